@@ -0,0 +1,124 @@
+#ifndef ARQUEUE_H
+#define ARQUEUE_H
+
+#include <string>
+#include <chrono>
+#include <functional>
+#include <hiredis.h>
+#include <async.h>
+#include <stdint.h>
+#include "rqueue.h"
+#include "wait_strategy.h"
+
+
+namespace util
+{
+    /// @brief Event loop driven variant of the redis worker queue manager.
+    /// Keeps a configurable number of lease commands in flight on a single
+    /// asynchronous connection and pipelines completions on the same
+    /// connection. All member functions must be called from the thread
+    /// running the event loop, typically from within the item handler.
+    class AsyncRedisQueue
+    {
+        public:
+            /// @brief Callback receiving every leased item
+            typedef std::function<void(AsyncRedisQueue&, LeasedItem const&)> ItemHandler;
+
+        private:
+            /// @brief Asynchronous redis context driven by the poll adapter
+            redisAsyncContext *ctx;
+            std::string _session;
+            std::string _main_q_name;
+            std::string _processing_q_name;
+            std::string _payloads_name;
+            std::string _lease_key_prefix;
+            /// @brief Counter of completed items, read by the inspector
+            std::string _completed_name;
+            std::string _lease_sha;
+            std::string _complete_sha;
+            std::string _duration;
+            ItemHandler _on_item;
+
+            /// @brief Number of lease commands kept in flight
+            size_t _in_flight;
+            /// @brief Lease slots waiting to be reissued after the main
+            /// queue was found empty
+            size_t _idle_slots = 0;
+            /// @brief Commands awaiting a reply
+            size_t _pending = 0;
+            bool _loading = false;
+            bool _stopping = false;
+            /// @brief Delay before an empty main queue is polled again, 
+            /// growing while the queue stays empty
+            rq::Backoff _idle_backoff;
+            std::chrono::steady_clock::time_point _idle_until;
+
+            /// Redis command stubs
+            const char *EVAL = "EVAL";
+            const char *EVALSHA = "EVALSHA";
+
+            void _load(const char *script, std::string *sha);
+            void _script_load();
+            void _lease();
+            /// @brief Sends the complete script for an item owned by the 
+            /// call, which is freed once its reply arrives
+            void _complete(LeasedItem *leased);
+            void _refill();
+
+            /// Reply and connection callbacks, privdata is the queue manager 
+            /// for leases, the digest for script loads and the item for 
+            /// completions
+            static void _on_script_load(redisAsyncContext *ac, void *r, void *privdata);
+            static void _on_lease(redisAsyncContext *ac, void *r, void *privdata);
+            static void _on_complete(redisAsyncContext *ac, void *r, void *privdata);
+            static void _on_disconnect(const redisAsyncContext *ac, int status);
+
+        public:
+            AsyncRedisQueue() = delete;
+            AsyncRedisQueue(AsyncRedisQueue const&) = delete;
+            AsyncRedisQueue operator=(AsyncRedisQueue const&) = delete;
+
+            ~AsyncRedisQueue()
+            {
+                if (ctx != nullptr) redisAsyncFree(ctx);
+            }
+
+            /// @brief Constructor for asynchronous Redis queue manager
+            /// @param queue_name Name of the main messaging channel
+            /// @param host_name Redis server host e.g., "localhost",
+            /// "127.0.0.1", "redis" etc
+            /// @param port Port number for redis server, default 6379
+            /// @param in_flight Number of lease commands kept in flight
+            /// @param duration Maximum duration to keep an item in the
+            /// processing queue
+            /// @param idle_backoff Longest delay before polling an empty main 
+            /// queue again, the delay starts at a millisecond and doubles 
+            /// while the queue stays empty
+            AsyncRedisQueue(
+                std::string const &queue_name,
+                std::string const &host_name,
+                uint16_t port = 6379,
+                size_t in_flight = 8,
+                uint8_t duration = 5,
+                std::chrono::milliseconds idle_backoff = std::chrono::milliseconds(100));
+
+            /// @brief Accessor for session identifier
+            inline std::string session_id() const  { return _session; }
+
+            /// @brief Runs the event loop and delivers leased items to the
+            /// handler until stop() is called and all pending commands have
+            /// been answered, or the connection is lost
+            void run(ItemHandler on_item);
+
+            /// @brief Stops issuing leases, run() returns once pending
+            /// replies have been received
+            void stop();
+
+            /// @brief Marks the completion of processing a leased item,
+            /// pipelined on the event loop connection
+            void complete(LeasedItem const &leased);
+    };
+} // namespace util
+
+
+#endif // ARQUEUE_H
@@ -0,0 +1,277 @@
+#ifndef COQUEUE_H
+#define COQUEUE_H
+
+#include <string>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <initializer_list>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <hiredis.h>
+#include <async.h>
+#include <stdint.h>
+#include "rqueue.h"
+#include "keys.h"
+#include "wait_strategy.h"
+
+
+namespace util
+{
+    class CoRedisQueue;
+
+    /// @brief Logical worker running on the event loop of a CoRedisQueue.
+    /// A task starts once it is spawned and is resumed by the loop whenever
+    /// an operation it awaits has finished.
+    class CoTask
+    {
+        public:
+            struct promise_type
+            {
+                std::exception_ptr error;
+
+                CoTask get_return_object()
+                {
+                    return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+                /// @brief Finished tasks stay suspended, the loop destroys
+                /// them after checking for an exception
+                std::suspend_always final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { error = std::current_exception(); }
+            };
+
+        private:
+            std::coroutine_handle<promise_type> _handle;
+
+            explicit CoTask(std::coroutine_handle<promise_type> handle): _handle(handle) {}
+            friend class CoRedisQueue;
+
+        public:
+            CoTask(CoTask const&) = delete;
+            CoTask operator=(CoTask const&) = delete;
+            CoTask(CoTask &&other) noexcept: _handle(other._handle) { other._handle = {}; }
+
+            ~CoTask()
+            {
+                if (_handle) _handle.destroy();
+            }
+    };
+
+    /// @brief Coroutine variant of the redis worker queue manager. Leases
+    /// and completions are awaited instead of blocking the calling thread,
+    /// so thousands of logical workers can run on the single thread of the
+    /// event loop over one asynchronous connection:
+    ///     CoTask worker(CoRedisQueue &q)
+    ///     {
+    ///         while (std::optional<LeasedItem> leased = co_await q.lease())
+    ///             co_await q.complete(*leased);
+    ///     }
+    /// Workers waiting for an item share one lease script call, which takes
+    /// as many items as there are waiters. Supports the list and sorted set
+    /// layouts. All member functions must be called from the thread running
+    /// the event loop.
+    class CoRedisQueue
+    {
+        public:
+            /// @brief Awaitable lease, resumes with the leased item or with
+            /// nothing once the timeout expired or the queue was stopped
+            class LeaseAwaiter
+            {
+                CoRedisQueue *_q;
+                std::chrono::steady_clock::time_point _deadline;
+                bool _forever;
+                std::optional<LeasedItem> _leased;
+                std::coroutine_handle<> _handle;
+                friend class CoRedisQueue;
+
+                public:
+                LeaseAwaiter(CoRedisQueue *q, std::chrono::milliseconds timeout)
+                :_q(q), _deadline(std::chrono::steady_clock::now() + timeout),
+                _forever(timeout.count() == 0) {}
+
+                bool await_ready() const noexcept;
+                void await_suspend(std::coroutine_handle<> handle);
+                std::optional<LeasedItem> await_resume() { return std::move(_leased); }
+            };
+
+            /// @brief Awaitable completion, resumes with true if the lease
+            /// of the item was still held
+            class CompleteAwaiter
+            {
+                CoRedisQueue *_q;
+                LeasedItem const &_leased;
+                bool _held = false;
+                std::coroutine_handle<> _handle;
+                friend class CoRedisQueue;
+
+                public:
+                CompleteAwaiter(CoRedisQueue *q, LeasedItem const &leased)
+                :_q(q), _leased(leased) {}
+
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> handle);
+                bool await_resume() const noexcept { return _held; }
+            };
+
+            /// @brief Awaitable pause of a task, which lets the others run
+            class SleepAwaiter
+            {
+                CoRedisQueue *_q;
+                std::chrono::steady_clock::time_point _until;
+                friend class CoRedisQueue;
+
+                public:
+                SleepAwaiter(CoRedisQueue *q, std::chrono::milliseconds duration)
+                :_q(q), _until(std::chrono::steady_clock::now() + duration) {}
+
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> handle);
+                void await_resume() const noexcept {}
+            };
+
+        private:
+            /// @brief Asynchronous redis context driven by the poll adapter
+            redisAsyncContext *ctx;
+            std::string _session;
+            std::string _main_q_name;
+            std::string _processing_q_name;
+            std::string _payloads_name;
+            std::string _lease_key_prefix;
+            /// @brief Counter of completed items, read by the inspector
+            std::string _completed_name;
+            rq::Layout _layout;
+            const char *_lease_script;
+            const char *_complete_script;
+            /// @brief Script digests, empty until SCRIPT LOAD has answered,
+            /// calls send the script body meanwhile
+            std::string _lease_sha;
+            std::string _complete_sha;
+            std::string _duration;
+            /// @brief Maximum number of items per lease script call
+            size_t _max_batch;
+
+            /// @brief Tasks spawned and not yet finished
+            std::vector<std::coroutine_handle<CoTask::promise_type>> _tasks;
+            /// @brief Coroutines to resume on the next turn of the loop,
+            /// reply callbacks never resume a coroutine themselves
+            std::deque<std::coroutine_handle<>> _ready;
+            /// @brief Leases waiting for the next lease script call
+            std::deque<LeaseAwaiter*> _waiting;
+            /// @brief Leases of the script call in flight
+            std::vector<LeaseAwaiter*> _leasing;
+            /// @brief Paused tasks with their wake up time
+            std::vector<std::pair<
+                std::chrono::steady_clock::time_point, std::coroutine_handle<>>> _sleeping;
+            /// @brief Commands awaiting a reply
+            size_t _pending = 0;
+            bool _stopping = false;
+            /// @brief Delay before an empty main queue is polled again,
+            /// growing while the queue stays empty
+            rq::Backoff _idle_backoff;
+            std::chrono::steady_clock::time_point _idle_until;
+            std::exception_ptr _error;
+
+            /// Redis command stubs
+            const char *EVALSHA = "EVALSHA";
+            const char *EVAL = "EVAL";
+
+            /// @brief Loads a script into the server cache, its digest is
+            /// stored once the reply arrives
+            void _load(const char *script, std::string *sha);
+            /// @brief Sends a script call by its digest, or with its body
+            /// while the digest is unknown, returns false if the command
+            /// could not be queued
+            bool _eval(
+                redisCallbackFn *callback, void *privdata, const char *script, 
+                std::string const &sha, std::initializer_list<std::string_view> args);
+            /// @brief Issues one lease script call for the waiting leases
+            void _dispatch();
+            /// @brief Resumes waiting leases and paused tasks that are due
+            void _expire(std::chrono::steady_clock::time_point now);
+            /// @brief Resumes every waiting lease with nothing
+            void _drain();
+            /// @brief Resumes the ready coroutines and reaps finished tasks
+            void _resume();
+
+            /// Reply and connection callbacks, privdata is the queue manager
+            /// or the completion awaiter
+            static void _on_script_load(redisAsyncContext *ac, void *r, void *privdata);
+            static void _on_lease(redisAsyncContext *ac, void *r, void *privdata);
+            static void _on_complete(redisAsyncContext *ac, void *r, void *privdata);
+            static void _on_disconnect(const redisAsyncContext *ac, int status);
+
+        public:
+            CoRedisQueue() = delete;
+            CoRedisQueue(CoRedisQueue const&) = delete;
+            CoRedisQueue operator=(CoRedisQueue const&) = delete;
+
+            ~CoRedisQueue();
+
+            /// @brief Constructor for coroutine Redis queue manager
+            /// @param queue_name Name of the main messaging channel
+            /// @param host_name Redis server host e.g., "localhost",
+            /// "127.0.0.1", "redis" etc
+            /// @param port Port number for redis server, default 6379
+            /// @param layout Layout of the items in processing, list or
+            /// sorted set
+            /// @param duration Maximum duration to keep an item in the
+            /// processing queue
+            /// @param max_batch Maximum number of items leased by one script
+            /// call for the waiting workers
+            /// @param idle_backoff Longest delay before polling an empty main
+            /// queue again, the delay starts at a millisecond and doubles
+            /// while the queue stays empty
+            CoRedisQueue(
+                std::string const &queue_name,
+                std::string const &host_name,
+                uint16_t port = 6379,
+                rq::Layout layout = rq::Layout::LIST,
+                uint8_t duration = 5,
+                size_t max_batch = 64,
+                std::chrono::milliseconds idle_backoff = std::chrono::milliseconds(100));
+
+            /// @brief Accessor for session identifier
+            inline std::string session_id() const  { return _session; }
+
+            /// @brief Leases a single item, waiting on the event loop until
+            /// an item is available or the timeout expires
+            /// @param timeout Time to wait for an item, zero waits until the
+            /// queue is stopped
+            LeaseAwaiter lease(std::chrono::milliseconds timeout = std::chrono::seconds(2))
+            {
+                return LeaseAwaiter(this, timeout);
+            }
+
+            /// @brief Marks the completion of processing a leased item
+            CompleteAwaiter complete(LeasedItem const &leased)
+            {
+                return CompleteAwaiter(this, leased);
+            }
+
+            /// @brief Pauses the awaiting task without blocking the others
+            SleepAwaiter sleep(std::chrono::milliseconds duration)
+            {
+                return SleepAwaiter(this, duration);
+            }
+
+            /// @brief Adds a task to the event loop, it starts on the next
+            /// turn of the loop
+            void spawn(CoTask task);
+
+            /// @brief Runs the event loop until every task has finished and
+            /// all pending replies have been received, or the connection is
+            /// lost. Rethrows the first exception escaping a task.
+            void run();
+
+            /// @brief Resumes waiting leases with nothing and lets every
+            /// further lease return nothing, so that the workers wind down
+            void stop();
+    };
+} // namespace util
+
+
+#endif // COQUEUE_H
@@ -0,0 +1,108 @@
+#ifndef INSPECTOR_H
+#define INSPECTOR_H
+
+#include <string>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <hiredis.h>
+#include <stdint.h>
+#include "rpool.h"
+#include "keys.h"
+
+
+namespace util
+{
+    /// @brief Rate limits for the queue inspector
+    struct InspectorOptions
+    {
+        /// @brief Layout of the items in processing
+        rq::Layout layout = rq::Layout::LIST;
+        /// @brief Lease duration in seconds used by the consumers, from
+        /// which the age of a lease is derived
+        uint8_t duration = 5;
+        /// @brief Maximum number of items in processing inspected by one
+        /// script call
+        size_t chunk = 100;
+        /// @brief Maximum number of chunks per snapshot, zero means a full
+        /// pass
+        size_t max_chunks = 10;
+        /// @brief Pause between two chunks of the same snapshot, so that the
+        /// inspector never holds the server for long
+        std::chrono::milliseconds pause = std::chrono::milliseconds(10);
+    };
+
+    /// @brief State of a queue at one point in time. Depths and counters
+    /// are read atomically with the first chunk of leases, later chunks only
+    /// add leases.
+    struct QueueSnapshot
+    {
+        /// @brief Server time of the snapshot in milliseconds
+        int64_t time_ms = 0;
+        size_t pending = 0;
+        size_t processing = 0;
+        /// @brief Number of items completed so far
+        uint64_t completed = 0;
+        /// @brief Number of items in processing inspected for leases
+        size_t inspected = 0;
+        /// @brief Inspected items without a live lease
+        size_t orphans = 0;
+        /// @brief Age of the oldest inspected lease in milliseconds
+        int64_t oldest_lease_ms = 0;
+        /// @brief Number of live leases by session
+        std::map<std::string, size_t> sessions;
+
+        /// @brief Whether the scan stopped before the end of processing
+        inline bool partial() const { return inspected < processing; }
+    };
+
+    /// @brief Items per second between two snapshots of the same queue
+    struct QueueRates
+    {
+        double arrivals = 0;
+        double completions = 0;
+
+        /// @brief Items leave a queue only by completion, so arrivals are
+        /// the growth of the queue plus the completions
+        static QueueRates between(QueueSnapshot const &before, QueueSnapshot const &after);
+    };
+
+    /// @brief Takes snapshots of a queue for operators, reading depths,
+    /// counters and leases with one script call per chunk of items in
+    /// processing instead of scanning the keyspace
+    class QueueInspector
+    {
+        private:
+            std::shared_ptr<RedisPool> _pool;
+            rq::QueueKeys _keys;
+            InspectorOptions _opts;
+            std::string _layout;
+            std::string _inspect_sha;
+
+            /// @brief Runs the inspect script on one chunk, merges the reply
+            /// into the snapshot and returns the next cursor
+            std::string _inspect(redisContext *ctx, std::string const &cursor, QueueSnapshot &snap);
+
+        public:
+            QueueInspector() = delete;
+            QueueInspector(QueueInspector const&) = delete;
+            QueueInspector operator=(QueueInspector const&) = delete;
+
+            /// @brief Constructor for the queue inspector
+            /// @param queue_name Name of the main messaging channel
+            /// @param pool Connection pool, the inspector holds one
+            /// connection for the duration of a chunk
+            /// @param opts Rate limits for the inspector
+            QueueInspector(
+                std::string const &queue_name,
+                std::shared_ptr<RedisPool> pool,
+                InspectorOptions const &opts = {});
+
+            /// @brief Takes a snapshot, inspecting at most max_chunks chunks
+            /// of items in processing
+            QueueSnapshot snapshot();
+    };
+} // namespace util
+
+
+#endif // INSPECTOR_H
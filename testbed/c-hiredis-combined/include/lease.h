@@ -0,0 +1,125 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <hiredis.h>
+
+
+namespace util
+{
+    /// @brief Reusable memory for hiredis reply objects. While an arena is
+    /// installed on a context, replies are built inside one of its blocks
+    /// instead of allocating every reply object, string and element array
+    /// on its own. A block returns to the arena once the lease owning its
+    /// reply is released, so a steady state consumer does not allocate per
+    /// item. Arenas are thread safe and can be shared by many queue handles.
+    class ReplyArena
+    {
+        public:
+            /// @brief Memory for the objects of a single reply
+            struct Block
+            {
+                std::unique_ptr<char[]> data;
+                size_t size;
+                size_t used;
+                /// @brief Allocations which did not fit the block
+                std::vector<void*> overflow;
+
+                /// @brief Bump allocates from the block, returns nullptr on
+                /// failure as expected by the hiredis reader
+                void *alloc(size_t n) noexcept;
+                void reset() noexcept;
+            };
+
+            /// @brief Installs a block on the reply reader of a context for
+            /// the lifetime of the scope. A null block leaves the default
+            /// reply functions in place.
+            class Scope
+            {
+                    redisReader *_reader;
+                    redisReplyObjectFunctions *_fn;
+                    void *_privdata;
+
+                public:
+                    Scope(redisContext *ctx, Block *block);
+                    Scope(Scope const&) = delete;
+                    Scope operator=(Scope const&) = delete;
+                    ~Scope();
+            };
+
+            /// @brief Reply object functions building replies in the block
+            /// passed as reader private data
+            static redisReplyObjectFunctions FUNCTIONS;
+
+        private:
+            size_t _block_size;
+            std::mutex _mtx;
+            std::vector<std::unique_ptr<Block>> _blocks;
+            std::vector<Block*> _free;
+
+        public:
+            ReplyArena(ReplyArena const&) = delete;
+            ReplyArena operator=(ReplyArena const&) = delete;
+
+            /// @param block_size Bytes per block, larger replies spill into
+            /// separate allocations which are freed with the block
+            explicit ReplyArena(size_t block_size = 64 * 1024);
+            ~ReplyArena();
+
+            /// @brief Checks out a free block, creating one if all are in use
+            Block *acquire();
+            /// @brief Returns a block, invalidating the reply built in it
+            void release(Block *block);
+            /// @brief Number of blocks created so far
+            size_t blocks();
+
+            /// @brief Frees a reply read from a context, replies built while
+            /// an arena was installed are reclaimed with their block instead
+            static void free_reply(redisContext *ctx, void *reply);
+    };
+
+    /// @brief Item leased from the queue which owns the reply of the lease
+    /// script. Item and lease key are views into the reply, so payloads of
+    /// any size and binary payloads are never copied. The reply is freed, or
+    /// its arena block returned, when the lease is completed or destroyed.
+    class Lease
+    {
+        private:
+            redisReply *_reply = nullptr;
+            std::shared_ptr<ReplyArena> _arena;
+            ReplyArena::Block *_block = nullptr;
+            std::string_view _item;
+            std::string_view _lease_key;
+
+        public:
+            Lease() = default;
+            Lease(Lease const&) = delete;
+            Lease operator=(Lease const&) = delete;
+            Lease(Lease &&other) noexcept;
+            Lease& operator=(Lease &&other) noexcept;
+            ~Lease() { reset(); }
+
+            /// @brief Takes ownership of a lease script reply
+            /// @param reply Reply of the lease script for a single item
+            /// @param arena Arena the reply was built in, if any
+            /// @param block Block of the arena holding the reply
+            Lease(
+                redisReply *reply,
+                std::shared_ptr<ReplyArena> arena = nullptr,
+                ReplyArena::Block *block = nullptr);
+
+            /// @brief Whether an item was leased
+            inline explicit operator bool() const { return _item.data() != nullptr; }
+            inline std::string_view item() const { return _item; }
+            inline std::string_view lease_key() const { return _lease_key; }
+
+            /// @brief Releases the reply, the views become invalid
+            void reset();
+    };
+} // namespace util
+
+
+#endif // LEASE_H
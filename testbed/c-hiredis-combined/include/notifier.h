@@ -0,0 +1,68 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <hiredis.h>
+#include <stdint.h>
+#include "wait_strategy.h"
+
+
+namespace util
+{
+    /// @brief Subscribes to the keyspace notifications of a main queue on a
+    /// dedicated connection and raises a wake up signal whenever an item is
+    /// pushed, so that idle workers do not have to poll the server. Requires
+    /// notify-keyspace-events to contain the K and l classes, or t for the
+    /// stream layout, whose stream key is passed as the queue name. The
+    /// connection is reestablished after errors, idle workers fall back to
+    /// their backoff in the meantime.
+    class KeyspaceNotifier
+    {
+        private:
+            std::string _host_name;
+            uint16_t _port;
+            timeval _timeout;
+            std::string _channel;
+            std::shared_ptr<rq::Wakeup> _wakeup;
+            std::atomic<bool> _stopping{false};
+            std::thread _thread;
+
+            /// @brief Connects and subscribes, returns nullptr on failure
+            redisContext *_subscribe();
+            /// @brief Adds the required event classes to the server config
+            void _configure();
+            void _run(redisContext *ctx);
+
+        public:
+            KeyspaceNotifier() = delete;
+            KeyspaceNotifier(KeyspaceNotifier const&) = delete;
+            KeyspaceNotifier operator=(KeyspaceNotifier const&) = delete;
+
+            /// @brief Constructor for the notifier, which subscribes before
+            /// it returns
+            /// @param queue_name Name of the main messaging channel
+            /// @param host_name Redis server host e.g., "localhost",
+            /// "127.0.0.1", "redis" etc
+            /// @param port Port number for redis server, default 6379
+            /// @param configure Whether to enable the required keyspace
+            /// events with CONFIG SET, which may be disabled on managed servers
+            /// @param wakeup Signal to raise, shared with the workers
+            KeyspaceNotifier(
+                std::string const &queue_name,
+                std::string const &host_name,
+                uint16_t port = 6379,
+                bool configure = false,
+                std::shared_ptr<rq::Wakeup> wakeup = std::make_shared<rq::Wakeup>());
+
+            ~KeyspaceNotifier();
+
+            /// @brief Wake up signal for the wait strategy of idle workers
+            inline std::shared_ptr<rq::Wakeup> wakeup() const { return _wakeup; }
+    };
+} // namespace util
+
+
+#endif // NOTIFIER_H
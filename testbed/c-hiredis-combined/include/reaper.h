@@ -0,0 +1,84 @@
+#ifndef REAPER_H
+#define REAPER_H
+
+#include <string>
+#include <chrono>
+#include <memory>
+#include <hiredis.h>
+#include <stdint.h>
+#include "rpool.h"
+#include "keys.h"
+#include "priority.h"
+
+
+namespace util
+{
+    /// @brief Rate limits for the lease reaper
+    struct ReaperOptions
+    {
+        /// @brief Layout of the items in processing
+        rq::Layout layout = rq::Layout::LIST;
+        /// @brief Whether the queue has priority levels, requeued items then
+        /// ring its doorbell, so that blocked priority consumers wake up
+        bool priorities = false;
+        /// @brief Maximum number of items inspected by one script call
+        size_t chunk = 100;
+        /// @brief Maximum number of chunks per run, zero means a full pass
+        size_t max_chunks = 0;
+        /// @brief Pause between two chunks of the same run, so that the
+        /// reaper never holds the server for long
+        std::chrono::milliseconds pause = std::chrono::milliseconds(10);
+        /// @brief Minimum time between the start of two runs
+        std::chrono::seconds interval = std::chrono::seconds(5);
+    };
+
+    /// @brief Requeues items whose lease has expired, e.g., because the 
+    /// worker holding them crashed, by scanning the processing queue in 
+    /// bounded chunks
+    class Reaper
+    {
+        private:
+            std::shared_ptr<RedisPool> _pool;
+            rq::QueueKeys _keys;
+            /// @brief Doorbell of a priority queue, empty otherwise
+            std::string _doorbell;
+            ReaperOptions _opts;
+            const char *_reap_script;
+            std::string _reap_sha;
+            /// @brief Value orphans are overwritten with before removal
+            std::string _tombstone;
+            std::chrono::steady_clock::time_point _last_run;
+            bool _ran = false;
+
+            /// @brief Runs the reap script on one chunk, returns the next 
+            /// cursor and adds the number of requeued items
+            long long _reap(redisContext *ctx, long long cursor, size_t &requeued);
+
+        public:
+            Reaper() = delete;
+            Reaper(Reaper const&) = delete;
+            Reaper operator=(Reaper const&) = delete;
+
+            /// @brief Constructor for the lease reaper
+            /// @param queue_name Name of the main messaging channel
+            /// @param pool Connection pool, the reaper holds one connection 
+            /// for the duration of a chunk
+            /// @param opts Rate limits for the reaper
+            Reaper(
+                std::string const &queue_name,
+                std::shared_ptr<RedisPool> pool,
+                ReaperOptions const &opts = {});
+
+            /// @brief Scans the processing queue and requeues orphans
+            /// @return Number of requeued items
+            size_t reap();
+
+            /// @brief Runs reap() only if the interval has elapsed since 
+            /// the last run, cheap enough to be called from a worker loop
+            /// @return Number of requeued items
+            size_t maybe_reap();
+    };
+} // namespace util
+
+
+#endif // REAPER_H
@@ -0,0 +1,100 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <charconv>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <hiredis.h>
+
+
+namespace util
+{
+    /// @brief Redis command pre-encoded in RESP once, of which only the
+    /// trailing arguments vary per call. Appending it skips the format string
+    /// parsing and the per call allocation of redisCommand, arguments are
+    /// encoded into a buffer per thread which keeps its capacity.
+    class RespTemplate
+    {
+        private:
+            /// @brief Array header and bulk strings of the fixed arguments
+            std::string _head;
+
+            static void _bulk(std::string &buf, std::string_view arg)
+            {
+                char len[24];
+                std::to_chars_result res = std::to_chars(len, len + sizeof(len), arg.size());
+                buf.push_back('$');
+                buf.append(len, res.ptr - len);
+                buf.append("\r\n", 2);
+                buf.append(arg.data(), arg.size());
+                buf.append("\r\n", 2);
+            }
+
+            template <typename Input>
+            void _encode(Input first, Input last, size_t tail_args)
+            {
+                char argc[24];
+                std::to_chars_result res = std::to_chars(
+                    argc, argc + sizeof(argc), (size_t) (last - first) + tail_args);
+                _head.push_back('*');
+                _head.append(argc, res.ptr - argc);
+                _head.append("\r\n", 2);
+                for (; first != last; ++first) _bulk(_head, *first);
+            }
+
+        public:
+            RespTemplate() = default;
+
+            /// @param head Fixed arguments starting with the command name
+            /// @param tail_args Number of arguments passed on every call
+            RespTemplate(std::initializer_list<std::string_view> head, size_t tail_args)
+            {
+                _encode(head.begin(), head.end(), tail_args);
+            }
+
+            /// @brief Template with a number of fixed arguments only known at
+            /// runtime, e.g., one key per priority level
+            RespTemplate(std::vector<std::string_view> const &head, size_t tail_args)
+            {
+                _encode(head.begin(), head.end(), tail_args);
+            }
+
+            /// @brief Encodes the command with the given trailing arguments,
+            /// the view is valid until the next call on the same thread
+            std::string_view format(std::initializer_list<std::string_view> tail) const
+            {
+                static thread_local std::string buf;
+                buf.assign(_head);
+                for (std::string_view arg: tail) _bulk(buf, arg);
+                return buf;
+            }
+
+            /// @brief Appends the command to the output buffer of a context
+            int append(redisContext *ctx, std::initializer_list<std::string_view> tail) const
+            {
+                std::string_view cmd = format(tail);
+                return redisAppendFormattedCommand(ctx, cmd.data(), cmd.size());
+            }
+    };
+
+    /// @brief Unsigned integer argument formatted into a stack buffer
+    struct IntArg
+    {
+        char buf[24];
+        std::string_view view;
+
+        explicit IntArg(unsigned long long value)
+        {
+            std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), value);
+            view = std::string_view(buf, res.ptr - buf);
+        }
+
+        IntArg(IntArg const&) = delete;
+        IntArg operator=(IntArg const&) = delete;
+    };
+} // namespace util
+
+
+#endif // RESP_H
@@ -0,0 +1,148 @@
+#ifndef RPOOL_H
+#define RPOOL_H
+
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
+#include <hiredis.h>
+#include <stdint.h>
+
+
+namespace util
+{
+    /// @brief Fixed size, thread safe pool of redis connections, which can be
+    /// shared by many queue handles within one process. Connections are
+    /// created lazily, checked with PING when they were idle for longer than
+    /// the health check interval and reconnected after connection errors.
+    class RedisPool
+    {
+        private:
+            /// @brief Idle connection together with the time it was returned
+            struct Slot
+            {
+                redisContext *ctx;
+                std::chrono::steady_clock::time_point last_used;
+            };
+
+            std::string _host_name;
+            uint16_t _port;
+            timeval _timeout;
+            size_t _size;
+            std::chrono::seconds _health_check;
+
+            std::mutex _mtx;
+            std::condition_variable _cv;
+            /// @brief Idle connections, reused in LIFO order to keep the
+            /// most recently used connections warm
+            std::vector<Slot> _idle;
+            /// @brief Number of live connections, idle or checked out
+            size_t _created = 0;
+            /// @brief SHA1 digests of scripts loaded through the pool
+            std::unordered_map<const char*, std::string> _shas;
+            /// @brief Key whose hash slot selects the cluster node, empty if
+            /// the pool connects to the host itself
+            std::string _route_key;
+            /// @brief Whether connections go to a replica of the slot
+            bool _replica = false;
+            /// @brief Node serving the slot, found when the last connection
+            /// was opened and asked first on the next lookup
+            std::string _node_host;
+            uint16_t _node_port = 0;
+
+            /// @brief Opens and verifies a new connection, throws on failure
+            redisContext *_connect();
+            /// @brief Opens a connection to the given server, nullptr on 
+            /// failure
+            redisContext *_open(std::string const &host_name, uint16_t port);
+            /// @brief Looks up the node serving the slot of the route key 
+            /// with CLUSTER SLOTS on a known node, false if it does not know
+            bool _resolve(
+                std::string const &host_name, uint16_t port, 
+                std::string &node_host, uint16_t &node_port);
+            /// @brief Validates an idle connection with PING
+            bool _ping(redisContext *ctx);
+            /// @brief Returns a connection to the pool, broken connections
+            /// are dropped and recreated on a later checkout
+            void _release(redisContext *ctx);
+
+        public:
+            /// @brief RAII handle for a checked out connection
+            class Connection
+            {
+                    RedisPool *_pool;
+                    redisContext *_ctx;
+
+                public:
+                    Connection(RedisPool *pool, redisContext *ctx): _pool(pool), _ctx(ctx) {}
+                    Connection(Connection const&) = delete;
+                    Connection operator=(Connection const&) = delete;
+                    Connection(Connection &&other) noexcept
+                    :_pool(other._pool), _ctx(other._ctx)
+                    {
+                        other._pool = nullptr;
+                        other._ctx = nullptr;
+                    }
+
+                    ~Connection()
+                    {
+                        if (_pool != nullptr) _pool -> _release(_ctx);
+                    }
+
+                    inline redisContext *get() const { return _ctx; }
+            };
+
+            RedisPool() = delete;
+            RedisPool(RedisPool const&) = delete;
+            RedisPool operator=(RedisPool const&) = delete;
+
+            /// @brief Frees idle connections, all connections must have been
+            /// returned to the pool
+            ~RedisPool();
+
+            /// @brief Constructor for the connection pool
+            /// @param host_name Redis server host e.g., "localhost",
+            /// "127.0.0.1", "redis" etc
+            /// @param port Port number for redis server, default 6379
+            /// @param size Maximum number of connections
+            /// @param timeout Connection timeout, default 1.5 seconds
+            /// @param health_check Idle time after which a connection is
+            /// validated before it is handed out again
+            RedisPool(
+                std::string const &host_name,
+                uint16_t port = 6379,
+                size_t size = 4,
+                timeval const &timeout = {1, 500000},
+                std::chrono::seconds health_check = std::chrono::seconds(30));
+
+            inline size_t size() const { return _size; }
+
+            /// @brief Treats the host as a seed node of a redis cluster and 
+            /// connects to the node serving the hash slot of the key instead.
+            /// The node is looked up again whenever a connection is opened, 
+            /// so that connections dropped after a failover follow the slot.
+            /// Must be called before the first connection is checked out.
+            /// @param key Key of the slot e.g., the hash tagged queue name
+            /// @param replica Connect to a replica of the slot in READONLY 
+            /// mode, e.g., for monitoring reads, the primary is used if the 
+            /// slot has no replica
+            void route(std::string const &key, bool replica = false);
+
+            /// @brief Checks out a connection, blocks while all connections
+            /// are in use
+            Connection acquire();
+
+            /// @brief Returns the SHA1 digest of a script, loading it on the
+            /// server only the first time it is requested through the pool
+            std::string script_sha(const char *script);
+
+            /// @brief Loads a script again on a checked out connection, e.g.,
+            /// after the server script cache was flushed
+            std::string reload_script(redisContext *ctx, const char *script);
+    };
+} // namespace util
+
+
+#endif // RPOOL_H
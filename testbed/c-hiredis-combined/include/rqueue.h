@@ -2,91 +2,324 @@
 #define RQUEUE_H
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <chrono>
+#include <string_view>
 #include <hiredis.h>
 #include <stdint.h>
+#include "rpool.h"
+#include "lease.h"
+#include "resp.h"
+#include "scripts.h"
+#include "heartbeat.h"
+#include "priority.h"
 
 
 namespace util
 {
+    /// @brief Item leased from the queue together with its lease key
+    struct LeasedItem
+    {
+        std::string item;
+        std::string lease_key;
+    };
+
     /// @brief Encapsulates utilities for a redis worker queue manager
     class RedisQueue
     {
         private:
-            /// @brief Internal queue types
-            enum QType {MAIN, PROCESSING};
-
-            /// @brief Redis context encapsulating server connection
-            redisContext *ctx;
+            /// @brief Pool of redis contexts encapsulating server connections,
+            /// a context is checked out for the duration of each operation
+            std::shared_ptr<RedisPool> _pool;
+            /// @brief Pool of the read only calls i.e., depth and lease 
+            /// checks, the queue pool unless reads go to a replica
+            std::shared_ptr<RedisPool> _reads;
             std::string _session;
             std::string _main_q_name;
+            /// @brief Processing list, in flight sorted set or stream, 
+            /// depending on the layout
             std::string _processing_q_name;
+            /// @brief Hash of items in processing, only used by the sorted 
+            /// set layout
+            std::string _payloads_name;
             std::string _lease_key_prefix;
+            /// @brief Counter of completed items, read by the inspector
+            std::string _completed_name;
+            /// @brief Consumer group of the stream layout
+            std::string _group;
+            rq::Layout _layout;
+            const char *_lease_script;
+            const char *_complete_script;
+            /// SHA1 digests of the preloaded server side scripts, fixed once
+            /// the queue is configured since a reload yields the same digest
+            std::string _lease_sha;
+            std::string _complete_sha;
+            std::string _lease_exists_sha;
+            std::string _extend_sha;
+            std::string _release_sha;
+            std::string _depth_sha;
+            /// @brief Pre-encoded commands of the per item path, taking the 
+            /// lease duration and count, the item and the item respectively
+            RespTemplate _lease_cmd;
+            RespTemplate _complete_cmd;
+            RespTemplate _lrem_cmd;
+            /// @brief Acknowledge and delete a stream entry by its id
+            RespTemplate _xack_cmd;
+            RespTemplate _xdel_cmd;
+            /// @brief Entry ids of items leased into caller buffers with the 
+            /// stream layout, complete only receives the item. Equal items 
+            /// leased more than once keep one entry each, and completing the 
+            /// item acknowledges one of them.
+            std::mutex _stream_ids_mtx;
+            std::unordered_multimap<std::string, std::string> _stream_ids;
+            /// @brief Cursors of the stream layout, the newest entry id seen 
+            /// by the last lease which found no item, after which blocking 
+            /// reads wait, and the entry id from which the next lease 
+            /// claims idle entries
+            std::mutex _stream_cursor_mtx;
+            std::string _stream_cursor;
+            std::string _claim_cursor = "0-0";
+            /// @brief Optional arena for the replies of zero copy leases
+            std::shared_ptr<ReplyArena> _arena;
+            /// @brief Priority levels leased from, a single level leases 
+            /// from the main queue only
+            rq::PrioritySchedule _priorities;
+            /// @brief Level keys from the highest to the lowest priority
+            std::vector<std::string> _level_names;
+            std::string _doorbell_name;
+            /// @brief Counts priority leases to pick their first level
+            std::atomic<uint64_t> _priority_ticket{0};
 
             /// Redis command stubs
-            const char *LLEN = "LLEN";
-            const char *EXISTS = "EXISTS";
-            const char *RPOPLPUSH = "RPOPLPUSH";
-            const char *BRPOPLPUSH = "BRPOPLPUSH";
-            const char *SETEX = "SETEX";
+            const char *ZREM = "ZREM";
+            const char *HDEL = "HDEL";
+            const char *BLMOVE = "BLMOVE";
+            const char *EVALSHA = "EVALSHA";
             const char *LREM = "LREM";
             const char *DEL = "DEL";
+            const char *INCRBY = "INCRBY";
+            const char *XACK = "XACK";
+            const char *XDEL = "XDEL";
 
-            /// @brief Internal utility function to generate a unique hash value 
-            /// for the item
-            inline size_t _key_for(const char *item);
             /// @brief Internal utility function to checks if the item exists in 
             /// the redis queue of leased items 
             bool _lease_exists(const char *item);
 
             /// Internal utility functions corresponding to redis 
             /// commands used in the implementation 
-            size_t _llen(RedisQueue::QType _q) const;
-            void _rpoplpush(bool blocking, uint8_t timeout, char *item);
-            void _setex(const char* item, uint8_t duration);
-            void _lrem(const char* item, uint8_t count = 0);
-            void _del(const char *item);
+            /// @brief Runs a preloaded script by its SHA1 digest, reloads the
+            /// script and retries once if the server script cache was flushed
+            redisReply *_evalsha(
+                redisContext *ctx, std::string const &sha, const char *script, 
+                int argc, const char **argv, size_t *argvlen) const;
+            /// @brief Encodes the per item commands with the current script 
+            /// digests
+            void _encode_commands();
+            /// @brief Runs a pre-encoded script call, reloads the script and 
+            /// retries once if the server script cache was flushed
+            redisReply *_run(
+                redisContext *ctx, RespTemplate const &cmd, const char *script, 
+                std::initializer_list<std::string_view> tail) const;
+            /// @brief Atomically moves up to count items to the processing 
+            /// queue and writes their leases, returns the raw script reply
+            redisReply *_lease(redisContext *ctx, size_t count, uint8_t duration);
+            /// @brief Leases a single item into a buffer of capacity bytes, 
+            /// returns false if the main queue is empty and throws if the 
+            /// item and its terminating null do not fit
+            bool _lease(redisContext *ctx, char *item, size_t capacity, uint8_t duration);
+            /// @brief Leases a single item into a reply owning lease, built 
+            /// in the arena if one is set
+            Lease _lease_one(redisContext *ctx, uint8_t duration);
+            /// @brief Runs the complete script for a binary safe item
+            void _complete(std::string_view item);
+            /// @brief Blocks until the main queue has an item without 
+            /// consuming it, returns false on timeout
+            bool _block(redisContext *ctx, double timeout);
+            /// @brief Blocking command of the layout behind _block
+            bool _wait(redisContext *ctx, double timeout);
+            /// @brief Creates the consumer group of the stream layout
+            void _create_group();
+            /// @brief Acknowledges and deletes a stream entry
+            void _ack(std::string_view id);
+            /// @brief Retries a lease attempt whenever the main queue 
+            /// receives an item until it succeeds or the timeout expires
+            template <typename Attempt>
+            bool _await(redisContext *ctx, uint8_t timeout, Attempt attempt);
+            /// @brief Extends the given leases of this session in one round 
+            /// trip, used by the heartbeat thread
+            std::vector<bool> _extend(std::vector<std::string> const &keys, uint8_t duration);
+
+            /// @brief Background lease heartbeat, declared last so that it 
+            /// stops before the pool is released
+            std::unique_ptr<rq::Heartbeat> _heartbeat;
         
         public:
             RedisQueue() = delete;
             RedisQueue(RedisQueue const&) = delete;
             RedisQueue operator=(RedisQueue const&) = delete;
             
-            ~RedisQueue()
-            {
-                if (ctx != nullptr) redisFree(ctx);
-            }
+            ~RedisQueue() = default;
 
-            /// @brief Constructor for Redis queue manager
+            /// @brief Constructor for Redis queue manager with a private 
+            /// connection pool, the second connection is only opened for 
+            /// the lease heartbeat
             /// @param queue_name Name of the main messaging channel
             /// @param host_name Redis server host e.g., "localhost", 
             /// "127.0.0.1", "redis" etc
             /// @param port Port number for redis server, default 6379 
             /// @param timeout Connection timeout, default 1.5 seconds
+            /// @param layout Layout of the items in processing, the list 
+            /// layout is compatible with existing queues, the stream layout 
+            /// needs producers adding stream entries
             RedisQueue(
                 std::string const &queue_name,
                 std::string const &host_name, 
                 uint16_t port = 6379,
-                timeval const &timeout = {1, 500000});
+                timeval const &timeout = {1, 500000},
+                rq::Layout layout = rq::Layout::LIST);
+
+            /// @brief Constructor for Redis queue manager sharing the 
+            /// connections of a pool with other handles. Construction does 
+            /// not need a round trip once the pool has loaded the scripts.
+            /// @param queue_name Name of the main messaging channel
+            /// @param pool Connection pool shared between threads
+            /// @param layout Layout of the items in processing
+            RedisQueue(
+                std::string const &queue_name,
+                std::shared_ptr<RedisPool> pool,
+                rq::Layout layout = rq::Layout::LIST);
 
             /// @brief Accessor for session identifier
             inline std::string session_id() const  { return _session; }
 
-            /// @brief Validator for empty queue
-            bool empty() const;
+            /// @brief Number of items waiting and in processing, read in a 
+            /// single atomic snapshot
+            rq::QueueDepth depth() const;
+
+            /// @brief Validator for empty queue, true if no item is waiting 
+            /// and no item is in processing
+            inline bool empty() const { return depth().empty(); }
+
+            /// @brief Builds the replies of zero copy leases in an arena, 
+            /// which can be shared with other handles
+            inline void use_arena(std::shared_ptr<ReplyArena> arena) { _arena = std::move(arena); }
+
+            /// @brief Sends the read only calls i.e., depth, empty and lease 
+            /// checks through a pool connected to a replica, so that 
+            /// monitoring does not load the primary. Replicas lag behind, so
+            /// the depth may be slightly stale. A null pool reads from the 
+            /// primary again.
+            /// @param replica Pool routed to a replica of the queue slot
+            void use_replica_reads(std::shared_ptr<RedisPool> replica);
+
+            /// @brief Leases from several priority levels, the highest 
+            /// non-empty level first. Items are published to the levels with 
+            /// a priority publisher, blocked leases wait on the doorbell of 
+            /// the queue. Must be called before the first lease, not 
+            /// supported by the stream layout.
+            /// @param levels Number of priority levels, level 0 is the main 
+            /// queue
+            /// @param weights Share of the leases starting at each level from
+            /// level 0, so that lower levels are not starved, empty for 
+            /// strict priorities
+            void use_priorities(size_t levels, std::vector<unsigned> const &weights = {});
 
             /// @brief Leases a given item from the queue, which essentially 
             /// means to pop the item from the main queue to and push to 
-            /// internal processing queue.
+            /// internal processing queue. The move and the lease key are 
+            /// written by a single server side script.
             /// @param item Buffer for storing the item currently in processing
             /// @param duration Maximum duration to keep the item in the 
             /// processing queue
             /// @param timeout Timeout for blocking the main queue
-            /// @param blocking Whether blocking variant of the RPOPLPUSH will 
-            /// be used.
+            /// @param blocking Whether to block until an item is available or
+            /// the timeout expires.
+            /// @deprecated The item is copied without a bound, so a buffer 
+            /// smaller than the item overflows. Use lease_item, or 
+            /// lease_into with the capacity of the buffer.
+            [[deprecated("Unbounded copy into the buffer, use lease_item or lease_into")]]
             void lease(char *item, uint8_t duration = 5, uint8_t timeout = 2, bool blocking = true);
 
-            /// @brief Marks the completion of processing a given item
+            /// @brief Leases a given item into a buffer of known size.
+            /// @param item Buffer for storing the item and its terminating 
+            /// null, set to an empty string if no item was leased
+            /// @param capacity Size of the buffer in bytes
+            /// @param duration Maximum duration to keep the item in the 
+            /// processing queue
+            /// @param timeout Timeout for blocking the main queue
+            /// @param blocking Whether to block until an item is available or
+            /// the timeout expires.
+            /// @return Whether an item was leased
+            /// @throws std::runtime_error If the item does not fit, the item 
+            /// stays leased until its lease expires. Use lease_item for 
+            /// payloads of unknown size or binary payloads.
+            bool lease_into(
+                char *item, size_t capacity, 
+                uint8_t duration = 5, uint8_t timeout = 2, bool blocking = true);
+
+            /// @brief Leases a single item without copying it out of the 
+            /// reply, the lease owns the reply until it is completed.
+            /// @param duration Maximum duration to keep the item in the 
+            /// processing queue
+            /// @param timeout Timeout for blocking the main queue
+            /// @param blocking Whether to block until an item is available or
+            /// the timeout expires.
+            /// @return Lease of the item, false on timeout
+            Lease lease_item(uint8_t duration = 5, uint8_t timeout = 2, bool blocking = true);
+
+            /// @brief Leases up to n items from the queue in one round trip.
+            /// @param n Maximum number of items to lease
+            /// @param duration Maximum duration to keep the items in the 
+            /// processing queue
+            /// @param timeout Timeout for blocking the main queue
+            /// @param blocking Whether to block until at least one item is 
+            /// available or the timeout expires.
+            /// @return Leased items with their lease keys, empty on timeout
+            std::vector<LeasedItem> lease_batch(
+                size_t n, uint8_t duration = 5, uint8_t timeout = 2, bool blocking = true);
+
+            /// @brief Marks the completion of processing a given item, with 
+            /// the stream layout only items leased by this handle into a 
+            /// buffer can be completed by item
             void complete(const char* item);
+
+            /// @brief Marks the completion of a zero copy lease and releases 
+            /// its reply
+            void complete(Lease &&lease);
+
+            /// @brief Marks the completion of processing a set of leased 
+            /// items with a single pipelined call
+            void complete_batch(std::vector<LeasedItem> const &items);
+
+            /// @brief Gives leased items back to the main queue before their
+            /// leases expire, e.g., items leased ahead but never started. 
+            /// Items whose lease was taken over by another session are left
+            /// alone, stream entries become claimable by the next lease.
+            /// @return Number of items given back
+            size_t release_batch(std::vector<LeasedItem> const &items);
+
+            /// @brief Starts a background thread, which extends all leases 
+            /// held by this handle until their items are completed. The 
+            /// leases are extended in one round trip per tick and only while 
+            /// they are still owned by this session.
+            /// @param duration Lease duration set on every tick
+            /// @param interval Time between two ticks, e.g., a third of the 
+            /// lease duration
+            /// @param on_lost Called from the heartbeat thread with the item 
+            /// and lease key of every lease that expired before it could be 
+            /// extended. The item may already be leased by another consumer.
+            void start_heartbeat(
+                uint8_t duration, 
+                std::chrono::milliseconds interval, 
+                rq::Heartbeat::LostHandler on_lost = {});
+
+            /// @brief Whether a lease is still held, always false while no 
+            /// heartbeat is running
+            bool lease_held(std::string const &lease_key) const;
     };
 } // namespace util
 
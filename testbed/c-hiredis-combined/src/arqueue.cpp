@@ -0,0 +1,232 @@
+#include <stdexcept>
+#include <string.h>
+#include <adapters/poll.h>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include "arqueue.h"
+#include "keys.h"
+#include "scripts.h"
+
+util::AsyncRedisQueue::AsyncRedisQueue(
+                std::string const &queue_name,
+                std::string const &host_name,
+                uint16_t port,
+                size_t in_flight,
+                uint8_t duration,
+                std::chrono::milliseconds idle_backoff)
+                :_main_q_name(queue_name), _in_flight(in_flight), 
+                _idle_backoff(std::chrono::milliseconds(1), idle_backoff)
+{
+    ctx = redisAsyncConnect(host_name.c_str(), port);
+    if(ctx == NULL || ctx -> err)
+    {
+        if (ctx)
+        {
+            printf("Encountered Connection Error: %s\n", ctx -> errstr);
+            redisAsyncFree(ctx);
+        } else
+        {
+            printf("Could not allocate Redis Context.\n");
+        }
+        throw std::runtime_error("Could not initialize AsyncRedisQueue, exiting...");
+    }
+    if (redisPollAttach(ctx) != REDIS_OK)
+    {
+        redisAsyncFree(ctx);
+        throw std::runtime_error("Could not attach event loop, exiting...");
+    }
+    ctx -> data = this;
+    redisAsyncSetDisconnectCallback(ctx, &AsyncRedisQueue::_on_disconnect);
+    _session = boost::uuids::to_string(boost::uuids::random_generator_mt19937()());
+    rq::QueueKeys keys(_main_q_name);
+    _processing_q_name = std::move(keys.processing);
+    _payloads_name = std::move(keys.payloads);
+    _lease_key_prefix = std::move(keys.lease_prefix);
+    _completed_name = std::move(keys.completed);
+    _duration = std::to_string(duration);
+}
+
+void util::AsyncRedisQueue::_load(const char *script, std::string *sha)
+{
+    if (ctx == nullptr) return;
+    if (redisAsyncCommand(
+        ctx, &AsyncRedisQueue::_on_script_load, sha, "SCRIPT LOAD %s", script) == REDIS_OK)
+    {
+        _pending += 1;
+    }
+}
+
+void util::AsyncRedisQueue::_script_load()
+{
+    if (_loading || ctx == nullptr) return;
+    _loading = true;
+    // Replies arrive in order, leases are refilled once their script is in
+    _load(rq::scripts::COMPLETE, &_complete_sha);
+    _load(rq::scripts::LEASE, &_lease_sha);
+}
+
+void util::AsyncRedisQueue::_lease()
+{
+    const char *argv[10] = {
+        EVALSHA, _lease_sha.c_str(), "3",
+        _main_q_name.c_str(), _processing_q_name.c_str(), _payloads_name.c_str(),
+        _lease_key_prefix.c_str(), _session.c_str(), _duration.c_str(), "1" };
+    size_t argvlen[10] = {
+        strlen(EVALSHA), _lease_sha.size(), 1,
+        _main_q_name.size(), _processing_q_name.size(), _payloads_name.size(),
+        _lease_key_prefix.size(), _session.size(), _duration.size(), 1 };
+    if (redisAsyncCommandArgv(
+        ctx, &AsyncRedisQueue::_on_lease, this, 10, argv, argvlen) == REDIS_OK)
+    {
+        _pending += 1;
+    }
+}
+
+void util::AsyncRedisQueue::_complete(LeasedItem *leased)
+{
+    // Sends the script body while the digest is unknown
+    bool body = _complete_sha.empty();
+    const char *argv[8] = {
+        body ? EVAL : EVALSHA, body ? rq::scripts::COMPLETE : _complete_sha.c_str(), "3",
+        _processing_q_name.c_str(), _payloads_name.c_str(), _completed_name.c_str(),
+        _lease_key_prefix.c_str(), leased -> item.data() };
+    size_t argvlen[8] = {
+        strlen(argv[0]), body ? strlen(rq::scripts::COMPLETE) : _complete_sha.size(), 1,
+        _processing_q_name.size(), _payloads_name.size(), _completed_name.size(),
+        _lease_key_prefix.size(), leased -> item.size() };
+    if (redisAsyncCommandArgv(
+        ctx, &AsyncRedisQueue::_on_complete, leased, 8, argv, argvlen) == REDIS_OK)
+    {
+        _pending += 1;
+        return;
+    }
+    delete leased;
+}
+
+void util::AsyncRedisQueue::_refill()
+{
+    if (_lease_sha.empty())
+    {
+        _script_load();
+        return;
+    }
+    for (; _idle_slots > 0 && !_stopping && ctx != nullptr; _idle_slots -= 1) _lease();
+}
+
+void util::AsyncRedisQueue::_on_script_load(redisAsyncContext *ac, void *r, void *privdata)
+{
+    AsyncRedisQueue *q = static_cast<AsyncRedisQueue*>(ac -> data);
+    redisReply *repl = static_cast<redisReply*>(r);
+    if (q -> _pending > 0) q -> _pending -= 1;
+    bool lease = privdata == &q -> _lease_sha;
+    if (lease) q -> _loading = false;
+    if (repl == nullptr) return;
+    if (repl -> type != REDIS_REPLY_STRING)
+    {
+        printf("Could not load script: %s\n", repl -> str);
+        q -> stop();
+        return;
+    }
+    static_cast<std::string*>(privdata) -> assign(repl -> str, repl -> len);
+    if (lease) q -> _refill();
+}
+
+void util::AsyncRedisQueue::_on_lease(redisAsyncContext *ac, void *r, void *privdata)
+{
+    (void) ac;
+    AsyncRedisQueue *q = static_cast<AsyncRedisQueue*>(privdata);
+    redisReply *repl = static_cast<redisReply*>(r);
+    if (q -> _pending > 0) q -> _pending -= 1;
+    // The slot is given back on every reply, without a reply the 
+    // connection is gone and the loop ends
+    q -> _idle_slots += 1;
+    if (repl == nullptr) return;
+    if (repl -> type == REDIS_REPLY_ERROR && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed, slots are refilled once it is reloaded
+        q -> _lease_sha.clear();
+        q -> _script_load();
+        return;
+    }
+    if (repl -> type == REDIS_REPLY_ERROR)
+    {
+        // Not an empty queue, but retried after the same delay
+        printf("Could not lease: %s\n", repl -> str);
+        q -> _idle_until = std::chrono::steady_clock::now() + q -> _idle_backoff.next();
+        return;
+    }
+    if (repl -> type == REDIS_REPLY_ARRAY && repl -> elements == 2)
+    {
+        LeasedItem leased = {
+            std::string(repl -> element[0] -> str, repl -> element[0] -> len),
+            std::string(repl -> element[1] -> str, repl -> element[1] -> len) };
+        q -> _on_item(*q, leased);
+        q -> _idle_backoff.reset();
+        // Keep the slot busy while there is work in the main queue
+        q -> _refill();
+        return;
+    }
+    q -> _idle_until = std::chrono::steady_clock::now() + q -> _idle_backoff.next();
+}
+
+void util::AsyncRedisQueue::_on_complete(redisAsyncContext *ac, void *r, void *privdata)
+{
+    AsyncRedisQueue *q = static_cast<AsyncRedisQueue*>(ac -> data);
+    LeasedItem *leased = static_cast<LeasedItem*>(privdata);
+    redisReply *repl = static_cast<redisReply*>(r);
+    if (q -> _pending > 0) q -> _pending -= 1;
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR 
+        && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed, the retry sends the script body
+        q -> _complete_sha.clear();
+        q -> _load(rq::scripts::COMPLETE, &q -> _complete_sha);
+        q -> _complete(leased);
+        return;
+    }
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR) 
+        printf("Could not complete: %s\n", repl -> str);
+    delete leased;
+}
+
+void util::AsyncRedisQueue::_on_disconnect(const redisAsyncContext *ac, int status)
+{
+    AsyncRedisQueue *q = static_cast<AsyncRedisQueue*>(ac -> data);
+    if (status != REDIS_OK) printf("Connection lost: %s\n", ac -> errstr);
+    // The context is freed by hiredis once this callback returns
+    q -> ctx = nullptr;
+    q -> _pending = 0;
+}
+
+void util::AsyncRedisQueue::run(ItemHandler on_item)
+{
+    _on_item = std::move(on_item);
+    _stopping = false;
+    _idle_slots = _in_flight;
+    _idle_until = std::chrono::steady_clock::now();
+    _refill();
+    while (ctx != nullptr && (!_stopping || _pending > 0))
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (_idle_slots > 0 && !_stopping && now >= _idle_until) _refill();
+        // Upper bound of a poll while only replies are awaited
+        double tick = 0.1;
+        if (_idle_slots > 0 && _idle_until > now)
+            tick = std::chrono::duration<double>(_idle_until - now).count();
+        redisPollTick(ctx, tick);
+    }
+}
+
+void util::AsyncRedisQueue::stop()
+{
+    _stopping = true;
+}
+
+void util::AsyncRedisQueue::complete(LeasedItem const &leased)
+{
+    if (ctx == nullptr) return;
+    // Pipelined behind any lease commands in flight, the copy is kept until
+    // the reply in case the script has to be sent again
+    _complete(new LeasedItem(leased));
+}
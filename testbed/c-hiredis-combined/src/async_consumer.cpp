@@ -0,0 +1,28 @@
+#include <iostream>
+#include <string>
+#include "arqueue.h"
+
+int main(int argc, char **argv)
+{
+    std::string host_name = (argc > 1) ? argv[1] : "localhost";
+    uint16_t port = (argc > 2) ? (uint16_t) std::stoul(argv[2]) : 8888;
+    std::string queue_name = (argc > 3) ? argv[3] : "foo";
+    size_t in_flight = (argc > 4) ? std::stoul(argv[4]) : 8;
+    util::AsyncRedisQueue q = { queue_name, host_name, port, in_flight };
+    std::cout << "Worker with Session ID: " << q.session_id() << "\n";
+    q.run([](util::AsyncRedisQueue &q, util::LeasedItem const &leased)
+    {
+        if (leased.item != "EOQ")
+        {
+            std::cout << "Processing item: " << leased.item << "\n";
+            // Here we would hand the item over to some actual work like 
+            // executing a CUDA kernel and complete it once that is done
+        } else
+        {
+            q.stop();
+        }
+        q.complete(leased);
+    });
+    std::cout << "All items processed, exiting..." << "\n";
+    return 0;
+}
@@ -1,32 +1,381 @@
+#include <atomic>
 #include <iostream>
 #include <string.h>
+#include <thread>
 #include <unistd.h>
+#include <getopt.h>
 #include "rqueue.h"
+#include "worker_pool.h"
+#include "prefetcher.h"
+#include "batcher.h"
+#include "notifier.h"
+#include "keys.h"
+#include "stats.h"
+#include "local_queue.h"
+#include "queue_uri.h"
+#include "priority.h"
+#include "sharded_queue.h"
+#include "cluster.h"
+#include "item_id.h"
+#include "cli.h"
+
+/// @brief Runs a worker pool on an in process queue, fed with the lines of
+/// the standard input by a producer thread in the same process
+static int run_local(std::string const &queue_name, size_t workers, size_t fetchers)
+{
+    rq::WorkerPoolOptions<std::chrono::milliseconds> opts;
+    opts.fetchers = fetchers;
+    opts.workers = workers;
+    opts.lease_duration = std::chrono::seconds(5);
+    opts.lease_timeout = std::chrono::seconds(2);
+    std::thread producer([&]()
+    {
+        rq::LocalQueue q = rq::LocalQueue(queue_name);
+        std::string line;
+        while (std::getline(std::cin, line))
+            while (!q.publish(line)) std::this_thread::sleep_for(std::chrono::microseconds(100));
+        while (!q.publish("EOQ")) std::this_thread::sleep_for(std::chrono::microseconds(100));
+    });
+    rq::WorkerPool<rq::LocalQueue, std::chrono::milliseconds> pool = {
+        [&]() { return std::make_unique<rq::LocalQueue>(queue_name); },
+        opts };
+    std::cout << "Local worker pool with " << fetchers << " fetchers, " << workers << " workers\n";
+    pool.run([](auto &pool, rq::LeasedItem const &leased)
+    {
+        if (leased.item == "EOQ")
+        {
+            pool.stop();
+            return;
+        }
+        std::cout << ("Processing item: " + leased.item + "\n");
+    });
+    producer.join();
+    std::cout << "All items processed, exiting..." << "\n";
+    return 0;
+}
+
+/// @brief Connection pool of a queue, on a cluster routed to the node 
+/// serving the slot of the hash tagged queue name
+static std::shared_ptr<util::RedisPool> connect(
+    std::string const &host_name, uint16_t port, size_t size, 
+    std::string const &queue_name, bool cluster, bool replica = false)
+{
+    auto conns = std::make_shared<util::RedisPool>(host_name, port, size);
+    if (cluster) conns -> route(queue_name, replica);
+    return conns;
+}
+
+/// @brief Runs a worker pool on a queue spread over shards, which are 
+/// assigned to the hosts in turn. Every fetcher leases from its own home 
+/// shard first and steals from the others while it is empty.
+static int run_sharded(
+    std::vector<std::string> const &hosts, uint16_t port, std::string const &queue_name,
+    size_t shards, size_t workers, size_t fetchers, rq::Layout layout,
+    size_t levels, std::vector<unsigned> const &weights, bool cluster)
+{
+    typedef rq::ShardedQueue<util::RedisQueue, uint8_t> ShardedQueue;
+    rq::WorkerPoolOptions<uint8_t> opts;
+    opts.fetchers = fetchers;
+    opts.workers = workers;
+    opts.exit_when_idle = true;
+    opts.lease_duration = 5;
+    opts.lease_timeout = 2;
+    // One connection pool per server, shared by the fetchers. On a cluster 
+    // every shard has its own hash tag and pool, so that the shards spread 
+    // over the primaries.
+    std::vector<std::string> names;
+    std::vector<std::shared_ptr<util::RedisPool>> conns;
+    for (size_t shard = 0; shard < shards; shard += 1)
+    {
+        names.push_back(cluster 
+            ? rq::hash_tag(rq::shard_name(queue_name, shard)) : rq::shard_name(queue_name, shard));
+        if (cluster || shard < hosts.size())
+            conns.push_back(connect(
+                hosts[shard % hosts.size()], port, fetchers, names.back(), cluster));
+    }
+    std::atomic<size_t> next_home{0};
+    rq::WorkerPool<ShardedQueue, uint8_t> pool = {
+        [&]()
+        {
+            std::vector<std::unique_ptr<util::RedisQueue>> queues;
+            for (size_t shard = 0; shard < shards; shard += 1)
+            {
+                queues.push_back(std::make_unique<util::RedisQueue>(
+                    names[shard], conns[shard % conns.size()], layout));
+                if (levels > 1) queues.back() -> use_priorities(levels, weights);
+            }
+            return std::make_unique<ShardedQueue>(std::move(queues), next_home++, 1);
+        },
+        opts };
+    std::cout << "Worker pool on " << shards << " shards with " << fetchers << " fetchers, " 
+        << workers << " workers\n";
+    pool.run([](auto&, util::LeasedItem const &leased)
+    {
+        std::cout << ("Processing item: " + std::string(rq::payload_of(leased.item)) + "\n");
+        sleep(2);
+    });
+    std::cout << "All items processed, exiting..." << "\n";
+    return 0;
+}
+
+/// @brief Options of the consumer, every mode is selected by its own option
+static const char *USAGE = 
+    "Usage: redis-consumer [options]\n"
+    "  -H, --host HOST        redis server, or comma separated servers of the shards\n"
+    "  -p, --port PORT        redis port, default 8888\n"
+    "  -q, --queue NAME       queue name, default foo\n"
+    "  -u, --uri URI          queue URI replacing host, port and queue, e.g.,\n"
+    "                         redis://localhost:6379/foo, redis-cluster://host:port/foo\n"
+    "                         or local://foo\n"
+    "  -w, --workers N        worker pool with N worker threads\n"
+    "  -f, --fetchers N       fetcher threads of the worker pool, default 1\n"
+    "  -n, --notify           wake idle fetchers with keyspace notifications\n"
+    "  -l, --layout LAYOUT    list, zset or stream, default list\n"
+    "      --levels N         number of priority levels, default 1\n"
+    "      --weights W        weights of the levels from level 0, e.g., 1,2,4\n"
+    "      --shards N         spread the queue over N shards\n"
+    "      --prefetch N       keep N items leased ahead of the single worker\n"
+    "      --batch N          hand the single worker batches of up to N items\n"
+    "      --batch-delay MS   time a batch waits to fill up, default 5\n"
+    "  -h, --help             show this help\n";
 
 int main(int argc, char **argv)
 {
-    std::string host_name = (argc > 1) ? argv[1] : "localhost";
-    uint16_t port = (argc > 2) ? *argv[2] : 8888;
-    std::string queue_name = (argc > 3) ? argv[3] : "foo";
-    util::RedisQueue q = { queue_name, host_name, port  };
-    std::cout << "Worker with Session ID: " << q.session_id() << "\n";
-    std::cout << "Initial queue state empty ?: " << q.empty() << "\n";
-    while (!q.empty())
+    std::string host_name = "localhost";
+    uint16_t port = 8888;
+    std::string queue_name = "foo";
+    rq::QueueUri uri;
+    bool has_uri = false;
+    // Worker pool mode is enabled by a non zero number of worker threads
+    size_t workers = 0;
+    size_t fetchers = 1;
+    // Idle fetchers are woken by keyspace notifications instead of polling
+    bool notify = false;
+    rq::Layout layout = rq::Layout::LIST;
+    // Number of priority levels and their weights from level 0 e.g., 1,2,4, 
+    // without weights higher levels are always served first
+    size_t levels = 1;
+    std::vector<unsigned> weights;
+    // Spreads the queue over shards, the host may be a comma separated list 
+    // of servers holding the shards in turn
+    size_t shards = 1;
+    // Keeps the given number of items leased ahead of the single worker, so 
+    // that the next lease overlaps with the work on the current item
+    size_t prefetch = 0;
+    // Hands the single worker batches of up to the given number of items, 
+    // waiting at most the given milliseconds for a batch to fill up
+    size_t max_batch = 1;
+    std::chrono::milliseconds max_delay(5);
+    enum { LEVELS = 256, WEIGHTS, SHARDS, PREFETCH, BATCH, BATCH_DELAY };
+    const option options[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "queue", required_argument, nullptr, 'q' },
+        { "uri", required_argument, nullptr, 'u' },
+        { "workers", required_argument, nullptr, 'w' },
+        { "fetchers", required_argument, nullptr, 'f' },
+        { "notify", no_argument, nullptr, 'n' },
+        { "layout", required_argument, nullptr, 'l' },
+        { "levels", required_argument, nullptr, LEVELS },
+        { "weights", required_argument, nullptr, WEIGHTS },
+        { "shards", required_argument, nullptr, SHARDS },
+        { "prefetch", required_argument, nullptr, PREFETCH },
+        { "batch", required_argument, nullptr, BATCH },
+        { "batch-delay", required_argument, nullptr, BATCH_DELAY },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 } };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "H:p:q:u:w:f:nl:h", options, nullptr)) != -1)
     {
-        char *item = (char*) malloc(10 * sizeof(char));
-        q.lease(item);
-        if(strlen(item) > 0 && strcmp(item, "END") != 0)
+        switch (opt)
         {
-            std::cout << "Processing item: " << item << "\n";
+            case 'H': host_name = optarg; break;
+            case 'p': port = rq::cli::port(optarg); break;
+            case 'q': queue_name = optarg; break;
+            case 'u':
+                uri = rq::QueueUri::parse(optarg);
+                has_uri = true;
+                break;
+            case 'w': workers = rq::cli::number("workers", optarg); break;
+            case 'f': fetchers = rq::cli::number("fetchers", optarg); break;
+            case 'n': notify = true; break;
+            case 'l': layout = rq::layout_from(optarg); break;
+            case LEVELS: levels = rq::cli::number("levels", optarg); break;
+            case WEIGHTS: weights = rq::weights_from(optarg); break;
+            case SHARDS: shards = rq::cli::number("shards", optarg); break;
+            case PREFETCH: prefetch = rq::cli::number("prefetch", optarg); break;
+            case BATCH: max_batch = rq::cli::number("batch", optarg); break;
+            case BATCH_DELAY: 
+                max_delay = std::chrono::milliseconds(rq::cli::number("batch-delay", optarg));
+                break;
+            case 'h':
+                std::cout << USAGE;
+                return 0;
+            default:
+                std::cout << USAGE;
+                return 1;
+        }
+    }
+    if (has_uri)
+    {
+        host_name = uri.host;
+        port = uri.port;
+        queue_name = uri.queue;
+    }
+    // All keys of a queue on a cluster share the slot of its hash tag
+    std::string base_name = queue_name;
+    if (uri.cluster) queue_name = rq::hash_tag(queue_name);
+    if (uri.scheme == rq::QueueUri::Scheme::LOCAL) return run_local(queue_name, workers, fetchers);
+    // Counters and latency histograms are written to the file named by 
+    // RQUEUE_STATS every 10 seconds, as JSON if it ends with .json and as 
+    // Prometheus text otherwise
+    std::unique_ptr<rq::stats::Exporter> exporter;
+    if (const char *path = getenv("RQUEUE_STATS"))
+        exporter = std::make_unique<rq::stats::Exporter>(path, std::chrono::seconds(10));
+    // Producers push into the stream itself with the stream layout and ring
+    // the doorbell of priority queues
+    std::string notify_key = (layout == rq::Layout::STREAM) 
+        ? queue_name + rq::processing_suffix(layout) 
+        : (levels > 1) ? rq::doorbell_key(queue_name) : queue_name;
+    if (shards > 1)
+    {
+        if (workers == 0 || notify) 
+            throw std::runtime_error("Sharded queues need the worker pool without notifications");
+        return run_sharded(
+            rq::list_from(host_name), port, base_name, shards, workers, 
+            fetchers, layout, levels, weights, uri.cluster);
+    }
+    // Notifications are published by the node of the key only
+    if (notify && uri.cluster) 
+        throw std::runtime_error("Keyspace notifications are not supported on a cluster");
+    std::shared_ptr<util::RedisPool> replica;
+    if (uri.replica_reads) replica = connect(host_name, port, 1, queue_name, true, true);
+    if (workers > 0)
+    {
+        rq::WorkerPoolOptions<uint8_t> opts;
+        opts.fetchers = fetchers;
+        opts.workers = workers;
+        opts.exit_when_idle = true;
+        opts.lease_duration = 5;
+        opts.lease_timeout = 2;
+        std::unique_ptr<util::KeyspaceNotifier> notifier;
+        if (notify)
+        {
+            notifier = std::make_unique<util::KeyspaceNotifier>(notify_key, host_name, port, true);
+            opts.wait.wakeup = notifier -> wakeup();
+        }
+        // Fetchers share one connection pool instead of connecting on their own
+        auto conns = connect(host_name, port, fetchers, queue_name, uri.cluster);
+        rq::WorkerPool<util::RedisQueue, uint8_t> pool = {
+            [&]() 
+            { 
+                auto q = std::make_unique<util::RedisQueue>(queue_name, conns, layout);
+                if (levels > 1) q -> use_priorities(levels, weights);
+                if (replica) q -> use_replica_reads(replica);
+                return q;
+            },
+            opts };
+        std::cout << "Worker pool with " << fetchers << " fetchers, " << workers << " workers\n";
+        pool.run([](auto&, util::LeasedItem const &leased)
+        {
+            std::cout << ("Processing item: " + std::string(rq::payload_of(leased.item)) + "\n");
             // Here we would do some actual work instead of sleeping like 
             // executing a CUDA kernel
             sleep(2);
-            q.complete(item);
-            free(item);
+        });
+        std::cout << "All items processed, exiting..." << "\n";
+        return 0;
+    }
+    if (max_batch > 1)
+    {
+        rq::BatchOptions<uint8_t> opts;
+        opts.max_batch = max_batch;
+        opts.max_delay = max_delay;
+        opts.exit_when_idle = true;
+        opts.lease_duration = 5;
+        opts.lease_timeout = 2;
+        opts.heartbeat = std::chrono::milliseconds(5000 / 3);
+        auto q = std::make_unique<util::RedisQueue>(
+            queue_name, connect(host_name, port, 2, queue_name, uri.cluster), layout);
+        if (levels > 1) q -> use_priorities(levels, weights);
+        if (replica) q -> use_replica_reads(replica);
+        std::cout << "Worker with Session ID: " << q -> session_id() 
+            << ", batches of up to " << max_batch << " items\n";
+        rq::Batcher<util::RedisQueue, uint8_t> batcher = { std::move(q), opts };
+        batcher.run([](auto&, auto batch, rq::BatchOutcome &outcome)
+        {
+            std::cout << ("Processing batch of " + std::to_string(batch.size()) + " items\n");
+            for (size_t idx = 0; idx < batch.size(); idx += 1)
+            {
+                // Empty payloads stand for items the kernel cannot process, 
+                // they return to the queue without the rest of the batch
+                if (rq::payload_of(batch[idx].item).empty()) outcome.fail(idx);
+            }
+            // Here we would launch a single CUDA kernel over the whole batch
+            sleep(2);
+        });
+        std::cout << "All items processed, exiting..." << "\n";
+        return 0;
+    }
+    if (prefetch > 0)
+    {
+        rq::PrefetchOptions<uint8_t> opts;
+        opts.depth = prefetch;
+        opts.lease_duration = 5;
+        opts.lease_timeout = 2;
+        // Buffered items are renewed while they wait for the worker
+        opts.heartbeat = std::chrono::milliseconds(5000 / 3);
+        // Connections of the lease thread, the heartbeat and the idle checks
+        auto q = std::make_unique<util::RedisQueue>(
+            queue_name, connect(host_name, port, 3, queue_name, uri.cluster), layout);
+        if (levels > 1) q -> use_priorities(levels, weights);
+        if (replica) q -> use_replica_reads(replica);
+        std::cout << "Worker with Session ID: " << q -> session_id() 
+            << ", prefetching " << prefetch << " items\n";
+        rq::Prefetcher<util::RedisQueue, uint8_t> prefetcher = { std::move(q), opts };
+        while (true)
+        {
+            std::optional<util::LeasedItem> leased = prefetcher.next();
+            if (!leased)
+            {
+                // Completions are acknowledged in the background, so an item
+                // may briefly count as in processing after its last lease
+                if (prefetcher.queue().empty()) break;
+                continue;
+            }
+            std::cout << "Processing item: " << rq::payload_of(leased -> item) << "\n";
+            sleep(2);
+            prefetcher.complete(std::move(*leased));
+        }
+        prefetcher.stop();
+        std::cout << "All items processed, exiting..." << "\n";
+        return 0;
+    }
+    util::RedisQueue q = { queue_name, connect(host_name, port, 2, queue_name, uri.cluster), layout };
+    if (levels > 1) q.use_priorities(levels, weights);
+    if (replica) q.use_replica_reads(replica);
+    std::cout << "Worker with Session ID: " << q.session_id() << "\n";
+    std::cout << "Initial queue state empty ?: " << q.empty() << "\n";
+    // Replies of the leases are built in reusable arena blocks and items are
+    // read in place, so the loop does not allocate or copy per item, see 
+    // test/alloc_check.cpp for the allocations left in hiredis
+    q.use_arena(std::make_shared<util::ReplyArena>());
+    while (true)
+    {
+        util::Lease lease = q.lease_item();
+        if (!lease)
+        {
+            // The lease blocked on the server until its timeout, so the queue
+            // is only inspected while idle. Items still in processing may 
+            // return to the queue once their lease expires.
+            if (q.empty()) break;
             continue;
         }
-        free(item);
-        break;
+        std::cout << "Processing item: " << rq::payload_of(lease.item()) << "\n";
+        // Here we would do some actual work instead of sleeping like 
+        // executing a CUDA kernel
+        sleep(2);
+        q.complete(std::move(lease));
     }
     std::cout << "All items processed, exiting..." << "\n";
     return 0;
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <thread>
+#include <utility>
+#include <adapters/poll.h>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include "coqueue.h"
+#include "keys.h"
+#include "scripts.h"
+
+util::CoRedisQueue::CoRedisQueue(
+                std::string const &queue_name,
+                std::string const &host_name,
+                uint16_t port,
+                rq::Layout layout,
+                uint8_t duration,
+                size_t max_batch,
+                std::chrono::milliseconds idle_backoff)
+                :_main_q_name(queue_name), _layout(layout), 
+                _max_batch(std::max<size_t>(max_batch, 1)),
+                _idle_backoff(std::chrono::milliseconds(1), idle_backoff)
+{
+    if (_layout == rq::Layout::STREAM)
+        throw std::runtime_error("The coroutine queue does not support the stream layout");
+    ctx = redisAsyncConnect(host_name.c_str(), port);
+    if(ctx == NULL || ctx -> err)
+    {
+        if (ctx)
+        {
+            printf("Encountered Connection Error: %s\n", ctx -> errstr);
+            redisAsyncFree(ctx);
+        } else
+        {
+            printf("Could not allocate Redis Context.\n");
+        }
+        throw std::runtime_error("Could not initialize CoRedisQueue, exiting...");
+    }
+    if (redisPollAttach(ctx) != REDIS_OK)
+    {
+        redisAsyncFree(ctx);
+        throw std::runtime_error("Could not attach event loop, exiting...");
+    }
+    ctx -> data = this;
+    redisAsyncSetDisconnectCallback(ctx, &CoRedisQueue::_on_disconnect);
+    _session = boost::uuids::to_string(boost::uuids::random_generator_mt19937()());
+    rq::QueueKeys keys(_main_q_name, _layout);
+    _processing_q_name = std::move(keys.processing);
+    _payloads_name = std::move(keys.payloads);
+    _lease_key_prefix = std::move(keys.lease_prefix);
+    _completed_name = std::move(keys.completed);
+    _lease_script = (_layout == rq::Layout::ZSET) ? rq::scripts::LEASE_ZSET : rq::scripts::LEASE;
+    _complete_script = (_layout == rq::Layout::ZSET)
+        ? rq::scripts::COMPLETE_ZSET : rq::scripts::COMPLETE;
+    _duration = std::to_string(duration);
+    _idle_until = std::chrono::steady_clock::now();
+    // Queued until the connection is established
+    _load(_lease_script, &_lease_sha);
+    _load(_complete_script, &_complete_sha);
+}
+
+util::CoRedisQueue::~CoRedisQueue()
+{
+    // Pending callbacks run with a null reply before the context is freed,
+    // so the frames of their awaiters must still exist
+    if (ctx != nullptr) redisAsyncFree(ctx);
+    for (std::coroutine_handle<CoTask::promise_type> task: _tasks) task.destroy();
+}
+
+void util::CoRedisQueue::_load(const char *script, std::string *sha)
+{
+    if (ctx == nullptr) return;
+    if (redisAsyncCommand(
+        ctx, &CoRedisQueue::_on_script_load, sha, "SCRIPT LOAD %s", script) == REDIS_OK)
+    {
+        _pending += 1;
+    }
+}
+
+bool util::CoRedisQueue::_eval(
+    redisCallbackFn *callback, void *privdata, const char *script,
+    std::string const &sha, std::initializer_list<std::string_view> args)
+{
+    if (ctx == nullptr) return false;
+    bool body = sha.empty();
+    std::vector<const char*> argv = { body ? EVAL : EVALSHA, body ? script : sha.c_str() };
+    std::vector<size_t> argvlen = { strlen(argv[0]), body ? strlen(script) : sha.size() };
+    for (std::string_view arg: args)
+    {
+        argv.push_back(arg.data());
+        argvlen.push_back(arg.size());
+    }
+    if (redisAsyncCommandArgv(
+        ctx, callback, privdata, argv.size(), argv.data(), argvlen.data()) != REDIS_OK)
+    {
+        return false;
+    }
+    _pending += 1;
+    return true;
+}
+
+void util::CoRedisQueue::_dispatch()
+{
+    if (!_leasing.empty() || _waiting.empty() || ctx == nullptr) return;
+    size_t count = std::min(_waiting.size(), _max_batch);
+    _leasing.assign(_waiting.begin(), _waiting.begin() + count);
+    _waiting.erase(_waiting.begin(), _waiting.begin() + count);
+    std::string n = std::to_string(count);
+    if (!_eval(
+        &CoRedisQueue::_on_lease, this, _lease_script, _lease_sha,
+        { "3", _main_q_name, _processing_q_name, _payloads_name,
+          _lease_key_prefix, _session, _duration, n }))
+    {
+        _waiting.insert(_waiting.begin(), _leasing.begin(), _leasing.end());
+        _leasing.clear();
+    }
+}
+
+void util::CoRedisQueue::_expire(std::chrono::steady_clock::time_point now)
+{
+    auto expired = [&](LeaseAwaiter *lease)
+    {
+        if (lease -> _forever || lease -> _deadline > now) return false;
+        _ready.push_back(lease -> _handle);
+        return true;
+    };
+    _waiting.erase(std::remove_if(_waiting.begin(), _waiting.end(), expired), _waiting.end());
+    auto due = [&](auto const &sleeper)
+    {
+        if (sleeper.first > now) return false;
+        _ready.push_back(sleeper.second);
+        return true;
+    };
+    _sleeping.erase(std::remove_if(_sleeping.begin(), _sleeping.end(), due), _sleeping.end());
+}
+
+void util::CoRedisQueue::_drain()
+{
+    for (LeaseAwaiter *lease: _waiting) _ready.push_back(lease -> _handle);
+    _waiting.clear();
+}
+
+void util::CoRedisQueue::_resume()
+{
+    std::deque<std::coroutine_handle<>> ready;
+    ready.swap(_ready);
+    bool finished = false;
+    for (std::coroutine_handle<> handle: ready)
+    {
+        handle.resume();
+        finished = finished || handle.done();
+    }
+    if (!finished) return;
+    auto reap = [&](std::coroutine_handle<CoTask::promise_type> task)
+    {
+        if (!task.done()) return false;
+        if (task.promise().error && !_error) _error = task.promise().error;
+        task.destroy();
+        return true;
+    };
+    _tasks.erase(std::remove_if(_tasks.begin(), _tasks.end(), reap), _tasks.end());
+}
+
+void util::CoRedisQueue::_on_script_load(redisAsyncContext *ac, void *r, void *privdata)
+{
+    CoRedisQueue *q = static_cast<CoRedisQueue*>(ac -> data);
+    redisReply *repl = static_cast<redisReply*>(r);
+    if (q -> _pending > 0) q -> _pending -= 1;
+    if (repl == nullptr) return;
+    if (repl -> type != REDIS_REPLY_STRING)
+    {
+        // Calls keep sending the script body
+        printf("Could not load script: %s\n", repl -> str);
+        return;
+    }
+    static_cast<std::string*>(privdata) -> assign(repl -> str, repl -> len);
+}
+
+void util::CoRedisQueue::_on_lease(redisAsyncContext *ac, void *r, void *privdata)
+{
+    (void) ac;
+    CoRedisQueue *q = static_cast<CoRedisQueue*>(privdata);
+    redisReply *repl = static_cast<redisReply*>(r);
+    if (q -> _pending > 0) q -> _pending -= 1;
+    std::vector<LeaseAwaiter*> leasing;
+    leasing.swap(q -> _leasing);
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR
+        && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed, the next call sends the script body
+        q -> _lease_sha.clear();
+        q -> _load(q -> _lease_script, &q -> _lease_sha);
+        q -> _waiting.insert(q -> _waiting.begin(), leasing.begin(), leasing.end());
+        return;
+    }
+    size_t leased = 0;
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY)
+    {
+        for (; leased < leasing.size() && 2 * leased + 1 < repl -> elements; leased += 1)
+        {
+            redisReply *item = repl -> element[2 * leased];
+            redisReply *key = repl -> element[2 * leased + 1];
+            leasing[leased] -> _leased = LeasedItem{
+                std::string(item -> str, item -> len), std::string(key -> str, key -> len) };
+            q -> _ready.push_back(leasing[leased] -> _handle);
+        }
+    } else
+    {
+        // Connection lost or the script failed, the waiting workers see a
+        // lease without an item
+        if (repl != nullptr) printf("Could not lease: %s\n", repl -> str);
+        for (LeaseAwaiter *lease: leasing) q -> _ready.push_back(lease -> _handle);
+        return;
+    }
+    // Fewer items than waiters means the main queue is empty
+    if (leased < leasing.size())
+    {
+        q -> _waiting.insert(q -> _waiting.begin(), leasing.begin() + leased, leasing.end());
+        q -> _idle_until = std::chrono::steady_clock::now() + q -> _idle_backoff.next();
+    } else
+    {
+        q -> _idle_backoff.reset();
+    }
+}
+
+void util::CoRedisQueue::_on_complete(redisAsyncContext *ac, void *r, void *privdata)
+{
+    CoRedisQueue *q = static_cast<CoRedisQueue*>(ac -> data);
+    CompleteAwaiter *complete = static_cast<CompleteAwaiter*>(privdata);
+    redisReply *repl = static_cast<redisReply*>(r);
+    if (q -> _pending > 0) q -> _pending -= 1;
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR
+        && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        q -> _complete_sha.clear();
+        q -> _load(q -> _complete_script, &q -> _complete_sha);
+        complete -> await_suspend(complete -> _handle);
+        return;
+    }
+    complete -> _held = repl != nullptr 
+        && repl -> type == REDIS_REPLY_INTEGER && repl -> integer == 1;
+    q -> _ready.push_back(complete -> _handle);
+}
+
+void util::CoRedisQueue::_on_disconnect(const redisAsyncContext *ac, int status)
+{
+    CoRedisQueue *q = static_cast<CoRedisQueue*>(ac -> data);
+    if (status != REDIS_OK) printf("Connection lost: %s\n", ac -> errstr);
+    // The context is freed by hiredis once this callback returns
+    q -> ctx = nullptr;
+    q -> _pending = 0;
+}
+
+bool util::CoRedisQueue::LeaseAwaiter::await_ready() const noexcept
+{
+    return _q -> _stopping || _q -> ctx == nullptr;
+}
+
+void util::CoRedisQueue::LeaseAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    // Leases suspended during one turn of the loop share a script call
+    _handle = handle;
+    _q -> _waiting.push_back(this);
+}
+
+void util::CoRedisQueue::CompleteAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    _handle = handle;
+    if (!_q -> _eval(
+        &CoRedisQueue::_on_complete, this, _q -> _complete_script, _q -> _complete_sha,
+        { "3", _q -> _processing_q_name, _q -> _payloads_name, _q -> _completed_name,
+          _q -> _lease_key_prefix, _leased.item }))
+    {
+        _held = false;
+        _q -> _ready.push_back(handle);
+    }
+}
+
+void util::CoRedisQueue::SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    _q -> _sleeping.emplace_back(_until, handle);
+}
+
+void util::CoRedisQueue::spawn(CoTask task)
+{
+    std::coroutine_handle<CoTask::promise_type> handle = task._handle;
+    task._handle = {};
+    _tasks.push_back(handle);
+    _ready.push_back(handle);
+}
+
+void util::CoRedisQueue::run()
+{
+    while (!_tasks.empty() || (ctx != nullptr && _pending > 0))
+    {
+        auto now = std::chrono::steady_clock::now();
+        _expire(now);
+        if (_stopping || ctx == nullptr) _drain();
+        _resume();
+        if (_error) break;
+        if (now >= _idle_until) _dispatch();
+        // Waits for replies until the next lease attempt, lease timeout or
+        // wake up of a paused task, at most a tenth of a second
+        auto until = now + std::chrono::milliseconds(100);
+        if (!_ready.empty()) until = now;
+        if (!_waiting.empty() && _leasing.empty()) until = std::min(until, _idle_until);
+        for (LeaseAwaiter *lease: _waiting)
+            if (!lease -> _forever) until = std::min(until, lease -> _deadline);
+        for (auto const &sleeper: _sleeping) until = std::min(until, sleeper.first);
+        double tick = std::max(0.0, std::chrono::duration<double>(until - now).count());
+        if (ctx != nullptr) redisPollTick(ctx, tick);
+        else std::this_thread::sleep_for(std::chrono::duration<double>(tick));
+    }
+    if (_error) std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void util::CoRedisQueue::stop()
+{
+    _stopping = true;
+}
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <string>
+#include "coqueue.h"
+#include "keys.h"
+#include "item_id.h"
+
+static const char *USAGE =
+    "Usage: redis-coro-consumer [HOST] [PORT] [QUEUE] [WORKERS] [LAYOUT]\n"
+    "  HOST PORT QUEUE        redis server and queue, default localhost 8888 foo\n"
+    "  WORKERS                logical workers on the event loop thread, default 1000\n"
+    "  LAYOUT                 list or zset, default list\n"
+    "All workers share one async connection, workers waiting for an item in one\n"
+    "turn of the loop share a single lease call of up to 64 items.\n";
+
+/// @brief Logical worker, leases and completes items until the queue is 
+/// stopped or stays empty for the lease timeout
+static util::CoTask worker(util::CoRedisQueue &q, size_t id)
+{
+    while (std::optional<util::LeasedItem> leased = co_await q.lease())
+    {
+        if (rq::payload_of(leased -> item) == "EOQ")
+        {
+            q.stop();
+        } else
+        {
+            std::cout << ("Worker " + std::to_string(id) + " processing item: " 
+                + std::string(rq::payload_of(leased -> item)) + "\n");
+            // Here we would await some I/O bound preprocessing instead of 
+            // pausing, the other workers keep running meanwhile
+            co_await q.sleep(std::chrono::milliseconds(200));
+        }
+        co_await q.complete(*leased);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))
+    {
+        std::cout << USAGE;
+        return 0;
+    }
+    std::string host_name = (argc > 1) ? argv[1] : "localhost";
+    uint16_t port = (argc > 2) ? (uint16_t) std::stoul(argv[2]) : 8888;
+    std::string queue_name = (argc > 3) ? argv[3] : "foo";
+    // Number of logical workers sharing the event loop thread
+    size_t workers = (argc > 4) ? std::stoul(argv[4]) : 1000;
+    rq::Layout layout = rq::layout_from((argc > 5) ? argv[5] : "list");
+    util::CoRedisQueue q = { queue_name, host_name, port, layout };
+    std::cout << "Worker with Session ID: " << q.session_id() << ", " << workers 
+        << " coroutines\n";
+    for (size_t id = 0; id < workers; id += 1) q.spawn(worker(q, id));
+    q.run();
+    std::cout << "All items processed, exiting..." << "\n";
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <string.h>
+#include "inspector.h"
+
+util::QueueRates util::QueueRates::between(QueueSnapshot const &before, QueueSnapshot const &after)
+{
+    QueueRates rates;
+    double seconds = (after.time_ms - before.time_ms) / 1000.0;
+    if (seconds <= 0) return rates;
+    // A counter reset e.g., by a flushed database restarts the count
+    double completed = (after.completed >= before.completed)
+        ? (double) (after.completed - before.completed) : (double) after.completed;
+    double growth = (double) (after.pending + after.processing)
+        - (double) (before.pending + before.processing);
+    rates.completions = completed / seconds;
+    rates.arrivals = std::max(growth + completed, 0.0) / seconds;
+    return rates;
+}
+
+util::QueueInspector::QueueInspector(
+                std::string const &queue_name,
+                std::shared_ptr<RedisPool> pool,
+                InspectorOptions const &opts)
+                :_pool(std::move(pool)), _keys(queue_name, opts.layout), _opts(opts)
+{
+    _opts.chunk = std::max<size_t>(_opts.chunk, 1);
+    switch (_opts.layout)
+    {
+        case rq::Layout::ZSET: _layout = "zset"; break;
+        case rq::Layout::STREAM: _layout = "stream"; break;
+        default: _layout = "list";
+    }
+    _inspect_sha = _pool -> script_sha(rq::scripts::INSPECT);
+}
+
+std::string util::QueueInspector::_inspect(
+    redisContext *ctx, std::string const &cursor, QueueSnapshot &snap)
+{
+    // Leases of the stream layout are pending entries of the group
+    std::string const &lease_arg = (_opts.layout == rq::Layout::STREAM)
+        ? std::string(rq::STREAM_GROUP) : _keys.lease_prefix;
+    std::string _chunk = std::to_string(_opts.chunk);
+    std::string _duration = std::to_string(_opts.duration);
+    const char *argv[11] = {
+        "EVALSHA", _inspect_sha.c_str(), "3",
+        _keys.main.c_str(), _keys.processing.c_str(), _keys.completed.c_str(),
+        _layout.c_str(), lease_arg.c_str(), cursor.c_str(), _chunk.c_str(), _duration.c_str() };
+    size_t argvlen[11] = {
+        7, _inspect_sha.size(), 1,
+        _keys.main.size(), _keys.processing.size(), _keys.completed.size(),
+        _layout.size(), lease_arg.size(), cursor.size(), _chunk.size(), _duration.size() };
+    redisReply *repl = (redisReply*) redisCommandArgv(ctx, 11, argv, argvlen);
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR
+        && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed e.g., by SCRIPT FLUSH or a restart
+        freeReplyObject(repl);
+        _inspect_sha = _pool -> reload_script(ctx, rq::scripts::INSPECT);
+        argv[1] = _inspect_sha.c_str();
+        repl = (redisReply*) redisCommandArgv(ctx, 11, argv, argvlen);
+    }
+    if (repl == nullptr || repl -> type != REDIS_REPLY_ARRAY || repl -> elements < 8)
+    {
+        if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR)
+            printf("Encountered Inspect Error: %s\n", repl -> str);
+        if (repl != nullptr) freeReplyObject(repl);
+        throw std::runtime_error("Could not inspect queue");
+    }
+    redisReply **elem = repl -> element;
+    // Depths and counters are taken from the first chunk only, so that
+    // they describe a single point in time
+    if (cursor == "0")
+    {
+        snap.time_ms = elem[0] -> integer;
+        snap.pending = (size_t) std::max<long long>(elem[1] -> integer, 0);
+        snap.processing = (size_t) elem[2] -> integer;
+        snap.completed = (uint64_t) std::max<long long>(elem[3] -> integer, 0);
+    }
+    std::string next(elem[4] -> str, elem[4] -> len);
+    snap.inspected += (size_t) elem[5] -> integer;
+    snap.orphans += (size_t) elem[6] -> integer;
+    snap.oldest_lease_ms = std::max<int64_t>(snap.oldest_lease_ms, elem[7] -> integer);
+    for (size_t idx = 8; idx + 1 < repl -> elements; idx += 2)
+    {
+        snap.sessions[std::string(elem[idx] -> str, elem[idx] -> len)]
+            += (size_t) elem[idx + 1] -> integer;
+    }
+    freeReplyObject(repl);
+    return next;
+}
+
+util::QueueSnapshot util::QueueInspector::snapshot()
+{
+    QueueSnapshot snap;
+    std::string cursor = "0";
+    for (size_t chunks = 1; ; chunks += 1)
+    {
+        {
+            // The connection is only held for a single chunk
+            RedisPool::Connection conn = _pool -> acquire();
+            cursor = _inspect(conn.get(), cursor, snap);
+        }
+        if (cursor == "0" || (_opts.max_chunks > 0 && chunks >= _opts.max_chunks)) break;
+        std::this_thread::sleep_for(_opts.pause);
+    }
+    return snap;
+}
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <cstddef>
+#include "lease.h"
+
+namespace
+{
+    using Block = util::ReplyArena::Block;
+
+    /// @brief Creates a reply object in the block of the reader task and
+    /// links it into its parent, like the default hiredis functions do
+    redisReply *_create(const redisReadTask *task, int type)
+    {
+        Block *block = (Block*) task -> privdata;
+        redisReply *r = (redisReply*) block -> alloc(sizeof(redisReply));
+        if (r == nullptr) return nullptr;
+        memset(r, 0, sizeof(redisReply));
+        r -> type = type;
+        if (task -> parent != nullptr)
+        {
+            redisReply *parent = (redisReply*) task -> parent -> obj;
+            parent -> element[task -> idx] = r;
+        }
+        return r;
+    }
+
+    char *_copy(const redisReadTask *task, const char *str, size_t len)
+    {
+        Block *block = (Block*) task -> privdata;
+        char *buf = (char*) block -> alloc(len + 1);
+        if (buf == nullptr) return nullptr;
+        memcpy(buf, str, len);
+        buf[len] = '\0';
+        return buf;
+    }
+
+    void *_create_string(const redisReadTask *task, char *str, size_t len)
+    {
+        redisReply *r = _create(task, task -> type);
+        if (r == nullptr) return nullptr;
+        if (task -> type == REDIS_REPLY_VERB)
+        {
+            // Verbatim strings start with a three letter format and a colon
+            memcpy(r -> vtype, str, 3);
+            r -> vtype[3] = '\0';
+            str += 4;
+            len -= 4;
+        }
+        r -> str = _copy(task, str, len);
+        r -> len = len;
+        return (r -> str != nullptr) ? r : nullptr;
+    }
+
+    void *_create_array(const redisReadTask *task, size_t elements)
+    {
+        redisReply *r = _create(task, task -> type);
+        if (r == nullptr) return nullptr;
+        if (elements > 0)
+        {
+            Block *block = (Block*) task -> privdata;
+            r -> element = (redisReply**) block -> alloc(elements * sizeof(redisReply*));
+            if (r -> element == nullptr) return nullptr;
+            memset(r -> element, 0, elements * sizeof(redisReply*));
+        }
+        r -> elements = elements;
+        return r;
+    }
+
+    void *_create_integer(const redisReadTask *task, long long value)
+    {
+        redisReply *r = _create(task, REDIS_REPLY_INTEGER);
+        if (r != nullptr) r -> integer = value;
+        return r;
+    }
+
+    void *_create_double(const redisReadTask *task, double value, char *str, size_t len)
+    {
+        redisReply *r = _create(task, REDIS_REPLY_DOUBLE);
+        if (r == nullptr) return nullptr;
+        r -> dval = value;
+        r -> str = _copy(task, str, len);
+        r -> len = len;
+        return (r -> str != nullptr) ? r : nullptr;
+    }
+
+    void *_create_nil(const redisReadTask *task)
+    {
+        return _create(task, REDIS_REPLY_NIL);
+    }
+
+    void *_create_bool(const redisReadTask *task, int value)
+    {
+        redisReply *r = _create(task, REDIS_REPLY_BOOL);
+        if (r != nullptr) r -> integer = value != 0;
+        return r;
+    }
+
+    /// @brief Reply objects live until their block is released
+    void _free_object(void *)
+    {
+    }
+} // namespace
+
+redisReplyObjectFunctions util::ReplyArena::FUNCTIONS = {
+    _create_string,
+    _create_array,
+    _create_integer,
+    _create_double,
+    _create_nil,
+    _create_bool,
+    _free_object
+};
+
+void *util::ReplyArena::Block::alloc(size_t n) noexcept
+{
+    const size_t align = alignof(std::max_align_t);
+    size_t offset = (used + align - 1) & ~(align - 1);
+    if (offset + n <= size)
+    {
+        used = offset + n;
+        return data.get() + offset;
+    }
+    void *spilled = malloc(n);
+    if (spilled == nullptr) return nullptr;
+    try
+    {
+        overflow.push_back(spilled);
+    }
+    catch(...)
+    {
+        free(spilled);
+        return nullptr;
+    }
+    return spilled;
+}
+
+void util::ReplyArena::Block::reset() noexcept
+{
+    used = 0;
+    for (void *spilled: overflow) free(spilled);
+    overflow.clear();
+}
+
+util::ReplyArena::Scope::Scope(redisContext *ctx, Block *block)
+:_reader(nullptr), _fn(nullptr), _privdata(nullptr)
+{
+    if (block == nullptr) return;
+    _reader = ctx -> reader;
+    _fn = _reader -> fn;
+    _privdata = _reader -> privdata;
+    _reader -> fn = &FUNCTIONS;
+    _reader -> privdata = block;
+}
+
+util::ReplyArena::Scope::~Scope()
+{
+    if (_reader == nullptr) return;
+    _reader -> fn = _fn;
+    _reader -> privdata = _privdata;
+}
+
+util::ReplyArena::ReplyArena(size_t block_size): _block_size(block_size)
+{
+}
+
+util::ReplyArena::~ReplyArena()
+{
+    for (std::unique_ptr<Block> &block: _blocks) block -> reset();
+}
+
+util::ReplyArena::Block *util::ReplyArena::acquire()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!_free.empty())
+    {
+        Block *block = _free.back();
+        _free.pop_back();
+        return block;
+    }
+    std::unique_ptr<Block> block = std::make_unique<Block>();
+    block -> data.reset(new char[_block_size]);
+    block -> size = _block_size;
+    block -> used = 0;
+    _blocks.push_back(std::move(block));
+    _free.reserve(_blocks.size());
+    return _blocks.back().get();
+}
+
+void util::ReplyArena::release(Block *block)
+{
+    block -> reset();
+    std::lock_guard<std::mutex> lock(_mtx);
+    _free.push_back(block);
+}
+
+size_t util::ReplyArena::blocks()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _blocks.size();
+}
+
+void util::ReplyArena::free_reply(redisContext *ctx, void *reply)
+{
+    if (ctx -> reader -> fn != &FUNCTIONS) freeReplyObject(reply);
+}
+
+util::Lease::Lease(
+    redisReply *reply,
+    std::shared_ptr<ReplyArena> arena,
+    ReplyArena::Block *block)
+:_reply(reply), _arena(std::move(arena)), _block(block)
+{
+    // Lease scripts reply with the item followed by its lease key
+    if (reply != nullptr
+        && reply -> type == REDIS_REPLY_ARRAY
+        && reply -> elements == 2)
+    {
+        redisReply *item = reply -> element[0];
+        redisReply *key = reply -> element[1];
+        _item = std::string_view(item -> str, item -> len);
+        _lease_key = std::string_view(key -> str, key -> len);
+    }
+}
+
+util::Lease::Lease(Lease &&other) noexcept
+:_reply(other._reply), _arena(std::move(other._arena)), _block(other._block),
+_item(other._item), _lease_key(other._lease_key)
+{
+    other._reply = nullptr;
+    other._block = nullptr;
+    other._item = std::string_view();
+    other._lease_key = std::string_view();
+}
+
+util::Lease& util::Lease::operator=(Lease &&other) noexcept
+{
+    if (this == &other) return *this;
+    reset();
+    _reply = other._reply;
+    _arena = std::move(other._arena);
+    _block = other._block;
+    _item = other._item;
+    _lease_key = other._lease_key;
+    other._reply = nullptr;
+    other._block = nullptr;
+    other._item = std::string_view();
+    other._lease_key = std::string_view();
+    return *this;
+}
+
+void util::Lease::reset()
+{
+    if (_block != nullptr) _arena -> release(_block);
+    else if (_reply != nullptr) freeReplyObject(_reply);
+    _reply = nullptr;
+    _block = nullptr;
+    _arena.reset();
+    _item = std::string_view();
+    _lease_key = std::string_view();
+}
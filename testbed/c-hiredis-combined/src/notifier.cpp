@@ -0,0 +1,128 @@
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include "notifier.h"
+#include "keyspace.h"
+
+util::KeyspaceNotifier::KeyspaceNotifier(
+                std::string const &queue_name,
+                std::string const &host_name,
+                uint16_t port,
+                bool configure,
+                std::shared_ptr<rq::Wakeup> wakeup)
+                :_host_name(host_name), _port(port), _timeout({1, 500000}),
+                _channel(rq::keyspace::channel(queue_name)), _wakeup(std::move(wakeup))
+{
+    if (configure) _configure();
+    redisContext *ctx = _subscribe();
+    if (ctx == nullptr)
+        throw std::runtime_error("Could not subscribe to keyspace notifications, exiting...");
+    _thread = std::thread([this, ctx]() { _run(ctx); });
+}
+
+util::KeyspaceNotifier::~KeyspaceNotifier()
+{
+    _stopping = true;
+    if (_thread.joinable()) _thread.join();
+}
+
+redisContext *util::KeyspaceNotifier::_subscribe()
+{
+    redisContext *ctx = redisConnectWithTimeout(_host_name.c_str(), _port, _timeout);
+    if (ctx == NULL || ctx -> err)
+    {
+        if (ctx)
+        {
+            printf("Encountered Connection Error: %s\n", ctx -> errstr);
+            redisFree(ctx);
+        }
+        return nullptr;
+    }
+    redisReply *repl = (redisReply*) redisCommand(
+        ctx, "SUBSCRIBE %b", _channel.data(), _channel.size());
+    bool subscribed = repl != nullptr && repl -> type == REDIS_REPLY_ARRAY;
+    if (repl != nullptr) freeReplyObject(repl);
+    if (!subscribed)
+    {
+        redisFree(ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+void util::KeyspaceNotifier::_configure()
+{
+    redisContext *ctx = redisConnectWithTimeout(_host_name.c_str(), _port, _timeout);
+    if (ctx == NULL || ctx -> err)
+    {
+        if (ctx) redisFree(ctx);
+        throw std::runtime_error("Could not connect to configure keyspace notifications, exiting...");
+    }
+    redisReply *repl = (redisReply*) redisCommand(ctx, "CONFIG GET notify-keyspace-events");
+    std::string flags;
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY && repl -> elements == 2)
+        flags.assign(repl -> element[1] -> str, repl -> element[1] -> len);
+    if (repl != nullptr) freeReplyObject(repl);
+    std::string required = rq::keyspace::with_queue_events(flags);
+    if (required != flags)
+    {
+        repl = (redisReply*) redisCommand(
+            ctx, "CONFIG SET notify-keyspace-events %s", required.c_str());
+        bool configured = repl != nullptr && repl -> type == REDIS_REPLY_STATUS;
+        if (repl != nullptr) freeReplyObject(repl);
+        if (!configured)
+        {
+            redisFree(ctx);
+            throw std::runtime_error("Could not enable keyspace notifications, exiting...");
+        }
+    }
+    redisFree(ctx);
+}
+
+void util::KeyspaceNotifier::_run(redisContext *ctx)
+{
+    // Reads are polled with a short timeout, so that the destructor does
+    // not wait for the next notification
+    const int tick = 100;
+    while (!_stopping)
+    {
+        if (ctx == nullptr)
+        {
+            poll(nullptr, 0, 10 * tick);
+            ctx = _subscribe();
+            // Pushes may have been missed while disconnected
+            if (ctx != nullptr) _wakeup -> notify();
+            continue;
+        }
+        redisReply *repl = nullptr;
+        if (redisGetReplyFromReader(ctx, (void**) &repl) != REDIS_OK)
+        {
+            redisFree(ctx);
+            ctx = nullptr;
+            continue;
+        }
+        if (repl != nullptr)
+        {
+            // Messages are {"message", channel, event}
+            if (repl -> type == REDIS_REPLY_ARRAY && repl -> elements == 3
+                && repl -> element[2] -> type == REDIS_REPLY_STRING
+                && rq::keyspace::is_push(std::string_view(
+                    repl -> element[2] -> str, repl -> element[2] -> len)))
+            {
+                _wakeup -> notify();
+            }
+            freeReplyObject(repl);
+            continue;
+        }
+        pollfd pfd = { ctx -> fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, tick);
+        if ((ready < 0 && errno != EINTR) || (ready > 0 && redisBufferRead(ctx) != REDIS_OK))
+        {
+            printf("Keyspace notifications lost: %s\n", ctx -> errstr);
+            redisFree(ctx);
+            ctx = nullptr;
+        }
+    }
+    if (ctx != nullptr) redisFree(ctx);
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include "reaper.h"
+
+util::Reaper::Reaper(
+                std::string const &queue_name,
+                std::shared_ptr<RedisPool> pool,
+                ReaperOptions const &opts)
+                :_pool(std::move(pool)), _keys(queue_name, opts.layout), _opts(opts)
+{
+    // Pending entries of streams are claimed by the next lease with XAUTOCLAIM
+    if (_opts.layout == rq::Layout::STREAM)
+        throw std::runtime_error("Stream queues do not need a reaper, exiting...");
+    _opts.chunk = std::max<size_t>(_opts.chunk, 1);
+    _reap_script = (_opts.layout == rq::Layout::LIST) 
+        ? rq::scripts::REAP : rq::scripts::REAP_ZSET;
+    _reap_sha = _pool -> script_sha(_reap_script);
+    if (_opts.priorities) _doorbell = rq::doorbell_key(queue_name);
+    _tombstone = queue_name + ":reaper_tombstone:" 
+        + boost::uuids::to_string(boost::uuids::random_generator_mt19937()());
+}
+
+long long util::Reaper::_reap(redisContext *ctx, long long cursor, size_t &requeued)
+{
+    std::string _cursor = std::to_string(cursor);
+    std::string _chunk = std::to_string(_opts.chunk);
+    std::vector<const char*> argv = {
+        "EVALSHA", _reap_sha.c_str(), _doorbell.empty() ? "3" : "4",
+        _keys.main.c_str(), _keys.processing.c_str(), _keys.payloads.c_str() };
+    std::vector<size_t> argvlen = {
+        7, _reap_sha.size(), 1, _keys.main.size(), _keys.processing.size(), _keys.payloads.size() };
+    if (!_doorbell.empty())
+    {
+        argv.push_back(_doorbell.c_str());
+        argvlen.push_back(_doorbell.size());
+    }
+    argv.insert(argv.end(), { 
+        _keys.lease_prefix.c_str(), _cursor.c_str(), _chunk.c_str(), _tombstone.c_str() });
+    argvlen.insert(argvlen.end(), { 
+        _keys.lease_prefix.size(), _cursor.size(), _chunk.size(), _tombstone.size() });
+    redisReply *repl = (redisReply*) redisCommandArgv(ctx, argv.size(), argv.data(), argvlen.data());
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR 
+        && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed e.g., by SCRIPT FLUSH or a restart
+        freeReplyObject(repl);
+        _reap_sha = _pool -> reload_script(ctx, _reap_script);
+        argv[1] = _reap_sha.c_str();
+        repl = (redisReply*) redisCommandArgv(ctx, argv.size(), argv.data(), argvlen.data());
+    }
+    if (repl == nullptr || repl -> type != REDIS_REPLY_ARRAY || repl -> elements != 2)
+    {
+        if (repl != nullptr) freeReplyObject(repl);
+        throw std::runtime_error("Could not reap expired leases");
+    }
+    long long next = repl -> element[0] -> integer;
+    requeued += repl -> element[1] -> integer;
+    freeReplyObject(repl);
+    return next;
+}
+
+size_t util::Reaper::reap()
+{
+    _last_run = std::chrono::steady_clock::now();
+    _ran = true;
+    size_t requeued = 0;
+    long long cursor = 0;
+    for (size_t chunks = 1; ; chunks += 1)
+    {
+        {
+            // The connection is only held for a single chunk
+            RedisPool::Connection conn = _pool -> acquire();
+            cursor = _reap(conn.get(), cursor, requeued);
+        }
+        if (cursor == 0 || (_opts.max_chunks > 0 && chunks >= _opts.max_chunks)) break;
+        std::this_thread::sleep_for(_opts.pause);
+    }
+    return requeued;
+}
+
+size_t util::Reaper::maybe_reap()
+{
+    if (_ran && std::chrono::steady_clock::now() - _last_run < _opts.interval) return 0;
+    return reap();
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <getopt.h>
+#include "reaper.h"
+#include "keys.h"
+#include "cluster.h"
+#include "cli.h"
+
+/// @brief Options of the reaper daemon
+static const char *USAGE = 
+    "Usage: redis-reaper [options]\n"
+    "  -H, --host HOST        redis server or cluster seed node\n"
+    "  -p, --port PORT        redis port, default 8888\n"
+    "  -q, --queue NAME       queue name, default foo\n"
+    "  -i, --interval S       seconds between two runs, default 5\n"
+    "      --chunk N          items inspected per script call, default 100\n"
+    "  -l, --layout LAYOUT    list or zset, default list\n"
+    "      --priorities       ring the doorbell of a priority queue for requeued items\n"
+    "      --cluster          the host is a seed node of a redis cluster\n"
+    "  -h, --help             show this help\n";
+
+int main(int argc, char **argv)
+{
+    std::string host_name = "localhost";
+    uint16_t port = 8888;
+    std::string queue_name = "foo";
+    util::ReaperOptions opts;
+    // With a cluster the host is a seed node and the queue is hash tagged 
+    // like the consumers tag it
+    bool cluster = false;
+    enum { CHUNK = 256, PRIORITIES, CLUSTER };
+    const option options[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "queue", required_argument, nullptr, 'q' },
+        { "interval", required_argument, nullptr, 'i' },
+        { "chunk", required_argument, nullptr, CHUNK },
+        { "layout", required_argument, nullptr, 'l' },
+        { "priorities", no_argument, nullptr, PRIORITIES },
+        { "cluster", no_argument, nullptr, CLUSTER },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 } };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "H:p:q:i:l:h", options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host_name = optarg; break;
+            case 'p': port = rq::cli::port(optarg); break;
+            case 'q': queue_name = optarg; break;
+            case 'i': 
+                opts.interval = std::chrono::seconds(rq::cli::number("interval", optarg));
+                break;
+            case CHUNK: opts.chunk = rq::cli::number("chunk", optarg); break;
+            case 'l': opts.layout = rq::layout_from(optarg); break;
+            case PRIORITIES: opts.priorities = true; break;
+            case CLUSTER: cluster = true; break;
+            case 'h':
+                std::cout << USAGE;
+                return 0;
+            default:
+                std::cout << USAGE;
+                return 1;
+        }
+    }
+    if (cluster) queue_name = rq::hash_tag(queue_name);
+    auto pool = std::make_shared<util::RedisPool>(host_name, port, 1);
+    if (cluster) pool -> route(queue_name);
+    util::Reaper reaper = { queue_name, pool, opts };
+    std::cout << "Reaping expired leases of queue: " << queue_name << "\n";
+    while (true)
+    {
+        size_t requeued = reaper.reap();
+        if (requeued > 0) std::cout << "Requeued items: " << requeued << "\n";
+        std::this_thread::sleep_for(opts.interval);
+    }
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include <stdexcept>
+#include <string.h>
+#include "rpool.h"
+#include "cluster.h"
+#include "lease.h"
+#include "stats.h"
+
+util::RedisPool::RedisPool(
+                std::string const &host_name,
+                uint16_t port,
+                size_t size,
+                timeval const &timeout,
+                std::chrono::seconds health_check)
+                :_host_name(host_name), _port(port), _timeout(timeout), 
+                _size(size > 0 ? size : 1), _health_check(health_check)
+{
+    _idle.reserve(_size);
+}
+
+util::RedisPool::~RedisPool()
+{
+    for (Slot &slot: _idle) redisFree(slot.ctx);
+}
+
+redisContext *util::RedisPool::_open(std::string const &host_name, uint16_t port)
+{
+    redisContext *ctx = redisConnectWithTimeout(host_name.c_str(), port, _timeout);
+    if(ctx == NULL || ctx -> err)
+    {
+        if (ctx)
+        {
+            printf("Encountered Connection Error: %s\n", ctx -> errstr);
+            redisFree(ctx);
+        } else
+        {
+            printf("Could not allocate Redis Context.\n");
+        }
+        return nullptr;
+    }
+    return ctx;
+}
+
+bool util::RedisPool::_resolve(
+    std::string const &host_name, uint16_t port, std::string &node_host, uint16_t &node_port)
+{
+    redisContext *ctx = _open(host_name, port);
+    if (ctx == nullptr) return false;
+    redisReply *repl = (redisReply*) redisCommand(ctx, "CLUSTER SLOTS");
+    long long slot = rq::key_slot(_route_key);
+    bool found = false;
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY)
+    {
+        for (size_t idx = 0; idx < repl -> elements && !found; idx += 1)
+        {
+            // Slot ranges are {start, end, primary, replica...} and nodes 
+            // {address, port, id, ...}
+            redisReply *range = repl -> element[idx];
+            if (range -> type != REDIS_REPLY_ARRAY || range -> elements < 3) continue;
+            if (slot < range -> element[0] -> integer || slot > range -> element[1] -> integer) continue;
+            redisReply *node = range -> element[(_replica && range -> elements > 3) ? 3 : 2];
+            if (node -> type != REDIS_REPLY_ARRAY || node -> elements < 2) break;
+            // An empty address stands for the node that was asked
+            redisReply *address = node -> element[0];
+            node_host = (address -> type == REDIS_REPLY_STRING && address -> len > 0) 
+                ? std::string(address -> str, address -> len) : host_name;
+            node_port = (uint16_t) node -> element[1] -> integer;
+            found = true;
+        }
+    } else if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR)
+    {
+        printf("Encountered Cluster Error: %s\n", repl -> str);
+    }
+    if (repl != nullptr) freeReplyObject(repl);
+    redisFree(ctx);
+    return found;
+}
+
+void util::RedisPool::route(std::string const &key, bool replica)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (_created > 0) throw std::runtime_error("A pool can only be routed before its first connection");
+    _route_key = key;
+    _replica = replica;
+}
+
+redisContext *util::RedisPool::_connect()
+{
+    std::string host_name = _host_name;
+    uint16_t port = _port;
+    if (!_route_key.empty())
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        std::string last_host = _node_host;
+        uint16_t last_port = _node_port;
+        lock.unlock();
+        // The last known node is asked first, the seed still answers if 
+        // that node went away
+        bool found = (!last_host.empty() && _resolve(last_host, last_port, host_name, port)) 
+            || _resolve(_host_name, _port, host_name, port);
+        if (!found) throw std::runtime_error("Could not find the cluster node of the queue, exiting...");
+        lock.lock();
+        _node_host = host_name;
+        _node_port = port;
+    }
+    redisContext *ctx = _open(host_name, port);
+    if (ctx == nullptr) throw std::runtime_error("Could not initialize RedisPool connection, exiting...");
+    if (!_ping(ctx))
+    {
+        redisFree(ctx);
+        throw std::runtime_error("Could not connect to redis server, exiting...");
+    }
+    if (_replica && !_route_key.empty())
+    {
+        // Replicas of a cluster redirect reads unless the connection is 
+        // marked read only
+        redisReply *repl = (redisReply*) redisCommand(ctx, "READONLY");
+        bool _ok = repl != nullptr && repl -> type == REDIS_REPLY_STATUS;
+        if (repl != nullptr) freeReplyObject(repl);
+        if (!_ok)
+        {
+            redisFree(ctx);
+            throw std::runtime_error("Could not enable reads from the replica, exiting...");
+        }
+    }
+    return ctx;
+}
+
+bool util::RedisPool::_ping(redisContext *ctx)
+{
+    redisReply *repl = (redisReply*) redisCommand(ctx, "PING");
+    bool _pong = repl != nullptr 
+        && repl -> type == REDIS_REPLY_STATUS 
+        && strcmp(repl -> str, "PONG") == 0;
+    if (repl != nullptr) freeReplyObject(repl);
+    return _pong;
+}
+
+void util::RedisPool::_release(redisContext *ctx)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    if (ctx == nullptr || ctx -> err)
+    {
+        // Broken connections are not reused, a fresh one is opened lazily
+        if (ctx != nullptr) redisFree(ctx);
+        rq::stats::count(rq::stats::Client::HIREDIS, rq::stats::Counter::RECONNECTS);
+        _created -= 1;
+    } else
+    {
+        _idle.push_back({ctx, std::chrono::steady_clock::now()});
+    }
+    lock.unlock();
+    _cv.notify_one();
+}
+
+util::RedisPool::Connection util::RedisPool::acquire()
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    _cv.wait(lock, [this]() { return !_idle.empty() || _created < _size; });
+    redisContext *ctx = nullptr;
+    if (!_idle.empty())
+    {
+        Slot slot = _idle.back();
+        _idle.pop_back();
+        lock.unlock();
+        if (std::chrono::steady_clock::now() - slot.last_used < _health_check 
+            || _ping(slot.ctx))
+        {
+            return Connection(this, slot.ctx);
+        }
+        redisFree(slot.ctx);
+        rq::stats::count(rq::stats::Client::HIREDIS, rq::stats::Counter::RECONNECTS);
+    } else
+    {
+        _created += 1;
+        lock.unlock();
+    }
+    try
+    {
+        ctx = _connect();
+    }
+    catch(...)
+    {
+        lock.lock();
+        _created -= 1;
+        lock.unlock();
+        _cv.notify_one();
+        throw;
+    }
+    return Connection(this, ctx);
+}
+
+std::string util::RedisPool::script_sha(const char *script)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = _shas.find(script);
+        if (it != _shas.end()) return it -> second;
+    }
+    Connection conn = acquire();
+    return reload_script(conn.get(), script);
+}
+
+std::string util::RedisPool::reload_script(redisContext *ctx, const char *script)
+{
+    redisReply *repl = (redisReply*) redisCommand(ctx, "SCRIPT LOAD %s", script);
+    // The caller may have installed a reply arena on the context
+    if (repl == nullptr || repl -> type != REDIS_REPLY_STRING)
+    {
+        if (repl != nullptr) ReplyArena::free_reply(ctx, repl);
+        throw std::runtime_error("Could not load redis script, exiting...");
+    }
+    std::string sha(repl -> str, repl -> len);
+    ReplyArena::free_reply(ctx, repl);
+    std::lock_guard<std::mutex> lock(_mtx);
+    _shas[script] = sha;
+    return sha;
+}
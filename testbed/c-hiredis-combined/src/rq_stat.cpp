@@ -0,0 +1,147 @@
+#include <iostream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "inspector.h"
+#include "keys.h"
+#include "queue_uri.h"
+#include "cluster.h"
+
+static const char *USAGE =
+    "Usage: rq-stat [HOST PORT QUEUE | URI] [LAYOUT] [INTERVAL] [FORMAT] [DURATION]\n"
+    "               [CHUNK] [MAX_CHUNKS]\n"
+    "  HOST PORT QUEUE        redis server and queue, default localhost 6379 foo\n"
+    "  URI                    queue URI replacing them, e.g., redis://localhost:6379/foo\n"
+    "                         or redis-cluster://host:port/foo?reads=replica\n"
+    "  LAYOUT                 list, zset or stream, default list\n"
+    "  INTERVAL               seconds between snapshots, default 0 prints one and exits\n"
+    "  FORMAT                 json for one object per line, default text\n"
+    "  DURATION               lease duration in seconds, default 5\n"
+    "  CHUNK                  items in processing read per script call, default 100\n"
+    "  MAX_CHUNKS             script calls per snapshot, default 10\n"
+    "e.g., rq-stat redis://localhost:6379/foo list 5 json prints depths, completions,\n"
+    "leases per session, orphans and the oldest lease age every 5 seconds, with arrival\n"
+    "and completion rates from the second snapshot on.\n";
+
+/// @brief Escapes a session name for a JSON string
+static std::string json_string(std::string const &value)
+{
+    std::string out = "\"";
+    for (char c: value)
+    {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char) c < 0x20) continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+static std::string to_json(
+    std::string const &queue,
+    util::QueueSnapshot const &snap,
+    std::optional<util::QueueRates> const &rates)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "{\"queue\":" << json_string(queue)
+        << ",\"time_ms\":" << snap.time_ms
+        << ",\"pending\":" << snap.pending
+        << ",\"processing\":" << snap.processing
+        << ",\"completed\":" << snap.completed
+        << ",\"inspected\":" << snap.inspected
+        << ",\"partial\":" << (snap.partial() ? "true" : "false")
+        << ",\"orphans\":" << snap.orphans
+        << ",\"oldest_lease_ms\":" << snap.oldest_lease_ms
+        << ",\"sessions\":{";
+    bool first = true;
+    for (auto const &session: snap.sessions)
+    {
+        out << (first ? "" : ",") << json_string(session.first) << ":" << session.second;
+        first = false;
+    }
+    out << "}";
+    // Rates need two snapshots and are left out of the first one
+    if (rates)
+        out << ",\"arrivals_per_s\":" << rates -> arrivals
+            << ",\"completions_per_s\":" << rates -> completions;
+    out << "}";
+    return out.str();
+}
+
+static std::string to_text(
+    std::string const &queue,
+    util::QueueSnapshot const &snap,
+    std::optional<util::QueueRates> const &rates)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "Queue: " << queue << "\n"
+        << "  pending:      " << snap.pending << "\n"
+        << "  processing:   " << snap.processing << "\n"
+        << "  completed:    " << snap.completed << "\n"
+        << "  orphans:      " << snap.orphans << "\n"
+        << "  oldest lease: " << snap.oldest_lease_ms << " ms\n";
+    if (snap.partial())
+        out << "  (leases of " << snap.inspected << " of " << snap.processing
+            << " items in processing inspected)\n";
+    if (rates)
+        out << "  arrivals:     " << rates -> arrivals << " /s\n"
+            << "  completions:  " << rates -> completions << " /s\n";
+    out << "  leases by session:\n";
+    for (auto const &session: snap.sessions)
+        out << "    " << session.first << ": " << session.second << "\n";
+    return out.str();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))
+    {
+        std::cout << USAGE;
+        return 0;
+    }
+    // A queue URI e.g., redis://localhost:6379/foo replaces the host, port
+    // and queue name arguments
+    bool has_uri = (argc > 1) && rq::QueueUri::is_uri(argv[1]);
+    rq::QueueUri uri = has_uri ? rq::QueueUri::parse(argv[1]) : rq::QueueUri();
+    int shift = has_uri ? 2 : 0;
+    auto arg = [&](int pos) -> const char* { return (argc > pos - shift) ? argv[pos - shift] : nullptr; };
+    std::string host_name = has_uri ? uri.host : (argc > 1) ? argv[1] : "localhost";
+    uint16_t port = has_uri ? uri.port : (argc > 2) ? std::stoul(argv[2]) : 6379;
+    std::string queue_name = has_uri ? uri.queue : (argc > 3) ? argv[3] : "foo";
+    if (uri.cluster) queue_name = rq::hash_tag(queue_name);
+    if (uri.scheme == rq::QueueUri::Scheme::LOCAL)
+    {
+        std::cerr << "Local queues live inside their process and cannot be inspected\n";
+        return 1;
+    }
+    util::InspectorOptions opts;
+    opts.layout = arg(4) ? rq::layout_from(arg(4)) : rq::Layout::LIST;
+    // Watch mode prints a snapshot every interval seconds, zero prints one
+    // snapshot and exits
+    size_t interval = arg(5) ? std::stoul(arg(5)) : 0;
+    bool json = arg(6) && std::string(arg(6)) == "json";
+    opts.duration = arg(7) ? std::stoul(arg(7)) : 5;
+    opts.chunk = arg(8) ? std::stoul(arg(8)) : 100;
+    opts.max_chunks = arg(9) ? std::stoul(arg(9)) : 10;
+    auto pool = std::make_shared<util::RedisPool>(host_name, port, 1);
+    // Inspection only reads, so it can be served by a replica of the slot
+    if (uri.cluster) pool -> route(queue_name, uri.replica_reads);
+    util::QueueInspector inspector = { queue_name, pool, opts };
+    std::optional<util::QueueSnapshot> last;
+    while (true)
+    {
+        util::QueueSnapshot snap = inspector.snapshot();
+        std::optional<util::QueueRates> rates;
+        if (last) rates = util::QueueRates::between(*last, snap);
+        // One JSON object per line, so that watch mode can be piped
+        std::cout << (json ? to_json(queue_name, snap, rates) + "\n" : to_text(queue_name, snap, rates));
+        std::cout.flush();
+        if (interval == 0) break;
+        last = std::move(snap);
+        std::this_thread::sleep_for(std::chrono::seconds(interval));
+    }
+    return 0;
+}
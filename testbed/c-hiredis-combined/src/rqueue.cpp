@@ -1,138 +1,743 @@
 #include <stdexcept>
-#include <functional>
-#include <assert.h>
+#include <chrono>
+#include <string.h>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include "rqueue.h"
+#include "scripts.h"
+#include "keys.h"
+#include "stats.h"
+
+namespace
+{
+    using rq::stats::Counter;
+    using rq::stats::Command;
+    constexpr rq::stats::Client CLIENT = rq::stats::Client::HIREDIS;
+
+    /// @brief Length of a reply in RESP encoding
+    uint64_t _reply_bytes(redisReply const *repl)
+    {
+        if (repl == nullptr) return 0;
+        switch (repl -> type)
+        {
+            case REDIS_REPLY_STRING:
+                return rq::stats::resp_bulk_bytes(repl -> len);
+            case REDIS_REPLY_ERROR:
+            case REDIS_REPLY_STATUS:
+                return repl -> len + 3;
+            case REDIS_REPLY_ARRAY:
+            {
+                uint64_t bytes = rq::stats::resp_header_bytes(repl -> elements);
+                for (size_t idx = 0; idx < repl -> elements; idx += 1)
+                    bytes += _reply_bytes(repl -> element[idx]);
+                return bytes;
+            }
+            case REDIS_REPLY_INTEGER:
+                return rq::stats::resp_header_bytes((repl -> integer < 0) 
+                    ? 0 - (uint64_t) repl -> integer : (uint64_t) repl -> integer);
+            default:
+                return 5;
+        }
+    }
+
+    /// @brief Reads a reply and counts its size
+    int _get_reply(redisContext *ctx, redisReply **repl)
+    {
+        int res = redisGetReply(ctx, (void**) repl);
+        if (res == REDIS_OK) rq::stats::count(CLIENT, Counter::BYTES_IN, _reply_bytes(*repl));
+        return res;
+    }
+
+    /// @brief Appends a pre-encoded command and counts its size
+    int _append(
+        redisContext *ctx, util::RespTemplate const &cmd, 
+        std::initializer_list<std::string_view> tail)
+    {
+        std::string_view encoded = cmd.format(tail);
+        rq::stats::count(CLIENT, Counter::BYTES_OUT, encoded.size());
+        return redisAppendFormattedCommand(ctx, encoded.data(), encoded.size());
+    }
+
+    /// @brief Appends a command given as arguments and counts its size
+    int _append(redisContext *ctx, int argc, const char **argv, const size_t *argvlen)
+    {
+        rq::stats::count(CLIENT, Counter::BYTES_OUT, rq::stats::resp_bytes(argvlen, argvlen + argc));
+        return redisAppendCommandArgv(ctx, argc, argv, argvlen);
+    }
+
+    /// @brief Session identifiers are drawn from a generator per thread, 
+    /// seeding a fresh generator for every handle is expensive
+    std::string _new_session()
+    {
+        static thread_local boost::uuids::random_generator_mt19937 gen;
+        return boost::uuids::to_string(gen());
+    }
+} // namespace
 
 util::RedisQueue::RedisQueue(
                 std::string const &queue_name,
                 std::string const &host_name, 
                 uint16_t port,
-                timeval const &timeout)
-                :_main_q_name(queue_name)
+                timeval const &timeout,
+                rq::Layout layout)
+                :RedisQueue(queue_name, std::make_shared<RedisPool>(host_name, port, 2, timeout), layout)
 {
-    ctx = redisConnectWithTimeout(host_name.c_str(), port, timeout);
-    if(ctx == NULL || ctx -> err)
+}
+
+util::RedisQueue::RedisQueue(
+                std::string const &queue_name,
+                std::shared_ptr<RedisPool> pool,
+                rq::Layout layout)
+                :_pool(std::move(pool)), _reads(_pool), _main_q_name(queue_name), _layout(layout)
+{
+    _session = _new_session();
+    rq::QueueKeys keys(_main_q_name, _layout);
+    _processing_q_name = std::move(keys.processing);
+    _payloads_name = std::move(keys.payloads);
+    _lease_key_prefix = std::move(keys.lease_prefix);
+    _completed_name = std::move(keys.completed);
+    _group = rq::STREAM_GROUP;
+    switch (_layout)
     {
-        if (ctx)
-        {
-            printf("Encountered Connection Error: %s\n", ctx -> errstr);
-            redisFree(ctx);
-        } else
-        {
-            printf("Could not allocate Redis Context.\n");
-        }
-        throw std::runtime_error("Could not initialize RedisQueue, exiting...");
+        case rq::Layout::ZSET:
+            _lease_script = rq::scripts::LEASE_ZSET;
+            _complete_script = rq::scripts::COMPLETE_ZSET;
+            break;
+        case rq::Layout::STREAM:
+            // Stream entries are completed with XACK and XDEL
+            _lease_script = rq::scripts::LEASE_STREAM;
+            _complete_script = nullptr;
+            _create_group();
+            break;
+        default:
+            _lease_script = rq::scripts::LEASE;
+            _complete_script = rq::scripts::COMPLETE;
+    }
+    _lease_sha = _pool -> script_sha(_lease_script);
+    if (_complete_script != nullptr) _complete_sha = _pool -> script_sha(_complete_script);
+    _lease_exists_sha = _pool -> script_sha(rq::scripts::LEASE_EXISTS);
+    _extend_sha = _pool -> script_sha(
+        (_layout == rq::Layout::STREAM) ? rq::scripts::EXTEND_STREAM : rq::scripts::EXTEND);
+    _depth_sha = _pool -> script_sha(rq::scripts::DEPTH);
+    _release_sha = _pool -> script_sha(rq::scripts::RELEASE);
+    _encode_commands();
+}
+
+void util::RedisQueue::use_replica_reads(std::shared_ptr<RedisPool> replica)
+{
+    _reads = replica ? std::move(replica) : _pool;
+    // Replicas keep their own script cache
+    _reads -> script_sha(rq::scripts::LEASE_EXISTS);
+    _reads -> script_sha(rq::scripts::DEPTH);
+}
+
+void util::RedisQueue::_create_group()
+{
+    // Existing entries are delivered as well, so that items added before 
+    // the first consumer started are not skipped
+    RedisPool::Connection conn = _pool -> acquire();
+    redisReply *repl = (redisReply*) redisCommand(
+        conn.get(), "XGROUP CREATE %b %b 0 MKSTREAM", 
+        _processing_q_name.data(), _processing_q_name.size(), _group.data(), _group.size());
+    bool created = repl != nullptr && (repl -> type == REDIS_REPLY_STATUS 
+        || (repl -> type == REDIS_REPLY_ERROR && strncmp(repl -> str, "BUSYGROUP", 9) == 0));
+    if (repl != nullptr) freeReplyObject(repl);
+    if (!created) throw std::runtime_error("Could not create the stream consumer group, exiting...");
+}
+
+void util::RedisQueue::use_priorities(size_t levels, std::vector<unsigned> const &weights)
+{
+    if (_layout == rq::Layout::STREAM)
+        throw std::runtime_error("Priority levels are not supported by the stream layout");
+    _priorities = rq::PrioritySchedule(levels, weights);
+    _level_names = _priorities.keys(_main_q_name);
+    _doorbell_name = rq::doorbell_key(_main_q_name);
+    _lease_script = _priorities.enabled() ? rq::scripts::LEASE_PRIORITY 
+        : (_layout == rq::Layout::ZSET) ? rq::scripts::LEASE_ZSET : rq::scripts::LEASE;
+    _lease_sha = _pool -> script_sha(_lease_script);
+    _encode_commands();
+}
+
+void util::RedisQueue::_encode_commands()
+{
+    if (_layout == rq::Layout::STREAM)
+    {
+        // Takes the lease duration, count and the cursor of idle entries
+        _lease_cmd = RespTemplate({ 
+            EVALSHA, _lease_sha, "1", _processing_q_name, _group, _session }, 3);
+        _xack_cmd = RespTemplate({ XACK, _processing_q_name, _group }, 1);
+        _xdel_cmd = RespTemplate({ XDEL, _processing_q_name }, 1);
+        return;
     }
-    redisReply *repl;
-    repl = (redisReply*) redisCommand(ctx, "PING");
-    if (repl != NULL && strcmp(repl -> str, "PONG") != 0)
+    if (_priorities.enabled())
     {
-        freeReplyObject(repl);
-        redisFree(ctx);
-        throw std::runtime_error("Could not connect to redis server, exiting...");
+        // Takes the lease duration, count and the position of the first level
+        std::string numkeys = std::to_string(3 + _level_names.size());
+        std::vector<std::string_view> head = { 
+            EVALSHA, _lease_sha, numkeys, _processing_q_name, _payloads_name, _doorbell_name };
+        head.insert(head.end(), _level_names.begin(), _level_names.end());
+        head.insert(head.end(), { 
+            _lease_key_prefix, _session, (_layout == rq::Layout::ZSET) ? "zset" : "list" });
+        _lease_cmd = RespTemplate(head, 3);
+    } else
+    {
+        _lease_cmd = RespTemplate({ 
+            EVALSHA, _lease_sha, "3", _main_q_name, _processing_q_name, _payloads_name, 
+            _lease_key_prefix, _session }, 2);
     }
-    _session = boost::uuids::to_string(boost::uuids::random_generator_mt19937()());
-    _processing_q_name = _main_q_name + ":processing";
-    _lease_key_prefix = _main_q_name + ":leased_by_session:";
+    _complete_cmd = RespTemplate({ 
+        EVALSHA, _complete_sha, "3", _processing_q_name, _payloads_name, 
+        _completed_name, _lease_key_prefix }, 1);
+    _lrem_cmd = RespTemplate({ LREM, _processing_q_name, "0" }, 1);
 }
 
-inline size_t util::RedisQueue::_key_for(const char *item)
+redisReply *util::RedisQueue::_evalsha(
+    redisContext *ctx, std::string const &sha, const char *script, 
+    int argc, const char **argv, size_t *argvlen) const
 {
-    return std::hash<std::string>{}(item);
+    argv[0] = EVALSHA;
+    argvlen[0] = strlen(EVALSHA);
+    argv[1] = sha.c_str();
+    argvlen[1] = sha.size();
+    redisReply *repl = nullptr;
+    if (_append(ctx, argc, argv, argvlen) != REDIS_OK || _get_reply(ctx, &repl) != REDIS_OK) 
+        return nullptr;
+    if (repl -> type == REDIS_REPLY_ERROR && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed e.g., by SCRIPT FLUSH or a restart, the 
+        // digest of the reloaded script is the same
+        ReplyArena::free_reply(ctx, repl);
+        _pool -> reload_script(ctx, script);
+        repl = nullptr;
+        if (_append(ctx, argc, argv, argvlen) != REDIS_OK || _get_reply(ctx, &repl) != REDIS_OK) 
+            return nullptr;
+    }
+    return repl;
 }
 
-size_t util::RedisQueue::_llen(RedisQueue::QType _q) const
+redisReply *util::RedisQueue::_run(
+    redisContext *ctx, RespTemplate const &cmd, const char *script, 
+    std::initializer_list<std::string_view> tail) const
 {
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx, "%s %s", 
-        LLEN, 
-        (_q == QType::MAIN) ? _main_q_name.c_str() : _processing_q_name.c_str()
-    );
-    size_t _len;
-    if (repl != nullptr) _len = repl -> integer;
-    freeReplyObject(repl);
-    return _len;
+    redisReply *repl = nullptr;
+    if (_append(ctx, cmd, tail) != REDIS_OK || _get_reply(ctx, &repl) != REDIS_OK) return nullptr;
+    if (repl -> type == REDIS_REPLY_ERROR && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed e.g., by SCRIPT FLUSH or a restart, the 
+        // digest embedded in the command stays valid once reloaded
+        ReplyArena::free_reply(ctx, repl);
+        _pool -> reload_script(ctx, script);
+        repl = nullptr;
+        if (_append(ctx, cmd, tail) != REDIS_OK || _get_reply(ctx, &repl) != REDIS_OK) return nullptr;
+    }
+    return repl;
 }
 
 bool util::RedisQueue::_lease_exists(const char *item)
 {
-    const char *arg = (_lease_key_prefix + std::to_string(_key_for(item))).c_str();
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx, "%s %s", 
-        EXISTS, arg);
-    bool _exs;
+    const char *argv[5] = { 
+        nullptr, nullptr, "0", _lease_key_prefix.c_str(), item };
+    size_t argvlen[5] = { 
+        0, 0, 1, _lease_key_prefix.size(), strlen(item) };
+    RedisPool::Connection conn = _reads -> acquire();
+    redisReply *repl = _evalsha(
+        conn.get(), _lease_exists_sha, rq::scripts::LEASE_EXISTS, 5, argv, argvlen);
+    bool _exs = false;
     if (repl != nullptr) _exs = repl -> integer > 0;
     freeReplyObject(repl);
     return _exs;
 }
 
-void util::RedisQueue::_rpoplpush(bool blocking, uint8_t timeout, char *item)
-{
-    redisReply *repl;
-    (blocking)
-        ? repl = (redisReply*) redisCommand(
-            ctx, "%s %s %s %u",
-            BRPOPLPUSH, _main_q_name.c_str(), _processing_q_name.c_str(), timeout
-        )
-        : repl = (redisReply*) redisCommand(
-            ctx, "%s %s %s",
-            RPOPLPUSH, _main_q_name.c_str(), _processing_q_name.c_str()
-        );
-    (repl != nullptr && repl -> str != NULL)
-        ? strcpy(item, repl -> str)
-        : strcpy(item, "END");
-    freeReplyObject(repl);
+redisReply *util::RedisQueue::_lease(redisContext *ctx, size_t count, uint8_t duration)
+{
+    rq::stats::Timer timer(CLIENT, (count == 1) ? Command::LEASE : Command::LEASE_BATCH);
+    IntArg _duration(duration);
+    IntArg _count(count);
+    redisReply *repl = nullptr;
+    if (_priorities.enabled())
+    {
+        IntArg _first(_priorities.first_position(
+            _priority_ticket.fetch_add(1, std::memory_order_relaxed)));
+        repl = _run(
+            ctx, _lease_cmd, _lease_script, 
+            { _duration.view, _count.view, _first.view });
+    } else if (_layout == rq::Layout::STREAM)
+    {
+        std::string cursor;
+        {
+            std::lock_guard<std::mutex> lock(_stream_cursor_mtx);
+            cursor = _claim_cursor;
+        }
+        repl = _run(
+            ctx, _lease_cmd, _lease_script, 
+            { _duration.view, _count.view, cursor });
+        if (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY && repl -> elements > 0)
+        {
+            // The claim cursor ends the reply, the elements before it have 
+            // the format of the other lease scripts
+            redisReply *next = repl -> element[repl -> elements - 1];
+            repl -> elements -= 1;
+            {
+                std::lock_guard<std::mutex> lock(_stream_cursor_mtx);
+                _claim_cursor.assign(next -> str, next -> len);
+                if (repl -> elements == 1)
+                    _stream_cursor.assign(repl -> element[0] -> str, repl -> element[0] -> len);
+            }
+            ReplyArena::free_reply(ctx, next);
+        }
+    } else
+    {
+        repl = _run(ctx, _lease_cmd, _lease_script, { _duration.view, _count.view });
+    }
+    size_t leased = (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY) ? repl -> elements / 2 : 0;
+    if (leased > 0) rq::stats::count(CLIENT, Counter::LEASES, leased);
+    else rq::stats::count(CLIENT, Counter::EMPTIES);
+    return repl;
 }
 
-void util::RedisQueue::_setex(const char* item, uint8_t duration)
+bool util::RedisQueue::_lease(redisContext *ctx, char *item, size_t capacity, uint8_t duration)
 {
-    std::string _item_key = _lease_key_prefix + std::to_string(_key_for(item));
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx,
-        "%s %s %u %s",
-        SETEX, _item_key.c_str(), duration, item
-    );
-    if(repl != nullptr) assert(strcmp(repl -> str, "OK") == 0);
+    redisReply *repl = _lease(ctx, 1, duration);
+    bool _leased = repl != nullptr 
+        && repl -> type == REDIS_REPLY_ARRAY 
+        && repl -> elements == 2;
+    if (_leased && repl -> element[0] -> len >= capacity)
+    {
+        std::string size = std::to_string(repl -> element[0] -> len);
+        freeReplyObject(repl);
+        throw std::runtime_error("Leased item of " + size + " bytes does not fit a buffer of " 
+            + std::to_string(capacity) + " bytes, use lease_item");
+    }
+    if (_leased)
+    {
+        memcpy(item, repl -> element[0] -> str, repl -> element[0] -> len);
+        item[repl -> element[0] -> len] = '\0';
+        if (_layout == rq::Layout::STREAM)
+        {
+            std::lock_guard<std::mutex> lock(_stream_ids_mtx);
+            _stream_ids.emplace(item, std::string(repl -> element[1] -> str, repl -> element[1] -> len));
+        }
+        if (_heartbeat) _heartbeat -> track(
+            std::string(repl -> element[0] -> str, repl -> element[0] -> len),
+            std::string(repl -> element[1] -> str, repl -> element[1] -> len));
+    }
     freeReplyObject(repl);
+    return _leased;
 }
 
-void util::RedisQueue::_lrem(const char* item, uint8_t count)
+util::Lease util::RedisQueue::_lease_one(redisContext *ctx, uint8_t duration)
 {
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx,
-        "%s %s %u %s",
-        LREM, _processing_q_name.c_str(), count, item
-    );
-    if(repl != nullptr) freeReplyObject(repl);
+    ReplyArena::Block *block = _arena ? _arena -> acquire() : nullptr;
+    redisReply *repl = nullptr;
+    {
+        ReplyArena::Scope scope(ctx, block);
+        repl = _lease(ctx, 1, duration);
+    }
+    Lease lease(repl, _arena, block);
+    if (lease && _heartbeat) 
+        _heartbeat -> track(std::string(lease.item()), std::string(lease.lease_key()));
+    return lease;
+}
+
+bool util::RedisQueue::_block(redisContext *ctx, double timeout)
+{
+    rq::stats::Timer timer(CLIENT, Command::BLOCK);
+    bool ready = _wait(ctx, timeout);
+    if (!ready) rq::stats::count(CLIENT, Counter::TIMEOUTS);
+    return ready;
 }
 
-void util::RedisQueue::_del(const char *item)
+bool util::RedisQueue::_wait(redisContext *ctx, double timeout)
 {
-    std::string _item_key = _lease_key_prefix + std::to_string(_key_for(item));
+    if (_layout == rq::Layout::STREAM)
+    {
+        // Reading without a group does not deliver the entry, the lease 
+        // script claims it afterwards
+        long long block = (long long) (timeout * 1000);
+        if (timeout > 0 && block == 0) block = 1;
+        std::string cursor;
+        {
+            std::lock_guard<std::mutex> lock(_stream_cursor_mtx);
+            cursor = _stream_cursor.empty() ? "$" : _stream_cursor;
+        }
+        redisReply *repl = (redisReply*) redisCommand(
+            ctx, "XREAD COUNT 1 BLOCK %lld STREAMS %b %s",
+            block, _processing_q_name.data(), _processing_q_name.size(), cursor.c_str());
+        bool _ready = repl != nullptr && repl -> type == REDIS_REPLY_ARRAY;
+        freeReplyObject(repl);
+        return _ready;
+    }
+    // Moving the head of the main queue onto itself leaves the queue 
+    // unchanged, but lets us block on the server until an item arrives. 
+    // The head keeps the rotation out of the rpush events the notifier 
+    // wakes on. Priority queues ring their doorbell for items of any level.
+    std::string const &watched = _priorities.enabled() ? _doorbell_name : _main_q_name;
     redisReply *repl = (redisReply*) redisCommand(
-        ctx,
-        "%s %s",
-        DEL, _item_key.c_str()
+        ctx, "%s %s %s LEFT LEFT %.3f",
+        BLMOVE, watched.c_str(), watched.c_str(), timeout
     );
-    if(repl != nullptr) freeReplyObject(repl);
+    bool _ready = repl != nullptr && repl -> type == REDIS_REPLY_STRING;
+    freeReplyObject(repl);
+    return _ready;
 }
 
-bool util::RedisQueue::empty() const
+rq::QueueDepth util::RedisQueue::depth() const
 {
-    return (_llen(RedisQueue::QType::MAIN) == 0) && (_llen(RedisQueue::QType::PROCESSING));
+    const char *layout = (_layout == rq::Layout::LIST) ? "list" 
+        : (_layout == rq::Layout::ZSET) ? "zset" : "stream";
+    // Levels above the main queue are passed as further keys
+    std::string numkeys = std::to_string(2 + ((_level_names.size() > 1) ? _level_names.size() - 1 : 0));
+    std::vector<const char*> argv = { 
+        nullptr, nullptr, numkeys.c_str(), _main_q_name.c_str(), _processing_q_name.c_str() };
+    std::vector<size_t> argvlen = { 
+        0, 0, numkeys.size(), _main_q_name.size(), _processing_q_name.size() };
+    for (size_t idx = 0; idx + 1 < _level_names.size(); idx += 1)
+    {
+        argv.push_back(_level_names[idx].c_str());
+        argvlen.push_back(_level_names[idx].size());
+    }
+    argv.insert(argv.end(), { layout, _group.c_str() });
+    argvlen.insert(argvlen.end(), { strlen(layout), _group.size() });
+    rq::stats::Timer timer(CLIENT, Command::DEPTH);
+    RedisPool::Connection conn = _reads -> acquire();
+    redisReply *repl = _evalsha(
+        conn.get(), _depth_sha, rq::scripts::DEPTH, argv.size(), argv.data(), argvlen.data());
+    if (repl == nullptr || repl -> type != REDIS_REPLY_ARRAY || repl -> elements != 2)
+    {
+        if (repl != nullptr) freeReplyObject(repl);
+        throw std::runtime_error("Could not read queue depth");
+    }
+    rq::QueueDepth depth;
+    depth.pending = repl -> element[0] -> integer;
+    depth.processing = repl -> element[1] -> integer;
+    freeReplyObject(repl);
+    return depth;
+}
+
+template <typename Attempt>
+bool util::RedisQueue::_await(redisContext *ctx, uint8_t timeout, Attempt attempt)
+{
+    // Another worker may take the item we woke up for, so keep waiting 
+    // until the deadline. A zero timeout blocks indefinitely. Items may 
+    // arrive without waking us, e.g., items pushed to level 0 of a priority
+    // queue without ringing its doorbell, so the wait ends with one more 
+    // attempt.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+    while (true)
+    {
+        double remaining = 0;
+        if (timeout > 0)
+        {
+            remaining = std::chrono::duration<double>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return attempt();
+        }
+        if (!_block(ctx, remaining)) return attempt();
+        if (attempt()) return true;
+    }
 }
 
 void util::RedisQueue::lease(char *item, uint8_t duration, uint8_t timeout, bool blocking)
 {
-    _rpoplpush(blocking, timeout, item);
-    if(strcmp(item, "END") != 0) _setex(item, duration);
+    // Kept for existing callers, which do not pass the size of their buffer
+    if (!lease_into(item, SIZE_MAX, duration, timeout, blocking)) strcpy(item, "END");
+}
+
+bool util::RedisQueue::lease_into(
+    char *item, size_t capacity, uint8_t duration, uint8_t timeout, bool blocking)
+{
+    if (capacity > 0) item[0] = '\0';
+    RedisPool::Connection conn = _pool -> acquire();
+    redisContext *ctx = conn.get();
+    if (_lease(ctx, item, capacity, duration)) return true;
+    return blocking && _await(ctx, timeout, [&]() { return _lease(ctx, item, capacity, duration); });
+}
+
+util::Lease util::RedisQueue::lease_item(uint8_t duration, uint8_t timeout, bool blocking)
+{
+    RedisPool::Connection conn = _pool -> acquire();
+    redisContext *ctx = conn.get();
+    Lease lease = _lease_one(ctx, duration);
+    if (lease || !blocking) return lease;
+    _await(ctx, timeout, [&]() 
+    { 
+        lease = _lease_one(ctx, duration); 
+        return static_cast<bool>(lease);
+    });
+    return lease;
+}
+
+std::vector<util::LeasedItem> util::RedisQueue::lease_batch(
+    size_t n, uint8_t duration, uint8_t timeout, bool blocking)
+{
+    std::vector<LeasedItem> leased;
+    if (n == 0) return leased;
+    RedisPool::Connection conn = _pool -> acquire();
+    redisContext *ctx = conn.get();
+    auto attempt = [&]()
+    {
+        redisReply *repl = _lease(ctx, n, duration);
+        if (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY)
+        {
+            leased.reserve(repl -> elements / 2);
+            for (size_t idx = 0; idx + 1 < repl -> elements; idx += 2)
+            {
+                redisReply *item = repl -> element[idx];
+                redisReply *key = repl -> element[idx + 1];
+                leased.push_back({ 
+                    std::string(item -> str, item -> len), 
+                    std::string(key -> str, key -> len) });
+                if (_heartbeat) _heartbeat -> track(leased.back().item, leased.back().lease_key);
+            }
+        }
+        freeReplyObject(repl);
+        return !leased.empty();
+    };
+    if (!attempt() && blocking) _await(ctx, timeout, attempt);
+    return leased;
+}
+
+void util::RedisQueue::_complete(std::string_view item)
+{
+    rq::stats::Timer timer(CLIENT, Command::COMPLETE);
+    RedisPool::Connection conn = _pool -> acquire();
+    redisReply *repl = _run(conn.get(), _complete_cmd, _complete_script, { item });
+    if(repl != nullptr) freeReplyObject(repl);
+}
+
+void util::RedisQueue::_ack(std::string_view id)
+{
+    rq::stats::Timer timer(CLIENT, Command::COMPLETE);
+    RedisPool::Connection conn = _pool -> acquire();
+    redisContext *ctx = conn.get();
+    _append(ctx, _xack_cmd, { id });
+    _append(ctx, _xdel_cmd, { id });
+    for (size_t idx = 0; idx < 2; idx += 1)
+    {
+        redisReply *repl = nullptr;
+        if (_get_reply(ctx, &repl) != REDIS_OK) 
+            throw std::runtime_error("Could not acknowledge item, connection lost");
+        freeReplyObject(repl);
+    }
 }
 
 void util::RedisQueue::complete(const char* item)
 {
-    _lrem(item);
-    _del(item);
-}
\ No newline at end of file
+    // Released first, so that the heartbeat never mistakes a completed 
+    // lease for a lost one
+    if (_heartbeat) _heartbeat -> release_item(item);
+    if (_layout != rq::Layout::STREAM)
+    {
+        _complete(item);
+        return;
+    }
+    std::string id;
+    {
+        std::lock_guard<std::mutex> lock(_stream_ids_mtx);
+        auto found = _stream_ids.find(item);
+        if (found == _stream_ids.end()) 
+            throw std::runtime_error("Item was not leased by this handle");
+        id = std::move(found -> second);
+        _stream_ids.erase(found);
+    }
+    _ack(id);
+}
+
+void util::RedisQueue::complete(Lease &&lease)
+{
+    // The reply backing the views is released when this function returns
+    Lease completed = std::move(lease);
+    if (!completed) return;
+    if (_heartbeat) _heartbeat -> release(std::string(completed.lease_key()));
+    // Lease keys of the stream layout are entry ids
+    if (_layout == rq::Layout::STREAM) _ack(completed.lease_key());
+    else _complete(completed.item());
+}
+
+void util::RedisQueue::complete_batch(std::vector<LeasedItem> const &items)
+{
+    if (items.empty()) return;
+    if (_heartbeat)
+        for (LeasedItem const &leased: items) _heartbeat -> release(leased.lease_key);
+    rq::stats::Timer timer(CLIENT, Command::COMPLETE_BATCH);
+    RedisPool::Connection conn = _pool -> acquire();
+    redisContext *ctx = conn.get();
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    argv.reserve(items.size() + 2);
+    argvlen.reserve(items.size() + 2);
+    // Appends one variadic command taking an argument from every item
+    auto append = [&](const char *cmd, std::initializer_list<std::string const*> keys, auto arg_of)
+    {
+        argv.assign({ cmd });
+        argvlen.assign({ strlen(cmd) });
+        for (std::string const *key: keys)
+        {
+            argv.push_back(key -> data());
+            argvlen.push_back(key -> size());
+        }
+        for (LeasedItem const &leased: items)
+        {
+            std::pair<const char*, size_t> arg = arg_of(leased);
+            argv.push_back(arg.first);
+            argvlen.push_back(arg.second);
+        }
+        _append(ctx, argv.size(), argv.data(), argvlen.data());
+    };
+    auto lease_key_of = [](LeasedItem const &leased)
+    {
+        return std::make_pair(leased.lease_key.data(), leased.lease_key.size());
+    };
+    size_t replies = 0;
+    // Items leave the processing queue before their leases are deleted, so 
+    // an item is never seen in processing without a lease
+    if (_layout == rq::Layout::LIST)
+    {
+        for (LeasedItem const &leased: items)
+        {
+            _append(ctx, _lrem_cmd, { leased.item });
+            replies += 1;
+        }
+    } else if (_layout == rq::Layout::ZSET)
+    {
+        // Item ids are the suffix of the lease keys
+        size_t prefix = _lease_key_prefix.size();
+        auto id_of = [prefix](LeasedItem const &leased)
+        {
+            return std::make_pair(
+                leased.lease_key.data() + prefix, leased.lease_key.size() - prefix);
+        };
+        append(ZREM, { &_processing_q_name }, id_of);
+        append(HDEL, { &_payloads_name }, id_of);
+        replies += 2;
+    }
+    if (_layout == rq::Layout::STREAM)
+    {
+        // Lease keys are entry ids, acknowledged entries are deleted so 
+        // that the stream only holds waiting and pending items
+        append(XACK, { &_processing_q_name, &_group }, lease_key_of);
+        append(XDEL, { &_processing_q_name }, lease_key_of);
+        replies += 2;
+    } else
+    {
+        append(DEL, {}, lease_key_of);
+        // Counted without checking the removals, which only differs for 
+        // items whose lease expired while they were processed
+        std::string count = std::to_string(items.size());
+        const char *incr_argv[3] = { INCRBY, _completed_name.c_str(), count.c_str() };
+        size_t incr_argvlen[3] = { strlen(INCRBY), _completed_name.size(), count.size() };
+        _append(ctx, 3, incr_argv, incr_argvlen);
+        replies += 2;
+    }
+    for (size_t idx = 0; idx < replies; idx += 1)
+    {
+        redisReply *repl = nullptr;
+        if (_get_reply(ctx, &repl) != REDIS_OK) 
+            throw std::runtime_error("Could not complete batch, connection lost");
+        freeReplyObject(repl);
+    }
+}
+
+size_t util::RedisQueue::release_batch(std::vector<LeasedItem> const &items)
+{
+    if (items.empty()) return 0;
+    if (_heartbeat)
+        for (LeasedItem const &leased: items) _heartbeat -> release(leased.lease_key);
+    const char *layout = (_layout == rq::Layout::LIST) ? "list" 
+        : (_layout == rq::Layout::ZSET) ? "zset" : "stream";
+    // Blocked priority leases wait on the doorbell
+    bool doorbell = _priorities.enabled();
+    std::string const &prefix = (_layout == rq::Layout::STREAM) ? _group : _lease_key_prefix;
+    std::vector<const char*> argv = { 
+        nullptr, nullptr, doorbell ? "4" : "3", 
+        _main_q_name.c_str(), _processing_q_name.c_str(), _payloads_name.c_str() };
+    std::vector<size_t> argvlen = { 
+        0, 0, 1, _main_q_name.size(), _processing_q_name.size(), _payloads_name.size() };
+    if (doorbell)
+    {
+        argv.push_back(_doorbell_name.c_str());
+        argvlen.push_back(_doorbell_name.size());
+    }
+    argv.insert(argv.end(), { layout, prefix.c_str(), _session.c_str() });
+    argvlen.insert(argvlen.end(), { strlen(layout), prefix.size(), _session.size() });
+    for (LeasedItem const &leased: items)
+    {
+        argv.insert(argv.end(), { leased.item.data(), leased.lease_key.data() });
+        argvlen.insert(argvlen.end(), { leased.item.size(), leased.lease_key.size() });
+    }
+    rq::stats::Timer timer(CLIENT, Command::RELEASE);
+    RedisPool::Connection conn = _pool -> acquire();
+    redisReply *repl = _evalsha(
+        conn.get(), _release_sha, rq::scripts::RELEASE, argv.size(), argv.data(), argvlen.data());
+    if (repl == nullptr || repl -> type != REDIS_REPLY_INTEGER)
+    {
+        if (repl != nullptr) freeReplyObject(repl);
+        throw std::runtime_error("Could not release leased items");
+    }
+    size_t released = repl -> integer;
+    freeReplyObject(repl);
+    return released;
+}
+
+std::vector<bool> util::RedisQueue::_extend(std::vector<std::string> const &keys, uint8_t duration)
+{
+    std::string _duration = std::to_string(duration);
+    std::string _numkeys = std::to_string(keys.size());
+    std::vector<const char*> argv = { nullptr, nullptr, _numkeys.c_str() };
+    std::vector<size_t> argvlen = { 0, 0, _numkeys.size() };
+    argv.reserve(keys.size() + 5);
+    argvlen.reserve(keys.size() + 5);
+    bool stream = _layout == rq::Layout::STREAM;
+    if (stream)
+    {
+        // Leases of the stream layout are entry ids passed as arguments, 
+        // pending entries have no duration but an idle time
+        argv = { nullptr, nullptr, "1", _processing_q_name.c_str(), _group.c_str(), _session.c_str() };
+        argvlen = { 0, 0, 1, _processing_q_name.size(), _group.size(), _session.size() };
+    }
+    for (std::string const &key: keys)
+    {
+        argv.push_back(key.data());
+        argvlen.push_back(key.size());
+    }
+    if (!stream)
+    {
+        argv.insert(argv.end(), { _session.c_str(), _duration.c_str() });
+        argvlen.insert(argvlen.end(), { _session.size(), _duration.size() });
+    }
+    rq::stats::Timer timer(CLIENT, Command::EXTEND);
+    RedisPool::Connection conn = _pool -> acquire();
+    redisReply *repl = _evalsha(
+        conn.get(), _extend_sha, stream ? rq::scripts::EXTEND_STREAM : rq::scripts::EXTEND, 
+        argv.size(), argv.data(), argvlen.data());
+    if (repl == nullptr || repl -> type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(repl);
+        throw std::runtime_error("Could not extend leases");
+    }
+    std::vector<bool> held(repl -> elements, false);
+    for (size_t idx = 0; idx < repl -> elements; idx += 1)
+        held[idx] = repl -> element[idx] -> integer == 1;
+    freeReplyObject(repl);
+    return held;
+}
+
+void util::RedisQueue::start_heartbeat(
+    uint8_t duration, 
+    std::chrono::milliseconds interval, 
+    rq::Heartbeat::LostHandler on_lost)
+{
+    _heartbeat.reset();
+    _heartbeat = std::make_unique<rq::Heartbeat>(
+        [this, duration](std::vector<std::string> const &keys) 
+        { 
+            return _extend(keys, duration); 
+        }, 
+        interval, std::move(on_lost));
+}
+
+bool util::RedisQueue::lease_held(std::string const &lease_key) const
+{
+    return _heartbeat && _heartbeat -> held(lease_key);
+}
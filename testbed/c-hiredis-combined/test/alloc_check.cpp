@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <hiredis.h>
+#include "rqueue.h"
+#include "keys.h"
+#include "cli.h"
+#include "alloc_counter.h"
+
+/// Steady state lease and complete loop of the combined consumer, failing if
+/// a cycle allocates more than the baseline. With a reply arena the queue
+/// code allocates nothing per cycle. hiredis 1.1.0 replaces its output
+/// buffer with a fresh empty one after every write and grows it again for
+/// the next command, i.e., two allocations for each of the lease and the
+/// complete command.
+
+/// @brief Most C++ allocations allowed in one steady state cycle
+static constexpr size_t MAX_CXX_ALLOCATIONS = 0;
+
+/// @brief Most hiredis allocations allowed in one steady state cycle
+static constexpr size_t MAX_HIREDIS_ALLOCATIONS = 4;
+
+/// @brief Exit code reported to ctest if no redis server is reachable
+static constexpr int SKIPPED = 77;
+
+static const char *USAGE =
+    "Usage: rq-alloc-check [options]\n"
+    "  -H, --host HOST        redis server, default localhost\n"
+    "  -p, --port PORT        redis port, default 8888\n"
+    "  -q, --queue NAME       scratch queue, deleted before and after, default rq-alloc-check\n"
+    "  -n, --cycles N         measured lease and complete cycles, default 1000\n"
+    "      --warmup N         cycles run before measuring, default 100\n"
+    "  -h, --help             show this help\n";
+
+/// @brief Deletes the keys of the scratch queue and pushes count items
+static bool _fill(redisContext *ctx, std::string const &queue_name, size_t count)
+{
+    rq::QueueKeys keys(queue_name);
+    redisReply *repl = (redisReply*) redisCommand(
+        ctx, "DEL %s %s %s", keys.main.c_str(), keys.processing.c_str(), keys.completed.c_str());
+    if (repl == nullptr) return false;
+    freeReplyObject(repl);
+    if (count == 0) return true;
+    std::vector<std::string> items;
+    items.reserve(count);
+    for (size_t idx = 0; idx < count; idx += 1) items.push_back("item-" + std::to_string(idx));
+    std::vector<const char*> argv = { "RPUSH", keys.main.c_str() };
+    std::vector<size_t> argvlen = { 5, keys.main.size() };
+    for (std::string const &item: items)
+    {
+        argv.push_back(item.c_str());
+        argvlen.push_back(item.size());
+    }
+    repl = (redisReply*) redisCommandArgv(ctx, argv.size(), argv.data(), argvlen.data());
+    bool pushed = repl != nullptr && repl -> type == REDIS_REPLY_INTEGER;
+    freeReplyObject(repl);
+    return pushed;
+}
+
+int main(int argc, char **argv)
+{
+    std::string host_name = "localhost";
+    uint16_t port = 8888;
+    std::string queue_name = "rq-alloc-check";
+    size_t cycles = 1000;
+    size_t warmup = 100;
+    enum { WARMUP = 256 };
+    const option options[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "queue", required_argument, nullptr, 'q' },
+        { "cycles", required_argument, nullptr, 'n' },
+        { "warmup", required_argument, nullptr, WARMUP },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 } };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "H:p:q:n:h", options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host_name = optarg; break;
+            case 'p': port = rq::cli::port(optarg); break;
+            case 'q': queue_name = optarg; break;
+            case 'n': cycles = rq::cli::number("cycles", optarg); break;
+            case WARMUP: warmup = rq::cli::number("warmup", optarg); break;
+            case 'h':
+                std::cout << USAGE;
+                return 0;
+            default:
+                std::cout << USAGE;
+                return 1;
+        }
+    }
+    util::count_hiredis_allocations();
+    redisContext *ctx = redisConnectWithTimeout(host_name.c_str(), port, {1, 500000});
+    if (ctx == nullptr || ctx -> err)
+    {
+        std::cout << "No redis server at " << host_name << ":" << port << ", skipping\n";
+        if (ctx != nullptr) redisFree(ctx);
+        return SKIPPED;
+    }
+    if (!_fill(ctx, queue_name, warmup + cycles))
+    {
+        std::cout << "Could not fill the queue " << queue_name << "\n";
+        redisFree(ctx);
+        return 1;
+    }
+    util::AllocationCount worst;
+    size_t over = 0;
+    {
+        util::RedisQueue q = { queue_name, host_name, port };
+        q.use_arena(std::make_shared<util::ReplyArena>());
+        for (size_t idx = 0; idx < warmup + cycles; idx += 1)
+        {
+            util::AllocationCount start = util::allocations();
+            util::Lease lease = q.lease_item(5, 1, false);
+            if (!lease)
+            {
+                std::cout << "Queue ran empty after " << idx << " items\n";
+                _fill(ctx, queue_name, 0);
+                redisFree(ctx);
+                return 1;
+            }
+            q.complete(std::move(lease));
+            util::AllocationCount used = util::allocations() - start;
+            if (idx < warmup) continue;
+            worst.cxx = std::max(worst.cxx, used.cxx);
+            worst.hiredis = std::max(worst.hiredis, used.hiredis);
+            if (used.cxx > MAX_CXX_ALLOCATIONS || used.hiredis > MAX_HIREDIS_ALLOCATIONS) over += 1;
+        }
+    }
+    _fill(ctx, queue_name, 0);
+    redisFree(ctx);
+    std::cout << "Most heap allocations of a cycle: " << worst.cxx << " C++, "
+        << worst.hiredis << " hiredis, baseline " << MAX_CXX_ALLOCATIONS << " C++, "
+        << MAX_HIREDIS_ALLOCATIONS << " hiredis\n";
+    if (over > 0)
+    {
+        std::cout << over << " of " << cycles << " cycles allocated more than the baseline\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <hiredis.h>
+#include "alloc_counter.h"
+
+namespace
+{
+    thread_local size_t _cxx = 0;
+    thread_local size_t _hiredis = 0;
+
+    void *_malloc(size_t size)
+    {
+        _hiredis += 1;
+        return malloc(size);
+    }
+
+    void *_calloc(size_t count, size_t size)
+    {
+        _hiredis += 1;
+        return calloc(count, size);
+    }
+
+    void *_realloc(void *ptr, size_t size)
+    {
+        _hiredis += 1;
+        return realloc(ptr, size);
+    }
+
+    char *_strdup(const char *str)
+    {
+        _hiredis += 1;
+        return strdup(str);
+    }
+} // namespace
+
+// Replacing the global allocation functions counts every C++ allocation of
+// the process, the array and nothrow forms forward to these
+void *operator new(size_t size)
+{
+    _cxx += 1;
+    void *ptr = malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+util::AllocationCount util::allocations()
+{
+    return { _cxx, _hiredis };
+}
+
+void util::count_hiredis_allocations()
+{
+    hiredisAllocFuncs funcs = { _malloc, _calloc, _realloc, _strdup, free };
+    hiredisSetAllocators(&funcs);
+}
@@ -0,0 +1,33 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stddef.h>
+
+
+namespace util
+{
+    /// @brief Heap allocations made by the calling thread, split into C++
+    /// allocations and allocations made by hiredis. Counting replaces the
+    /// global operator new, so alloc_counter.cpp is only linked into the
+    /// allocation check and never into the rqueue library.
+    struct AllocationCount
+    {
+        size_t cxx = 0;
+        size_t hiredis = 0;
+
+        inline AllocationCount operator-(AllocationCount const &other) const
+        {
+            return { cxx - other.cxx, hiredis - other.hiredis };
+        }
+    };
+
+    /// @brief Current allocation counters of the calling thread
+    AllocationCount allocations();
+
+    /// @brief Installs counting allocators in hiredis, should be called
+    /// before the first connection is opened
+    void count_hiredis_allocations();
+} // namespace util
+
+
+#endif // ALLOC_COUNTER_H
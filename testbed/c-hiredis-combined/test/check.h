@@ -0,0 +1,39 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+/// Minimal assertions of the unit tests. A failed check is reported with its
+/// location and the test keeps running, main returns failed() so that ctest
+/// sees every failure of a run at once.
+namespace rq
+{
+    namespace test
+    {
+        /// @brief Number of failed checks so far
+        inline int &failures()
+        {
+            static int count = 0;
+            return count;
+        }
+
+        /// @brief Exit code of a test, non zero if any check failed
+        inline int failed()
+        {
+            if (failures() > 0) printf("%d checks failed\n", failures());
+            return failures() > 0 ? 1 : 0;
+        }
+    } // namespace test
+} // namespace rq
+
+#define RQ_CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            rq::test::failures() += 1; \
+        } \
+    } while (0)
+
+#endif // CHECK_H
@@ -0,0 +1,24 @@
+#include <string>
+#include "cluster.h"
+#include "check.h"
+
+/// Hash slots against the published vectors of the redis cluster spec
+int main()
+{
+    RQ_CHECK(rq::crc16("123456789") == 0x31C3);
+    RQ_CHECK(rq::crc16("") == 0);
+    RQ_CHECK(rq::key_slot("foo") == 12182);
+    RQ_CHECK(rq::key_slot("somekey") == 11058);
+    // Only the hash tag is hashed
+    RQ_CHECK(rq::key_slot("{user1000}.following") == rq::key_slot("user1000"));
+    RQ_CHECK(rq::key_slot("{user1000}.followers") == rq::key_slot("{user1000}.following"));
+    RQ_CHECK(rq::hashed_part("foo{bar}{zap}") == "bar");
+    RQ_CHECK(rq::hashed_part("foo{{bar}}zap") == "{bar");
+    // An empty tag or an unclosed brace hashes the whole key
+    RQ_CHECK(rq::hashed_part("foo{}{bar}") == "foo{}{bar}");
+    RQ_CHECK(rq::hashed_part("foo{bar") == "foo{bar");
+    RQ_CHECK(rq::hash_tag("foo") == "{foo}");
+    RQ_CHECK(rq::hash_tag("{foo}") == "{foo}");
+    RQ_CHECK(rq::key_slot(rq::hash_tag("foo") + ":processing") == rq::key_slot("foo"));
+    return rq::test::failed();
+}
@@ -0,0 +1,61 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "local_queue.h"
+#include "check.h"
+
+using namespace std::chrono_literals;
+
+int main()
+{
+    // Expired leases return to the queue through the timer wheel and are 
+    // delivered again with a new lease key
+    rq::LocalBroker broker(16);
+    RQ_CHECK(broker.publish("a"));
+    std::vector<rq::LeasedItem> first = broker.lease(1, 30ms);
+    RQ_CHECK(first.size() == 1 && first[0].item == "a");
+    RQ_CHECK(broker.lease(1, 30ms).empty());
+    RQ_CHECK(broker.depth().pending == 0);
+    RQ_CHECK(broker.depth().processing == 1);
+    std::this_thread::sleep_for(80ms);
+    std::vector<rq::LeasedItem> again = broker.lease(1, 1s);
+    RQ_CHECK(again.size() == 1 && again[0].item == "a");
+    RQ_CHECK(again.size() == 1 && again[0].lease_key != first[0].lease_key);
+    // The expired lease cannot complete the item any more
+    RQ_CHECK(!broker.complete(first[0].lease_key));
+    RQ_CHECK(broker.complete(again[0].lease_key));
+    RQ_CHECK(broker.depth().empty());
+
+    // Completed and extended leases are not delivered again
+    RQ_CHECK(broker.publish("b"));
+    RQ_CHECK(broker.publish("c"));
+    std::vector<rq::LeasedItem> held = broker.lease(2, 30ms);
+    RQ_CHECK(held.size() == 2);
+    RQ_CHECK(held.size() == 2 && broker.complete(held[0].lease_key));
+    RQ_CHECK(held.size() == 2 && broker.extend(held[1].lease_key, 1s));
+    std::this_thread::sleep_for(80ms);
+    RQ_CHECK(broker.lease(2, 1s).empty());
+    RQ_CHECK(broker.depth().processing == 1);
+
+    // A blocked lease wakes up for an item whose lease expires meanwhile
+    RQ_CHECK(broker.publish("d"));
+    RQ_CHECK(broker.lease(1, 30ms).size() == 1);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<rq::LeasedItem> woken = broker.lease(1, 1s, 2s);
+    auto waited = std::chrono::steady_clock::now() - start;
+    RQ_CHECK(woken.size() == 1 && woken[0].item == "d");
+    RQ_CHECK(waited < 1s);
+
+    // Handles of one name share their queue, complete takes the item
+    rq::LocalQueue producer("test_local_queue");
+    rq::LocalQueue consumer("test_local_queue");
+    RQ_CHECK(producer.publish("e"));
+    std::optional<std::string> item = consumer.lease(30ms, 0ms, false);
+    RQ_CHECK(item && *item == "e");
+    consumer.complete("e");
+    std::this_thread::sleep_for(80ms);
+    RQ_CHECK(!consumer.lease(30ms, 0ms, false));
+    RQ_CHECK(producer.empty());
+    return rq::test::failed();
+}
@@ -0,0 +1,99 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "mpmc_ring.h"
+#include "check.h"
+
+/// @brief Producers and consumers pass every value exactly once through a
+/// small ring, so that all of them wrap around many times and keep finding
+/// the ring full or empty
+static void _contention(size_t producers, size_t consumers, size_t per_producer)
+{
+    rq::MpmcRing<uint64_t> ring(16);
+    size_t total = producers * per_producer;
+    std::vector<std::atomic<uint32_t>> seen(total);
+    std::atomic<size_t> popped{0};
+    std::atomic<size_t> out_of_order{0};
+    std::vector<std::thread> threads;
+    for (size_t producer = 0; producer < producers; producer += 1)
+    {
+        threads.emplace_back([&, producer]()
+        {
+            for (size_t idx = 0; idx < per_producer; idx += 1)
+            {
+                // Values of a producer are consecutive
+                uint64_t value = producer * per_producer + idx;
+                while (!ring.try_push(value)) std::this_thread::yield();
+            }
+        });
+    }
+    for (size_t consumer = 0; consumer < consumers; consumer += 1)
+    {
+        threads.emplace_back([&]()
+        {
+            // A consumer sees the values of every producer in push order
+            std::vector<int64_t> last(producers, -1);
+            uint64_t value = 0;
+            while (popped.load(std::memory_order_relaxed) < total)
+            {
+                if (!ring.try_pop(value))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                popped.fetch_add(1, std::memory_order_relaxed);
+                seen[value].fetch_add(1, std::memory_order_relaxed);
+                size_t producer = value / per_producer;
+                if ((int64_t) value <= last[producer]) out_of_order.fetch_add(1);
+                last[producer] = (int64_t) value;
+            }
+        });
+    }
+    for (std::thread &thread: threads) thread.join();
+    size_t once = 0;
+    for (std::atomic<uint32_t> const &count: seen) once += count.load() == 1;
+    RQ_CHECK(popped.load() == total);
+    RQ_CHECK(once == total);
+    RQ_CHECK(out_of_order.load() == 0);
+    RQ_CHECK(ring.empty());
+}
+
+int main()
+{
+    RQ_CHECK(rq::MpmcRing<int>(5).capacity() == 8);
+    RQ_CHECK(rq::MpmcRing<int>(8).capacity() == 8);
+    RQ_CHECK(rq::MpmcRing<int>(0).capacity() == 2);
+
+    // Full and empty, then many laps around a ring of four cells
+    rq::MpmcRing<int> ring(4);
+    int value = 0;
+    RQ_CHECK(ring.empty());
+    RQ_CHECK(!ring.try_pop(value));
+    for (int idx = 0; idx < 4; idx += 1) RQ_CHECK(ring.try_push(idx));
+    RQ_CHECK(!ring.try_push(4));
+    RQ_CHECK(ring.size() == 4);
+    for (int idx = 0; idx < 4; idx += 1)
+    {
+        RQ_CHECK(ring.try_pop(value));
+        RQ_CHECK(value == idx);
+    }
+    RQ_CHECK(!ring.try_pop(value));
+    int next_push = 0;
+    int next_pop = 0;
+    for (int lap = 0; lap < 100; lap += 1)
+    {
+        for (int idx = 0; idx < 3; idx += 1) RQ_CHECK(ring.try_push(next_push++));
+        for (int idx = 0; idx < 3; idx += 1)
+        {
+            RQ_CHECK(ring.try_pop(value));
+            RQ_CHECK(value == next_pop++);
+        }
+    }
+    RQ_CHECK(ring.empty());
+
+    _contention(1, 1, 100000);
+    _contention(4, 4, 50000);
+    _contention(8, 2, 20000);
+    return rq::test::failed();
+}
@@ -0,0 +1,65 @@
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "priority.h"
+#include "check.h"
+
+/// @brief Whether creating the schedule throws
+static bool _rejected(size_t levels, std::vector<unsigned> const &weights)
+{
+    try
+    {
+        rq::PrioritySchedule schedule(levels, weights);
+    }
+    catch(std::runtime_error const &)
+    {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    // Strict priorities start every lease at the highest level
+    rq::PrioritySchedule strict(3);
+    RQ_CHECK(strict.enabled());
+    RQ_CHECK(!strict.weighted());
+    for (uint64_t ticket = 0; ticket < 10; ticket += 1)
+    {
+        RQ_CHECK(strict.first(ticket) == 2);
+        RQ_CHECK(strict.first_position(ticket) == 1);
+    }
+    RQ_CHECK(!rq::PrioritySchedule(1).enabled());
+
+    // Every level receives its weight in each period of the schedule
+    std::vector<unsigned> weights = { 1, 2, 5 };
+    rq::PrioritySchedule weighted(3, weights);
+    RQ_CHECK(weighted.weighted());
+    std::vector<size_t> counts(3, 0);
+    for (uint64_t ticket = 0; ticket < 800; ticket += 1) counts[weighted.first(ticket)] += 1;
+    RQ_CHECK(counts[0] == 100);
+    RQ_CHECK(counts[1] == 200);
+    RQ_CHECK(counts[2] == 500);
+    // Levels are interleaved, the heaviest one is never served more than 
+    // twice in a row with these weights
+    size_t run = 0;
+    for (uint64_t ticket = 0; ticket < 16; ticket += 1)
+    {
+        run = (weighted.first(ticket) == 2) ? run + 1 : 0;
+        RQ_CHECK(run <= 2);
+    }
+    // Positions count from the highest level, as the lease script expects
+    for (uint64_t ticket = 0; ticket < 8; ticket += 1)
+        RQ_CHECK(weighted.first_position(ticket) == 3 - weighted.first(ticket));
+
+    std::vector<std::string> keys = weighted.keys("q");
+    RQ_CHECK(keys.size() == 3);
+    RQ_CHECK(keys[0] == rq::priority_key("q", 2));
+    RQ_CHECK(keys[2] == "q");
+
+    RQ_CHECK(rq::weights_from("1,2,5") == weights);
+    RQ_CHECK(_rejected(3, { 1, 2 }));
+    RQ_CHECK(_rejected(2, { 0, 0 }));
+    RQ_CHECK(_rejected(2, { rq::PrioritySchedule::MAX_WEIGHT, 1 }));
+    return rq::test::failed();
+}
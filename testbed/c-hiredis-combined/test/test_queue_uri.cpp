@@ -0,0 +1,58 @@
+#include <stdexcept>
+#include <string>
+#include "queue_uri.h"
+#include "check.h"
+
+/// @brief Whether parsing the URI throws
+static bool _rejected(std::string const &uri)
+{
+    try
+    {
+        rq::QueueUri::parse(uri);
+    }
+    catch(std::runtime_error const &)
+    {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    rq::QueueUri local = rq::QueueUri::parse("local://bar");
+    RQ_CHECK(local.scheme == rq::QueueUri::Scheme::LOCAL);
+    RQ_CHECK(local.queue == "bar");
+    RQ_CHECK(rq::QueueUri::parse("local://").queue == "foo");
+
+    rq::QueueUri redis = rq::QueueUri::parse("redis://cache.internal:7000/jobs");
+    RQ_CHECK(redis.scheme == rq::QueueUri::Scheme::REDIS);
+    RQ_CHECK(redis.host == "cache.internal");
+    RQ_CHECK(redis.port == 7000);
+    RQ_CHECK(redis.queue == "jobs");
+    RQ_CHECK(!redis.cluster);
+    RQ_CHECK(!redis.replica_reads);
+
+    // Missing parts keep their defaults
+    rq::QueueUri host_only = rq::QueueUri::parse("redis://redis");
+    RQ_CHECK(host_only.host == "redis");
+    RQ_CHECK(host_only.port == 6379);
+    RQ_CHECK(host_only.queue == "foo");
+    rq::QueueUri queue_only = rq::QueueUri::parse("redis:///jobs");
+    RQ_CHECK(queue_only.host == "localhost");
+    RQ_CHECK(queue_only.queue == "jobs");
+
+    rq::QueueUri cluster = rq::QueueUri::parse("redis-cluster://seed:7001/jobs?reads=replica");
+    RQ_CHECK(cluster.cluster);
+    RQ_CHECK(cluster.replica_reads);
+    RQ_CHECK(cluster.host == "seed");
+    RQ_CHECK(cluster.port == 7001);
+    RQ_CHECK(cluster.queue == "jobs");
+
+    RQ_CHECK(rq::QueueUri::is_uri("local://foo"));
+    RQ_CHECK(!rq::QueueUri::is_uri("localhost"));
+    RQ_CHECK(_rejected("localhost"));
+    RQ_CHECK(_rejected("http://host/jobs"));
+    RQ_CHECK(_rejected("redis://host/jobs?reads=replica"));
+    RQ_CHECK(_rejected("redis-cluster://host/jobs?reads=primary"));
+    return rq::test::failed();
+}
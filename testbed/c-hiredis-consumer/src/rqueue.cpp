@@ -1,6 +1,5 @@
 #include <stdexcept>
-#include <functional>
-#include <assert.h>
+#include <string.h>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -35,13 +34,46 @@ util::RedisQueue::RedisQueue(
         throw std::runtime_error("Could not connect to redis server, exiting...");
     }
     _session = boost::uuids::to_string(boost::uuids::random_generator_mt19937()());
-    _processing_q_name = _main_q_name + ":processing";
-    _lease_key_prefix = _main_q_name + ":leased_by_session:";
+    rq::QueueKeys keys(_main_q_name);
+    _processing_q_name = keys.processing;
+    _payloads_name = keys.payloads;
+    _completed_name = keys.completed;
+    _lease_key_prefix = keys.lease_prefix;
+    _lease_sha = _load(rq::scripts::LEASE);
+    _complete_sha = _load(rq::scripts::COMPLETE);
+    _lease_exists_sha = _load(rq::scripts::LEASE_EXISTS);
 }
 
-inline size_t util::RedisQueue::_key_for(const char *item)
+std::string util::RedisQueue::_load(const char *script)
 {
-    return std::hash<std::string>{}(item);
+    redisReply *repl = (redisReply*) redisCommand(ctx, "SCRIPT LOAD %s", script);
+    if (repl == nullptr || repl -> type != REDIS_REPLY_STRING)
+    {
+        printf("Could not load script: %s\n", (repl != nullptr) ? repl -> str : ctx -> errstr);
+        freeReplyObject(repl);
+        throw std::runtime_error("Could not initialize RedisQueue, exiting...");
+    }
+    std::string sha(repl -> str, repl -> len);
+    freeReplyObject(repl);
+    return sha;
+}
+
+redisReply *util::RedisQueue::_evalsha(
+    std::string &sha, const char *script, int argc, const char **argv)
+{
+    argv[0] = EVALSHA;
+    argv[1] = sha.c_str();
+    redisReply *repl = (redisReply*) redisCommandArgv(ctx, argc, argv, NULL);
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ERROR 
+        && strncmp(repl -> str, "NOSCRIPT", 8) == 0)
+    {
+        // Script cache was flushed e.g., by SCRIPT FLUSH or a restart
+        freeReplyObject(repl);
+        sha = _load(script);
+        argv[1] = sha.c_str();
+        repl = (redisReply*) redisCommandArgv(ctx, argc, argv, NULL);
+    }
+    return repl;
 }
 
 size_t util::RedisQueue::_llen(RedisQueue::QType _q) const
@@ -59,67 +91,41 @@ size_t util::RedisQueue::_llen(RedisQueue::QType _q) const
 
 bool util::RedisQueue::_lease_exists(const char *item)
 {
-    const char *arg = (_lease_key_prefix + std::to_string(_key_for(item))).c_str();
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx, "%s %s", 
-        EXISTS, arg);
-    bool _exs;
+    const char *argv[5] = { nullptr, nullptr, "0", _lease_key_prefix.c_str(), item };
+    redisReply *repl = _evalsha(_lease_exists_sha, rq::scripts::LEASE_EXISTS, 5, argv);
+    bool _exs = false;
     if (repl != nullptr) _exs = repl -> integer > 0;
     freeReplyObject(repl);
     return _exs;
 }
 
-void util::RedisQueue::_rpoplpush(bool blocking, uint8_t timeout, char *item)
+void util::RedisQueue::_lease(uint8_t duration, char *item)
 {
-    redisReply *repl;
-    (blocking)
-        ? repl = (redisReply*) redisCommand(
-            ctx, "%s %s %s %u",
-            BRPOPLPUSH, _main_q_name.c_str(), _processing_q_name.c_str(), timeout
-        )
-        : repl = (redisReply*) redisCommand(
-            ctx, "%s %s %s",
-            RPOPLPUSH, _main_q_name.c_str(), _processing_q_name.c_str()
-        );
-    (repl != nullptr && repl -> str != NULL)
-        ? strcpy(item, repl -> str)
-        : strcpy(item, "END");
+    std::string _duration = std::to_string(duration);
+    const char *argv[10] = {
+        nullptr, nullptr, "3", 
+        _main_q_name.c_str(), _processing_q_name.c_str(), _payloads_name.c_str(),
+        _lease_key_prefix.c_str(), _session.c_str(), _duration.c_str(), "1"
+    };
+    redisReply *repl = _evalsha(_lease_sha, rq::scripts::LEASE, 10, argv);
+    if (repl != nullptr && repl -> type == REDIS_REPLY_ARRAY && repl -> elements == 2)
+    {
+        strcpy(item, repl -> element[0] -> str);
+    }
     freeReplyObject(repl);
 }
 
-void util::RedisQueue::_setex(const char* item, uint8_t duration)
+void util::RedisQueue::_wait(uint8_t timeout)
 {
-    std::string _item_key = _lease_key_prefix + std::to_string(_key_for(item));
+    // Moving the head of the main queue onto itself blocks until an item 
+    // arrives without taking it, the item is leased by the script afterwards
     redisReply *repl = (redisReply*) redisCommand(
-        ctx,
-        "%s %s %u %s",
-        SETEX, _item_key.c_str(), duration, item
+        ctx, "%s %s %s LEFT LEFT %u",
+        BLMOVE, _main_q_name.c_str(), _main_q_name.c_str(), timeout
     );
-    if(repl != nullptr) assert(strcmp(repl -> str, "OK") == 0);
     freeReplyObject(repl);
 }
 
-void util::RedisQueue::_lrem(const char* item, uint8_t count)
-{
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx,
-        "%s %s %u %s",
-        LREM, _processing_q_name.c_str(), count, item
-    );
-    if(repl != nullptr) freeReplyObject(repl);
-}
-
-void util::RedisQueue::_del(const char *item)
-{
-    std::string _item_key = _lease_key_prefix + std::to_string(_key_for(item));
-    redisReply *repl = (redisReply*) redisCommand(
-        ctx,
-        "%s %s",
-        DEL, _item_key.c_str()
-    );
-    if(repl != nullptr) freeReplyObject(repl);
-}
-
 bool util::RedisQueue::empty() const
 {
     return (_llen(RedisQueue::QType::MAIN) == 0) && (_llen(RedisQueue::QType::PROCESSING));
@@ -127,12 +133,19 @@ bool util::RedisQueue::empty() const
 
 void util::RedisQueue::lease(char *item, uint8_t duration, uint8_t timeout, bool blocking)
 {
-    _rpoplpush(blocking, timeout, item);
-    if(strcmp(item, "END") != 0) _setex(item, duration);
+    strcpy(item, "END");
+    _lease(duration, item);
+    if (strcmp(item, "END") != 0 || !blocking) return;
+    _wait(timeout);
+    _lease(duration, item);
 }
 
 void util::RedisQueue::complete(const char* item)
 {
-    _lrem(item);
-    _del(item);
+    const char *argv[8] = {
+        nullptr, nullptr, "3", 
+        _processing_q_name.c_str(), _payloads_name.c_str(), _completed_name.c_str(),
+        _lease_key_prefix.c_str(), item
+    };
+    freeReplyObject(_evalsha(_complete_sha, rq::scripts::COMPLETE, 8, argv));
 }
\ No newline at end of file
@@ -2,14 +2,70 @@
 #include <hiredis.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#define PAYLOAD_SIZE 50
+
+// Sends count items as variadic RPUSH commands of up to chunk items each,
+// keeping at most depth commands in flight before waiting for a reply.
+// Returns the final length of the queue or -1 on error.
+static long long rpush_pipelined(
+    redisContext *ctx, const char *queue_name, size_t count, size_t chunk, size_t depth)
+{
+    char (*payloads)[PAYLOAD_SIZE] = malloc(chunk * PAYLOAD_SIZE);
+    const char **argv = malloc((chunk + 2) * sizeof(char*));
+    size_t *argvlen = malloc((chunk + 2) * sizeof(size_t));
+    if (payloads == NULL || argv == NULL || argvlen == NULL)
+    {
+        free(payloads); free(argv); free(argvlen);
+        return -1;
+    }
+    argv[0] = "RPUSH";
+    argvlen[0] = 5;
+    argv[1] = queue_name;
+    argvlen[1] = strlen(queue_name);
+    long long length = -1;
+    size_t pending = 0;
+    size_t idx = 1;
+    while (idx <= count || pending > 0)
+    {
+        if (idx <= count && pending < depth)
+        {
+            // Arguments are copied into the output buffer on append, so the
+            // payload buffers can be reused for the next chunk right away
+            int argc = 2;
+            for (; (size_t) argc - 2 < chunk && idx <= count; idx += 1, argc += 1)
+            {
+                argvlen[argc] = snprintf(payloads[argc - 2], PAYLOAD_SIZE, "bar-%lu", idx);
+                argv[argc] = payloads[argc - 2];
+            }
+            if (redisAppendCommandArgv(ctx, argc, argv, argvlen) != REDIS_OK) break;
+            pending += 1;
+            continue;
+        }
+        redisReply *reply;
+        if (redisGetReply(ctx, (void**) &reply) != REDIS_OK) break;
+        if (reply -> type == REDIS_REPLY_INTEGER) length = reply -> integer;
+        freeReplyObject(reply);
+        pending -= 1;
+    }
+    free(payloads);
+    free(argv);
+    free(argvlen);
+    return (idx > count && pending == 0) ? length : -1;
+}
+
 int main(int argc, char **argv)
 {
     // Define connection properties for redis
     const char *host_name = (argc > 1) ? argv[1] : "localhost";
-    uint16_t port = (argc > 2) ? *argv[2] : 8888;
+    uint16_t port = (argc > 2) ? (uint16_t) strtoul(argv[2], NULL, 10) : 8888;
     const char* queue_name = (argc > 3) ? argv[3] : "foo";
+    size_t count = (argc > 4) ? strtoul(argv[4], NULL, 10) : 15;
+    // Throughput mode is enabled by a non zero chunk size
+    size_t chunk = (argc > 5) ? strtoul(argv[5], NULL, 10) : 0;
+    size_t depth = (argc > 6) ? strtoul(argv[6], NULL, 10) : 16;
     // Attempt to establish connection
     struct timeval timeout = {1, 500000};
     redisContext *ctx = redisConnectWithTimeout(host_name, port, timeout);
@@ -31,15 +87,21 @@ int main(int argc, char **argv)
     printf("PING Response: %s\n", reply -> str);
     freeReplyObject(reply);
     // Attempt to send payload
-    for(size_t idx = 1; idx <= 15; idx += 1)
+    if (chunk > 0)
     {
-        char* payload = (char*) malloc(50 * sizeof(char));
-        snprintf(payload, 50, "bar-%lu", idx);
-        reply = redisCommand(ctx, "RPUSH %s %s", queue_name, payload);
-        free(payload);
-        printf("RPUSH Response: %lld\n", reply -> integer);
-        freeReplyObject(reply);
-        sleep(1);
+        long long length = rpush_pipelined(ctx, queue_name, count, chunk, depth > 0 ? depth : 1);
+        printf("RPUSH Response: %lld\n", length);
+    } else
+    {
+        char payload[PAYLOAD_SIZE];
+        for(size_t idx = 1; idx <= count; idx += 1)
+        {
+            snprintf(payload, PAYLOAD_SIZE, "bar-%lu", idx);
+            reply = redisCommand(ctx, "RPUSH %s %s", queue_name, payload);
+            printf("RPUSH Response: %lld\n", reply -> integer);
+            freeReplyObject(reply);
+            sleep(1);
+        }
     }
     // reply = redisCommand(ctx, "RPUSH %s %s", queue_name, "EOQ");
     // freeReplyObject(reply);
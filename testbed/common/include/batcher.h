@@ -0,0 +1,218 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "wait_strategy.h"
+
+namespace rq
+{
+    /// @brief View of the contiguous items of a batch, stands in for
+    /// std::span until the clients move to C++20
+    template <typename T>
+    class Span
+    {
+        T *_data;
+        size_t _size;
+
+        public:
+        Span(T *data, size_t size): _data(data), _size(size) {}
+
+        T *begin() const { return _data; }
+        T *end() const { return _data + _size; }
+        T *data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        T &operator[](size_t idx) const { return _data[idx]; }
+    };
+
+    /// @brief Result of a batch per item, every item succeeds unless the
+    /// handler marks it as failed
+    class BatchOutcome
+    {
+        std::vector<bool> _failed;
+        size_t _failures = 0;
+
+        public:
+        explicit BatchOutcome(size_t size): _failed(size, false) {}
+
+        /// @brief Marks the item at the given position of the batch as
+        /// failed, it is given back to the queue instead of being completed
+        void fail(size_t idx)
+        {
+            if (idx >= _failed.size()) throw std::out_of_range("Item outside of the batch");
+            if (_failed[idx]) return;
+            _failed[idx] = true;
+            _failures += 1;
+        }
+
+        /// @brief Marks every item of the batch as failed
+        void fail_all()
+        {
+            std::fill(_failed.begin(), _failed.end(), true);
+            _failures = _failed.size();
+        }
+
+        bool failed(size_t idx) const { return _failed.at(idx); }
+        size_t failures() const { return _failures; }
+        size_t size() const { return _failed.size(); }
+    };
+
+    /// @brief Options for the batcher
+    /// @tparam Duration Lease duration type of the queue client, e.g.,
+    /// uint8_t seconds for util::RedisQueue or std::chrono::seconds for
+    /// rds::Subscriber
+    template <typename Duration>
+    struct BatchOptions
+    {
+        /// @brief Maximum number of items per call of the handler
+        size_t max_batch = 32;
+        /// @brief Time a batch waits for further items once its first item
+        /// was leased, a full batch is dispatched right away
+        std::chrono::microseconds max_delay = std::chrono::milliseconds(5);
+        /// @brief Stop once a blocking lease times out with no item
+        bool exit_when_idle = false;
+        /// @brief Time between two lease extensions while a batch is being
+        /// processed, zero lets leases expire after the lease duration
+        std::chrono::milliseconds heartbeat{0};
+        /// @brief How the batcher polls for further items of a batch, the
+        /// wait never exceeds the time left until max_delay
+        WaitOptions wait;
+        Duration lease_duration;
+        Duration lease_timeout;
+    };
+
+    /// @brief Dynamic batching stage for handlers that process many items
+    /// at once, e.g., one kernel launch per batch. Items are leased until
+    /// the batch holds max_batch items or max_delay passed since its first
+    /// item, then the handler receives the whole batch. Successful items are
+    /// completed together, items the handler marks as failed are given back
+    /// to the queue, so that one bad item does not requeue the others.
+    /// @tparam Queue Queue client providing lease_batch, complete_batch,
+    /// release_batch and start_heartbeat
+    template <typename Queue, typename Duration>
+    class Batcher
+    {
+        public:
+        typedef typename decltype(
+            std::declval<Queue&>().lease_batch(1))::value_type Item;
+        typedef std::function<void(Batcher&, Span<Item const>, BatchOutcome&)> BatchHandler;
+
+        private:
+        std::unique_ptr<Queue> _queue;
+        BatchOptions<Duration> _opts;
+        std::atomic<bool> _stopping{false};
+
+        /// @brief Leases the next batch, returns false if a blocking lease
+        /// timed out before the first item arrived
+        bool _fill(std::vector<Item> &batch, WaitStrategy &wait)
+        {
+            batch = _queue -> lease_batch(
+                _opts.max_batch, _opts.lease_duration, _opts.lease_timeout, true);
+            if (batch.empty()) return false;
+            auto deadline = std::chrono::steady_clock::now() + _opts.max_delay;
+            while (batch.size() < _opts.max_batch && !_stopping.load(std::memory_order_acquire))
+            {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= deadline) break;
+                // Lease timeouts are whole seconds, so the rest of the batch
+                // is polled until the deadline
+                std::vector<Item> more = _queue -> lease_batch(
+                    _opts.max_batch - batch.size(), _opts.lease_duration, _opts.lease_timeout,
+                    false);
+                if (more.empty())
+                {
+                    wait.idle(std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+                    continue;
+                }
+                wait.busy();
+                batch.insert(
+                    batch.end(), std::make_move_iterator(more.begin()),
+                    std::make_move_iterator(more.end()));
+            }
+            return true;
+        }
+
+        /// @brief Completes the successful items with one call and gives
+        /// the failed items back with another
+        void _settle(std::vector<Item> &batch, BatchOutcome const &outcome)
+        {
+            if (outcome.failures() == 0)
+            {
+                _queue -> complete_batch(batch);
+                return;
+            }
+            std::vector<Item> done;
+            std::vector<Item> failed;
+            done.reserve(batch.size() - outcome.failures());
+            failed.reserve(outcome.failures());
+            for (size_t idx = 0; idx < batch.size(); idx += 1)
+                (outcome.failed(idx) ? failed : done).push_back(std::move(batch[idx]));
+            _queue -> complete_batch(done);
+            _queue -> release_batch(failed);
+        }
+
+        public:
+        Batcher() = delete;
+        Batcher(Batcher const&) = delete;
+        Batcher operator=(Batcher const&) = delete;
+
+        Batcher(std::unique_ptr<Queue> queue, BatchOptions<Duration> const &opts)
+        :_queue(std::move(queue)), _opts(opts)
+        {
+            _opts.max_batch = std::max<size_t>(_opts.max_batch, 1);
+            if (_opts.heartbeat.count() > 0)
+                _queue -> start_heartbeat(_opts.lease_duration, _opts.heartbeat);
+        }
+
+        /// @brief Leases and dispatches batches until stop() is called, or
+        /// the queue is idle when exit_when_idle is set. If the handler
+        /// throws, every item of its batch is given back to the queue and
+        /// the exception is passed on. Returns at once if stop() was called
+        /// before, reset() allows another run.
+        void run(BatchHandler handler)
+        {
+            WaitStrategy wait(_opts.wait);
+            std::vector<Item> batch;
+            batch.reserve(_opts.max_batch);
+            while (!_stopping.load(std::memory_order_acquire))
+            {
+                if (!_fill(batch, wait))
+                {
+                    if (_opts.exit_when_idle) break;
+                    continue;
+                }
+                BatchOutcome outcome(batch.size());
+                try
+                {
+                    handler(*this, Span<Item const>(batch.data(), batch.size()), outcome);
+                }
+                catch(...)
+                {
+                    _queue -> release_batch(batch);
+                    throw;
+                }
+                _settle(batch, outcome);
+            }
+        }
+
+        /// @brief Stops after the current batch, safe to call from any
+        /// thread and from the handler
+        void stop() { _stopping.store(true, std::memory_order_release); }
+
+        /// @brief Clears an earlier stop() so that run() can be called again
+        void reset() { _stopping.store(false, std::memory_order_release); }
+
+        /// @brief Queue client of the batcher, e.g., for depth()
+        Queue &queue() { return *_queue; }
+    };
+} // namespace rq
+
+#endif // BATCHER_H
@@ -0,0 +1,47 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+/// Value parsers for the named command line options of the daemons, which
+/// read their options with getopt_long. Invalid values are reported with
+/// the name of their option instead of the bare message of std::stoul.
+namespace rq
+{
+    namespace cli
+    {
+        /// @brief Parses the non negative integer value of an option
+        /// @param option Long name of the option, used in the error message
+        inline unsigned long long number(const char *option, const char *value)
+        {
+            char *end = nullptr;
+            errno = 0;
+            unsigned long long parsed = strtoull(value, &end, 10);
+            if (errno != 0 || end == value || *end != '\0' || value[0] == '-')
+            {
+                printf("Invalid value for --%s: %s\n", option, value);
+                throw std::runtime_error("Invalid command line option, exiting...");
+            }
+            return parsed;
+        }
+
+        /// @brief Parses a TCP port, which must be in 1..65535
+        inline uint16_t port(const char *value)
+        {
+            unsigned long long parsed = number("port", value);
+            if (parsed == 0 || parsed > UINT16_MAX)
+            {
+                printf("Invalid value for --port: %s\n", value);
+                throw std::runtime_error("Invalid command line option, exiting...");
+            }
+            return (uint16_t) parsed;
+        }
+    } // namespace cli
+} // namespace rq
+
+#endif // CLI_H
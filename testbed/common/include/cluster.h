@@ -0,0 +1,69 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace rq
+{
+    /// Queues on a Redis Cluster are selected with a URI such as
+    /// redis-cluster://host:port/foo, where host:port is a seed node. The
+    /// hiredis pool looks the node of the queue slot up with CLUSTER SLOTS
+    /// whenever it opens a connection, so connections dropped by a failover
+    /// follow the slot. ?reads=replica serves depth, lease checks and rq-stat
+    /// from a READONLY replica whose counts may lag slightly. Keyspace
+    /// notifications are not supported, and moving the slot of a queue to
+    /// another node needs a restart of its clients. A local cluster for
+    /// testing:
+    ///     redis-server --port <p> --cluster-enabled yes    (7000 to 7005)
+    ///     redis-cli --cluster create 127.0.0.1:7000 ... 127.0.0.1:7005 
+    ///         --cluster-replicas 1
+
+    /// @brief Number of hash slots of a redis cluster
+    constexpr uint16_t CLUSTER_SLOTS = 16384;
+
+    /// @brief CRC16 of redis cluster (XMODEM, polynomial 0x1021)
+    inline uint16_t crc16(std::string_view data)
+    {
+        uint16_t crc = 0;
+        for (unsigned char c: data)
+        {
+            crc ^= (uint16_t) (c << 8);
+            for (int bit = 0; bit < 8; bit += 1)
+                crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+        }
+        return crc;
+    }
+
+    /// @brief Part of a key that is hashed to its slot, the content of the
+    /// first non-empty {...} section or else the whole key
+    inline std::string_view hashed_part(std::string_view key)
+    {
+        size_t open = key.find('{');
+        if (open == std::string_view::npos) return key;
+        size_t close = key.find('}', open + 1);
+        if (close == std::string_view::npos || close == open + 1) return key;
+        return key.substr(open + 1, close - open - 1);
+    }
+
+    /// @brief Hash slot of a key in a redis cluster
+    inline uint16_t key_slot(std::string_view key)
+    {
+        return crc16(hashed_part(key)) % CLUSTER_SLOTS;
+    }
+
+    /// @brief Queue name whose derived keys share one hash slot. The keys of
+    /// a queue are all built by appending to its name, so wrapping the name
+    /// in a hash tag e.g., {foo} gives {foo}:processing, the lease keys and
+    /// the priority levels the slot of {foo}, and the multi key scripts can
+    /// run on the cluster node owning it. Names with a tag are kept.
+    inline std::string hash_tag(std::string const &queue)
+    {
+        if (hashed_part(queue).size() != queue.size()) return queue;
+        return "{" + queue + "}";
+    }
+} // namespace rq
+
+#endif // CLUSTER_H
@@ -0,0 +1,148 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <chrono>
+#include <exception>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+namespace rq
+{
+    /// @brief Background thread extending the leases held by a process.
+    /// Every tick hands all tracked lease keys to a single extend call,
+    /// which the queue clients implement as one round trip. Leases that
+    /// could not be extended are dropped and reported as lost. Leases are
+    /// also indexed by item, since complete() only receives the item.
+    class Heartbeat
+    {
+        public:
+        /// @brief Extends the given lease keys, returns for every key whether
+        /// the lease is still held by this process
+        typedef std::function<std::vector<bool>(std::vector<std::string> const&)> Extend;
+        /// @brief Called from the heartbeat thread with the item and lease
+        /// key of a lost lease
+        typedef std::function<void(std::string const&, std::string const&)> LostHandler;
+
+        private:
+        Extend _extend;
+        LostHandler _on_lost;
+        std::chrono::milliseconds _interval;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        /// @brief Items by lease key and lease keys by item
+        std::unordered_map<std::string, std::string> _held;
+        std::unordered_map<std::string, std::string> _keys;
+        bool _stopping = false;
+        std::thread _thread;
+
+        void _run()
+        {
+            std::vector<std::string> keys;
+            std::vector<std::pair<std::string, std::string>> lost;
+            std::unique_lock<std::mutex> lock(_mtx);
+            while (!_cv.wait_for(lock, _interval, [this]() { return _stopping; }))
+            {
+                if (_held.empty()) continue;
+                keys.clear();
+                for (auto const &held: _held) keys.push_back(held.first);
+                lock.unlock();
+                std::vector<bool> held;
+                try
+                {
+                    held = _extend(keys);
+                }
+                catch(std::exception const&)
+                {
+                    // Leases are only reported lost once the server says so,
+                    // the next tick retries after a connection error
+                    held.assign(keys.size(), true);
+                }
+                lost.clear();
+                lock.lock();
+                // Leases released while the tick was in flight were completed
+                // rather than lost
+                for (size_t idx = 0; idx < keys.size() && idx < held.size(); idx += 1)
+                {
+                    if (held[idx]) continue;
+                    auto found = _held.find(keys[idx]);
+                    if (found == _held.end()) continue;
+                    lost.emplace_back(std::move(found -> second), keys[idx]);
+                    _keys.erase(lost.back().first);
+                    _held.erase(found);
+                }
+                lock.unlock();
+                if (_on_lost)
+                    for (auto const &lease: lost) _on_lost(lease.first, lease.second);
+                lock.lock();
+            }
+        }
+
+        public:
+        Heartbeat() = delete;
+        Heartbeat(Heartbeat const&) = delete;
+        Heartbeat operator=(Heartbeat const&) = delete;
+
+        /// @param extend Extends a batch of lease keys
+        /// @param interval Time between two ticks, should be well below the
+        /// lease duration
+        /// @param on_lost Optional handler for lost leases
+        Heartbeat(Extend extend, std::chrono::milliseconds interval, LostHandler on_lost = {})
+        :_extend(std::move(extend)), _on_lost(std::move(on_lost)), _interval(interval)
+        {
+            _thread = std::thread([this]() { _run(); });
+        }
+
+        ~Heartbeat()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                _stopping = true;
+            }
+            _cv.notify_all();
+            if (_thread.joinable()) _thread.join();
+        }
+
+        /// @brief Starts extending the lease of an item
+        void track(std::string const &item, std::string const &lease_key)
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _held[lease_key] = item;
+            _keys[item] = lease_key;
+        }
+
+        /// @brief Stops extending a lease, e.g., once its item is completed
+        void release(std::string const &lease_key)
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto found = _held.find(lease_key);
+            if (found == _held.end()) return;
+            _keys.erase(found -> second);
+            _held.erase(found);
+        }
+
+        /// @brief Stops extending the lease of an item
+        void release_item(std::string const &item)
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto found = _keys.find(item);
+            if (found == _keys.end()) return;
+            _held.erase(found -> second);
+            _keys.erase(found);
+        }
+
+        /// @brief Whether a lease is tracked and has not been lost
+        bool held(std::string const &lease_key)
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            return _held.count(lease_key) > 0;
+        }
+    };
+} // namespace rq
+
+#endif // HEARTBEAT_H
@@ -0,0 +1,94 @@
+#ifndef ITEM_ID_H
+#define ITEM_ID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+// Header only build of xxHash, XXH3 selects SSE2, AVX2, AVX512 or NEON code
+// from the target flags e.g., -march=native
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+namespace rq
+{
+    /// Item identity shared by all clients and the scripts. Producers may
+    /// wrap an item in a versioned envelope
+    ///     rq1:<id>:<payload>
+    /// where id is the XXH3 128 bit hash of the payload as 32 lower case hex
+    /// digits in canonical (big endian) order, the same digits as
+    /// xxhash.xxh3_128_hexdigest in Python. The scripts take the lease key
+    /// and the dedupe entry of an enveloped item from its header instead of
+    /// hashing the payload on the server. Items without an envelope keep
+    /// the SHA1 digest of the whole item as their id, so both kinds can be
+    /// mixed on one queue. Envelopes are opt in, e.g., pub_daemon --dedupe
+    /// or RQUEUE_ENVELOPE=1 for the Python producer.
+
+    /// @brief Version tag opening an envelope
+    constexpr std::string_view ENVELOPE_TAG = "rq1:";
+
+    /// @brief Number of hex digits of an item id
+    constexpr size_t ITEM_ID_SIZE = 32;
+
+    /// @brief Length of the envelope header up to the payload
+    constexpr size_t ENVELOPE_HEADER_SIZE = ENVELOPE_TAG.size() + ITEM_ID_SIZE + 1;
+
+    /// @brief Writes the 32 hex digit id of a payload to out
+    inline void item_id(std::string_view payload, char *out)
+    {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        XXH128_hash_t hash = XXH3_128bits(payload.data(), payload.size());
+        for (int idx = 0; idx < 16; idx += 1)
+        {
+            out[idx] = DIGITS[(hash.high64 >> (60 - 4 * idx)) & 0xf];
+            out[16 + idx] = DIGITS[(hash.low64 >> (60 - 4 * idx)) & 0xf];
+        }
+    }
+
+    /// @brief Id of a payload as 32 hex digits
+    inline std::string item_id(std::string_view payload)
+    {
+        std::string id(ITEM_ID_SIZE, '0');
+        item_id(payload, id.data());
+        return id;
+    }
+
+    /// @brief Wraps a payload in an envelope, hashing it once on the client
+    inline std::string envelope(std::string_view payload)
+    {
+        std::string item;
+        item.resize(ENVELOPE_HEADER_SIZE + payload.size());
+        item.replace(0, ENVELOPE_TAG.size(), ENVELOPE_TAG);
+        item_id(payload, item.data() + ENVELOPE_TAG.size());
+        item[ENVELOPE_HEADER_SIZE - 1] = ':';
+        item.replace(ENVELOPE_HEADER_SIZE, payload.size(), payload);
+        return item;
+    }
+
+    /// @brief Whether an item is wrapped in an envelope
+    inline bool is_envelope(std::string_view item)
+    {
+        return item.size() >= ENVELOPE_HEADER_SIZE
+            && item.substr(0, ENVELOPE_TAG.size()) == ENVELOPE_TAG
+            && item[ENVELOPE_HEADER_SIZE - 1] == ':';
+    }
+
+    /// @brief Id carried by the envelope of an item, empty for items
+    /// without an envelope
+    inline std::string_view envelope_id(std::string_view item)
+    {
+        if (!is_envelope(item)) return std::string_view();
+        return item.substr(ENVELOPE_TAG.size(), ITEM_ID_SIZE);
+    }
+
+    /// @brief Payload of an item, the item itself if it has no envelope.
+    /// Leased items keep their envelope, since completing them needs the
+    /// item as stored.
+    inline std::string_view payload_of(std::string_view item)
+    {
+        if (!is_envelope(item)) return item;
+        return item.substr(ENVELOPE_HEADER_SIZE);
+    }
+} // namespace rq
+
+#endif // ITEM_ID_H
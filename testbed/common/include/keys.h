@@ -0,0 +1,66 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <string>
+#include "scripts.h"
+
+namespace rq
+{
+    /// @brief Consumer group reading the stream of the stream layout
+    constexpr const char *STREAM_GROUP = "workers";
+
+    /// @brief Field holding the item in the entries of the stream layout
+    constexpr const char *STREAM_FIELD = "item";
+
+    /// @brief Processing key suffix of a layout
+    inline const char *processing_suffix(Layout layout)
+    {
+        switch (layout)
+        {
+            case Layout::ZSET: return ":inflight";
+            case Layout::STREAM: return ":stream";
+            default: return ":processing";
+        }
+    }
+
+    /// @brief Parses a layout name given on the command line, "zset" or
+    /// "stream", anything else selects the list layout
+    inline Layout layout_from(std::string const &name)
+    {
+        if (name == "zset") return Layout::ZSET;
+        if (name == "stream") return Layout::STREAM;
+        return Layout::LIST;
+    }
+
+    /// @brief Names of the redis keys backing one logical queue
+    struct QueueKeys
+    {
+        /// @brief Main queue, producers push here
+        std::string main;
+        /// @brief Processing list, in flight sorted set or stream, depending
+        /// on the layout
+        std::string processing;
+        /// @brief Hash of items in processing, only used by the sorted set
+        /// layout
+        std::string payloads;
+        /// @brief Prefix of the per item lease keys
+        std::string lease_prefix;
+        /// @brief Number of items completed so far, not used by the stream
+        /// layout
+        std::string completed;
+        /// @brief Ids of recently published items, only used by producers
+        /// dropping duplicates
+        std::string dedupe;
+
+        QueueKeys(std::string const &queue, Layout layout = Layout::LIST)
+        :main(queue),
+        processing(queue + processing_suffix(layout)),
+        payloads(queue + ":payloads"),
+        lease_prefix(queue + ":leased_by_session:"),
+        completed(queue + ":completed"),
+        dedupe(queue + ":dedupe")
+        {}
+    };
+} // namespace rq
+
+#endif // KEYS_H
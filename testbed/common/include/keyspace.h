@@ -0,0 +1,44 @@
+#ifndef KEYSPACE_H
+#define KEYSPACE_H
+
+#include <string>
+#include <string_view>
+
+/// Helpers for the keyspace notification subscribers of both queue clients,
+/// which wake idle workers as soon as the main queue receives an item.
+namespace rq
+{
+    namespace keyspace
+    {
+        /// @brief Channel of the keyspace notifications for a key
+        inline std::string channel(std::string const &key, int db = 0)
+        {
+            return "__keyspace@" + std::to_string(db) + "__:" + key;
+        }
+
+        /// @brief Whether a list or stream event added items to the queue.
+        /// lpush is left out, blocked consumers rotate the head of the queue
+        /// onto itself with BLMOVE LEFT LEFT, which emits lpop and lpush
+        /// without adding anything. Producers that LPUSH are only picked up
+        /// by the idle backoff.
+        inline bool is_push(std::string_view event)
+        {
+            return event == "rpush" || event == "linsert" || event == "xadd";
+        }
+
+        /// @brief Adds the keyspace (K), list (l) and stream (t) event
+        /// classes to the notify-keyspace-events flags of a server, keeping
+        /// all others
+        inline std::string with_queue_events(std::string flags)
+        {
+            if (flags.find('K') == std::string::npos) flags.push_back('K');
+            // A is an alias for all event classes, including lists and streams
+            if (flags.find('A') != std::string::npos) return flags;
+            for (char event: {'l', 't'})
+                if (flags.find(event) == std::string::npos) flags.push_back(event);
+            return flags;
+        }
+    } // namespace keyspace
+} // namespace rq
+
+#endif // KEYSPACE_H
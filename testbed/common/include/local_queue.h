@@ -0,0 +1,350 @@
+#ifndef LOCAL_QUEUE_H
+#define LOCAL_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "mpmc_ring.h"
+#include "scripts.h"
+#include "timer_wheel.h"
+#include "wait_strategy.h"
+
+namespace rq
+{
+    /// @brief Item leased from a local queue together with its lease key
+    struct LeasedItem
+    {
+        std::string item;
+        std::string lease_key;
+    };
+
+    /// @brief In process queue shared by the handles of one name. Waiting
+    /// items are handed off through a bounded lock free ring, leased items
+    /// are kept with their deadline until completed. Deadlines are tracked
+    /// in a timer wheel, which consumers advance while leasing, so expired
+    /// items return to the ring without a reaper thread.
+    class LocalBroker
+    {
+        public:
+        typedef TimerWheel::Clock Clock;
+
+        private:
+        struct Held
+        {
+            std::string item;
+            Clock::time_point deadline;
+        };
+
+        static constexpr std::chrono::milliseconds RESOLUTION = std::chrono::milliseconds(10);
+
+        MpmcRing<std::string> _ready;
+        std::mutex _mtx;
+        std::unordered_map<uint64_t, Held> _held;
+        TimerWheel _deadlines;
+        uint64_t _next_id = 1;
+        /// @brief Number of held leases, read without the lock to skip
+        /// reaping while nothing is leased
+        std::atomic<size_t> _processing{0};
+        /// @brief Consumers blocked in a lease, publishers only signal the
+        /// wake up while there are any
+        std::atomic<size_t> _waiters{0};
+        Wakeup _wakeup;
+
+        void _signal()
+        {
+            // Pairs with the fence of blocked consumers, either they see the
+            // item or we see them waiting
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_waiters.load(std::memory_order_relaxed) > 0) _wakeup.notify();
+        }
+
+        /// @brief Returns the items of expired leases to the ring
+        void _reap(Clock::time_point now)
+        {
+            size_t requeued = 0;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                _deadlines.advance(now, [&](uint64_t id)
+                {
+                    auto found = _held.find(id);
+                    // Completed since the timer was scheduled
+                    if (found == _held.end()) return;
+                    Held &held = found -> second;
+                    if (held.deadline > now)
+                    {
+                        // Extended since the timer was scheduled
+                        _deadlines.schedule(id, held.deadline);
+                        return;
+                    }
+                    if (!_ready.try_push(std::move(held.item)))
+                    {
+                        // The ring is full, the item stays leased a bit longer
+                        _deadlines.schedule(id, now + RESOLUTION);
+                        return;
+                    }
+                    _held.erase(found);
+                    requeued += 1;
+                });
+            }
+            if (requeued == 0) return;
+            _processing.fetch_sub(requeued, std::memory_order_acq_rel);
+            _signal();
+        }
+
+        public:
+        LocalBroker() = delete;
+        LocalBroker(LocalBroker const&) = delete;
+        LocalBroker operator=(LocalBroker const&) = delete;
+
+        /// @param capacity Maximum number of waiting items, rounded up to
+        /// the next power of two
+        explicit LocalBroker(size_t capacity)
+        :_ready(capacity), _deadlines(RESOLUTION)
+        {
+        }
+
+        /// @brief Adds an item, returns false if the queue is full
+        bool publish(std::string item)
+        {
+            if (!_ready.try_push(std::move(item))) return false;
+            _signal();
+            return true;
+        }
+
+        /// @brief Leases up to n waiting items without blocking
+        std::vector<LeasedItem> lease(size_t n, std::chrono::milliseconds duration)
+        {
+            Clock::time_point now = Clock::now();
+            if (_processing.load(std::memory_order_acquire) > 0) _reap(now);
+            std::vector<LeasedItem> leased;
+            std::string item;
+            while (leased.size() < n && _ready.try_pop(item))
+            {
+                leased.emplace_back();
+                leased.back().item = std::move(item);
+            }
+            if (leased.empty()) return leased;
+            Clock::time_point deadline = now + duration;
+            char key[24];
+            std::lock_guard<std::mutex> lock(_mtx);
+            for (LeasedItem &lease: leased)
+            {
+                uint64_t id = _next_id++;
+                std::to_chars_result res = std::to_chars(key, key + sizeof(key), id);
+                lease.lease_key.assign(key, res.ptr - key);
+                _held.emplace(id, Held{lease.item, deadline});
+                _deadlines.schedule(id, deadline);
+            }
+            _processing.fetch_add(leased.size(), std::memory_order_acq_rel);
+            return leased;
+        }
+
+        /// @brief Leases up to n items, waiting until at least one item is
+        /// available or the timeout expires, a zero timeout waits forever
+        std::vector<LeasedItem> lease(
+            size_t n, std::chrono::milliseconds duration, std::chrono::milliseconds timeout)
+        {
+            Clock::time_point until = Clock::now() + timeout;
+            _waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::vector<LeasedItem> leased;
+            while (true)
+            {
+                uint64_t seen = _wakeup.generation();
+                leased = lease(n, duration);
+                if (!leased.empty()) break;
+                Clock::time_point now = Clock::now();
+                if (timeout.count() > 0 && now >= until) break;
+                // Expired leases are only noticed while leasing, so wake up
+                // once per tick while any are held
+                std::chrono::nanoseconds wait = (timeout.count() > 0)
+                    ? until - now : std::chrono::nanoseconds(std::chrono::hours(1));
+                if (_processing.load(std::memory_order_acquire) > 0)
+                    wait = std::min<std::chrono::nanoseconds>(wait, RESOLUTION);
+                _wakeup.wait(seen, wait);
+            }
+            _waiters.fetch_sub(1, std::memory_order_acq_rel);
+            return leased;
+        }
+
+        /// @brief Completes a lease, returns false if it was not held e.g.,
+        /// because it expired and the item was leased again
+        bool complete(std::string_view lease_key)
+        {
+            uint64_t id = 0;
+            std::from_chars_result res = std::from_chars(
+                lease_key.data(), lease_key.data() + lease_key.size(), id);
+            if (res.ec != std::errc()) return false;
+            size_t erased = 0;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                erased = _held.erase(id);
+            }
+            if (erased > 0) _processing.fetch_sub(erased, std::memory_order_acq_rel);
+            return erased > 0;
+        }
+
+        /// @brief Completes a set of leases under a single lock
+        template <typename Input>
+        void complete(Input first, Input last)
+        {
+            size_t erased = 0;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                for (; first != last; ++first)
+                {
+                    std::string const &key = first -> lease_key;
+                    uint64_t id = 0;
+                    std::from_chars_result res = std::from_chars(
+                        key.data(), key.data() + key.size(), id);
+                    if (res.ec == std::errc()) erased += _held.erase(id);
+                }
+            }
+            if (erased > 0) _processing.fetch_sub(erased, std::memory_order_acq_rel);
+        }
+
+        /// @brief Moves the deadline of a held lease, returns false if the
+        /// lease is not held anymore
+        bool extend(std::string_view lease_key, std::chrono::milliseconds duration)
+        {
+            uint64_t id = 0;
+            std::from_chars_result res = std::from_chars(
+                lease_key.data(), lease_key.data() + lease_key.size(), id);
+            if (res.ec != std::errc()) return false;
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto found = _held.find(id);
+            if (found == _held.end()) return false;
+            // The pending timer reschedules itself once it fires
+            found -> second.deadline = Clock::now() + duration;
+            return true;
+        }
+
+        /// @brief Items waiting and in processing, approximate while other
+        /// threads publish or lease
+        QueueDepth depth() const
+        {
+            QueueDepth depth;
+            depth.pending = _ready.size();
+            depth.processing = _processing.load(std::memory_order_acquire);
+            return depth;
+        }
+
+        /// @brief Shared broker of a queue name, created on first use and
+        /// released with the last handle
+        static std::shared_ptr<LocalBroker> open(std::string const &name, size_t capacity)
+        {
+            static std::mutex mtx;
+            static std::unordered_map<std::string, std::weak_ptr<LocalBroker>> brokers;
+            std::lock_guard<std::mutex> lock(mtx);
+            std::weak_ptr<LocalBroker> &entry = brokers[name];
+            std::shared_ptr<LocalBroker> broker = entry.lock();
+            if (!broker)
+            {
+                broker = std::make_shared<LocalBroker>(capacity);
+                entry = broker;
+            }
+            return broker;
+        }
+    };
+
+    /// @brief Queue handle with the lease and complete API of the redis
+    /// clients, for producers and consumers running in the same process.
+    /// Handles of the same name share one queue, like clients of the same
+    /// redis key. A handle is used by one thread at a time, e.g., one per
+    /// fetcher of a worker pool.
+    class LocalQueue
+    {
+        std::shared_ptr<LocalBroker> _broker;
+        /// @brief Lease keys of the items leased with lease(), since
+        /// complete() only receives the item, one entry per lease of equal
+        /// items
+        std::unordered_multimap<std::string, std::string> _keys;
+
+        public:
+        LocalQueue() = delete;
+        LocalQueue(LocalQueue const&) = delete;
+        LocalQueue operator=(LocalQueue const&) = delete;
+        LocalQueue(LocalQueue &&) = default;
+        LocalQueue& operator=(LocalQueue &&) = default;
+
+        /// @param name Name of the queue shared by handles of this process
+        /// @param capacity Maximum number of waiting items, only used by the
+        /// first handle of a name
+        explicit LocalQueue(std::string const &name, size_t capacity = 65536)
+        :_broker(LocalBroker::open(name, capacity))
+        {
+        }
+
+        /// @brief Adds an item, returns false if the queue is full
+        inline bool publish(std::string item) { return _broker -> publish(std::move(item)); }
+
+        /// @brief Adds items until the queue is full, returns the number of
+        /// items added
+        template <typename Input>
+        size_t publish_batch(Input first, Input last)
+        {
+            size_t published = 0;
+            for (; first != last && _broker -> publish(*first); ++first) published += 1;
+            return published;
+        }
+
+        inline QueueDepth depth() const { return _broker -> depth(); }
+        inline bool empty() const { return depth().empty(); }
+
+        std::optional<std::string> lease(
+            std::chrono::milliseconds duration = std::chrono::seconds(5),
+            std::chrono::milliseconds timeout = std::chrono::seconds(2),
+            bool blocking = true)
+        {
+            std::vector<LeasedItem> leased = lease_batch(1, duration, timeout, blocking);
+            if (leased.empty()) return std::nullopt;
+            _keys.emplace(leased[0].item, std::move(leased[0].lease_key));
+            return std::move(leased[0].item);
+        }
+
+        /// @brief Leases up to n items, blocking until at least one item is
+        /// available or the timeout expires
+        std::vector<LeasedItem> lease_batch(
+            size_t n,
+            std::chrono::milliseconds duration = std::chrono::seconds(5),
+            std::chrono::milliseconds timeout = std::chrono::seconds(2),
+            bool blocking = true)
+        {
+            if (n == 0) return {};
+            if (!blocking) return _broker -> lease(n, duration);
+            return _broker -> lease(n, duration, timeout);
+        }
+
+        /// @brief Completes an item leased with lease() by this handle
+        void complete(std::string const &item)
+        {
+            auto found = _keys.find(item);
+            if (found == _keys.end()) return;
+            _broker -> complete(found -> second);
+            _keys.erase(found);
+        }
+
+        void complete_batch(std::vector<LeasedItem> const &items)
+        {
+            _broker -> complete(items.begin(), items.end());
+        }
+
+        /// @brief Extends a held lease, returns false if it expired
+        inline bool extend(std::string const &lease_key, std::chrono::milliseconds duration)
+        {
+            return _broker -> extend(lease_key, duration);
+        }
+    };
+} // namespace rq
+
+#endif // LOCAL_QUEUE_H
@@ -0,0 +1,125 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace rq
+{
+    /// @brief Bounded lock free multi producer multi consumer ring buffer.
+    /// Every cell carries a sequence number that tells producers and
+    /// consumers whether the cell is free for the current lap, so that a
+    /// push or pop only needs a single compare and swap on its cursor.
+    template <typename T>
+    class MpmcRing
+    {
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        static constexpr size_t CACHE_LINE = 64;
+
+        std::unique_ptr<Cell[]> _cells;
+        size_t _mask;
+        alignas(CACHE_LINE) std::atomic<size_t> _enqueue_pos{0};
+        alignas(CACHE_LINE) std::atomic<size_t> _dequeue_pos{0};
+
+        template <typename U>
+        bool _push(U &&value)
+        {
+            size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = _cells[pos & _mask];
+                size_t seq = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+                if (diff == 0)
+                {
+                    if (_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        cell.data = std::forward<U>(value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0)
+                {
+                    // Cell still holds an item from the previous lap
+                    return false;
+                } else
+                {
+                    pos = _enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        public:
+        MpmcRing() = delete;
+        MpmcRing(MpmcRing const&) = delete;
+        MpmcRing operator=(MpmcRing const&) = delete;
+
+        /// @brief Creates a ring with at least the requested capacity,
+        /// rounded up to the next power of two
+        explicit MpmcRing(size_t capacity)
+        {
+            size_t size = 2;
+            while (size < capacity) size <<= 1;
+            _cells.reset(new Cell[size]);
+            _mask = size - 1;
+            for (size_t idx = 0; idx < size; idx += 1)
+                _cells[idx].sequence.store(idx, std::memory_order_relaxed);
+        }
+
+        inline size_t capacity() const { return _mask + 1; }
+
+        /// @brief Approximate number of items, exact when no other thread
+        /// is pushing or popping
+        inline size_t size() const
+        {
+            size_t head = _enqueue_pos.load(std::memory_order_acquire);
+            size_t tail = _dequeue_pos.load(std::memory_order_acquire);
+            return head > tail ? head - tail : 0;
+        }
+
+        inline bool empty() const { return size() == 0; }
+
+        /// @brief Pushes an item, returns false if the ring is full
+        bool try_push(T const &value) { return _push(value); }
+        bool try_push(T &&value) { return _push(std::move(value)); }
+
+        /// @brief Pops an item, returns false if the ring is empty
+        bool try_pop(T &value)
+        {
+            size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = _cells[pos & _mask];
+                size_t seq = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+                if (diff == 0)
+                {
+                    if (_dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        value = std::move(cell.data);
+                        cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0)
+                {
+                    return false;
+                } else
+                {
+                    pos = _dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+} // namespace rq
+
+#endif // MPMC_RING_H
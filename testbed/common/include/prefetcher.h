@@ -0,0 +1,232 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rq
+{
+    /// @brief Options for the prefetcher
+    /// @tparam Duration Lease duration type of the queue client, e.g.,
+    /// uint8_t seconds for util::RedisQueue or std::chrono::seconds for
+    /// rds::Subscriber
+    template <typename Duration>
+    struct PrefetchOptions
+    {
+        /// @brief Items kept leased ahead of the worker
+        size_t depth = 4;
+        /// @brief Maximum number of items per complete_batch call
+        size_t ack_batch = 64;
+        /// @brief Time between two lease extensions of the buffered and
+        /// running items, e.g., a third of the lease duration, zero lets
+        /// waiting items expire after the lease duration
+        std::chrono::milliseconds heartbeat{0};
+        Duration lease_duration;
+        Duration lease_timeout;
+    };
+
+    /// @brief Double buffering for a single worker. A background thread
+    /// does all queue I/O: it keeps up to depth items leased ahead in a
+    /// local buffer while the worker processes the current one, and
+    /// acknowledges completed items in batches. Items which were never
+    /// started are given back to the queue when the prefetcher stops.
+    /// @tparam Queue Queue client providing lease_batch, complete_batch,
+    /// release_batch and start_heartbeat, only used from the background
+    /// thread once the prefetcher runs
+    template <typename Queue, typename Duration>
+    class Prefetcher
+    {
+        public:
+        typedef typename decltype(
+            std::declval<Queue&>().lease_batch(1))::value_type Item;
+
+        private:
+        std::unique_ptr<Queue> _queue;
+        PrefetchOptions<Duration> _opts;
+        /// @brief Guards the buffers below, the background thread never
+        /// holds it during a round trip
+        std::mutex _mtx;
+        /// @brief Signals the worker, new items, an empty lease or a failure
+        std::condition_variable _ready_cv;
+        /// @brief Signals the background thread, room in the buffer,
+        /// completions or a stop
+        std::condition_variable _io_cv;
+        std::deque<Item> _ready;
+        std::vector<Item> _done;
+        /// @brief Blocking leases which expired with nothing buffered
+        size_t _empty_leases = 0;
+        bool _stopping = false;
+        bool _stopped = false;
+        std::exception_ptr _error;
+        std::thread _thread;
+
+        void _run()
+        {
+            std::vector<Item> batch;
+            std::unique_lock<std::mutex> lock(_mtx);
+            try
+            {
+                while (true)
+                {
+                    // Completions go out first, so that finished items do
+                    // not hold their leases longer than needed
+                    if (!_done.empty())
+                    {
+                        size_t count = std::min(_done.size(), _opts.ack_batch);
+                        batch.assign(
+                            std::make_move_iterator(_done.begin()),
+                            std::make_move_iterator(_done.begin() + count));
+                        _done.erase(_done.begin(), _done.begin() + count);
+                        lock.unlock();
+                        _queue -> complete_batch(batch);
+                        lock.lock();
+                        continue;
+                    }
+                    if (_stopping) break;
+                    if (_ready.size() >= _opts.depth)
+                    {
+                        _io_cv.wait(lock);
+                        continue;
+                    }
+                    // Only block on the main queue while the worker waits
+                    // for an item, a completion arriving meanwhile is
+                    // acknowledged after the lease returns
+                    size_t room = _opts.depth - _ready.size();
+                    bool blocking = _ready.empty();
+                    lock.unlock();
+                    std::vector<Item> leased = _queue -> lease_batch(
+                        room, _opts.lease_duration, _opts.lease_timeout, blocking);
+                    lock.lock();
+                    if (leased.empty())
+                    {
+                        if (blocking)
+                        {
+                            _empty_leases += 1;
+                            _ready_cv.notify_all();
+                        }
+                        // Non blocking leases only find nothing when the
+                        // buffer holds items, wait for the worker to take one
+                        else _io_cv.wait(lock);
+                        continue;
+                    }
+                    for (Item &item: leased) _ready.push_back(std::move(item));
+                    _ready_cv.notify_all();
+                }
+            }
+            catch(...)
+            {
+                _error = std::current_exception();
+                _ready_cv.notify_all();
+            }
+            // Unstarted items are given back instead of waiting for their
+            // leases to expire
+            batch.assign(
+                std::make_move_iterator(_ready.begin()), std::make_move_iterator(_ready.end()));
+            _ready.clear();
+            lock.unlock();
+            if (!_error && !batch.empty()) _queue -> release_batch(batch);
+        }
+
+        public:
+        Prefetcher() = delete;
+        Prefetcher(Prefetcher const&) = delete;
+        Prefetcher operator=(Prefetcher const&) = delete;
+
+        Prefetcher(std::unique_ptr<Queue> queue, PrefetchOptions<Duration> const &opts)
+        :_queue(std::move(queue)), _opts(opts)
+        {
+            _opts.depth = std::max<size_t>(_opts.depth, 1);
+            _opts.ack_batch = std::max<size_t>(_opts.ack_batch, 1);
+            if (_opts.heartbeat.count() > 0)
+            {
+                // Leases of buffered items which expired may already be
+                // held by another consumer, so they are never handed out
+                _queue -> start_heartbeat(_opts.lease_duration, _opts.heartbeat,
+                    [this](std::string const&, std::string const &lease_key)
+                    {
+                        std::lock_guard<std::mutex> lock(_mtx);
+                        _ready.erase(std::remove_if(_ready.begin(), _ready.end(),
+                            [&](Item const &item) { return item.lease_key == lease_key; }),
+                            _ready.end());
+                        _io_cv.notify_all();
+                    });
+            }
+            _thread = std::thread([this]() { _run(); });
+        }
+
+        ~Prefetcher()
+        {
+            stop();
+            // The heartbeat of the queue calls back into the buffers
+            _queue.reset();
+        }
+
+        /// @brief Takes the next item, blocks while the buffer is empty.
+        /// Returns nothing once a blocking lease timed out with nothing
+        /// buffered, like a lease timeout of the queue client, or after
+        /// stop(). Rethrows a failure of the background thread.
+        std::optional<Item> next()
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            size_t empty_leases = _empty_leases;
+            _ready_cv.wait(lock, [&]()
+            {
+                return !_ready.empty() || _empty_leases != empty_leases || _stopping || _error;
+            });
+            if (_error) std::rethrow_exception(_error);
+            if (_ready.empty()) return std::nullopt;
+            Item item = std::move(_ready.front());
+            _ready.pop_front();
+            _io_cv.notify_all();
+            return item;
+        }
+
+        /// @brief Hands a processed item to the background thread, which
+        /// acknowledges it with the next batch
+        void complete(Item item)
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            if (_stopped)
+            {
+                lock.unlock();
+                _queue -> complete_batch({ std::move(item) });
+                return;
+            }
+            _done.push_back(std::move(item));
+            _io_cv.notify_all();
+        }
+
+        /// @brief Acknowledges pending completions, gives the unstarted
+        /// items back to the queue and joins the background thread. Items
+        /// taken with next() can still be completed afterwards.
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                if (_stopped) return;
+                _stopping = true;
+                _io_cv.notify_all();
+                _ready_cv.notify_all();
+            }
+            if (_thread.joinable()) _thread.join();
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stopped = true;
+        }
+
+        /// @brief Queue client of the prefetcher, e.g., for depth(). Safe
+        /// to use for calls the client allows concurrently with leases.
+        Queue &queue() { return *_queue; }
+    };
+} // namespace rq
+
+#endif // PREFETCHER_H
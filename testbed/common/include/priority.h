@@ -0,0 +1,129 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rq
+{
+    /// @brief Key of the list holding the items of a priority level. Level 0
+    /// is the main queue itself, which the reaper and RELEASE requeue to.
+    /// Blocked priority consumers only wake up for the doorbell, so items
+    /// pushed to level 0 by producers unaware of priorities wait until the
+    /// next lease, at the latest when a blocking lease times out.
+    inline std::string priority_key(std::string const &queue, size_t level)
+    {
+        if (level == 0) return queue;
+        return queue + ":priority:" + std::to_string(level);
+    }
+
+    /// @brief List holding a single token while any level of a priority
+    /// queue may hold items. Priority publishes add the token and leases
+    /// finding every level empty remove it, so that blocked consumers wait
+    /// on this one key instead of polling every level.
+    inline std::string doorbell_key(std::string const &queue)
+    {
+        return queue + ":ready";
+    }
+
+    /// @brief Parses priority weights given on the command line as a comma
+    /// separated list from level 0, e.g., "1,2,4"
+    inline std::vector<unsigned> weights_from(std::string const &list)
+    {
+        std::vector<unsigned> weights;
+        size_t start = 0;
+        while (start <= list.size())
+        {
+            size_t comma = std::min(list.find(',', start), list.size());
+            weights.push_back((unsigned) std::stoul(list.substr(start, comma - start)));
+            start = comma + 1;
+        }
+        return weights;
+    }
+
+    /// @brief Order in which priority leases visit the levels of a queue.
+    /// Without weights every lease starts at the highest level and lower
+    /// levels are only served while all higher levels are empty. With
+    /// weights the level a lease starts at follows a smooth weighted round
+    /// robin, so that each level receives its share of the leases while it
+    /// has items and lower levels cannot starve. Leases continue with the
+    /// highest level if the first level is empty.
+    class PrioritySchedule
+    {
+        size_t _levels = 1;
+        /// @brief First level of consecutive leases, empty without weights
+        std::vector<uint32_t> _sequence;
+
+        public:
+        /// @brief Upper bound of the sum of the weights, which is the length
+        /// of the precomputed sequence
+        static constexpr unsigned MAX_WEIGHT = 1u << 16;
+
+        PrioritySchedule() = default;
+
+        /// @param levels Number of priority levels, one disables priorities
+        /// @param weights Share of the leases starting at every level from
+        /// level 0, empty for strict priorities
+        explicit PrioritySchedule(size_t levels, std::vector<unsigned> const &weights = {})
+        :_levels(std::max<size_t>(levels, 1))
+        {
+            if (weights.empty()) return;
+            if (weights.size() != _levels)
+                throw std::runtime_error("Expected one weight per priority level");
+            unsigned long long total = std::accumulate(weights.begin(), weights.end(), 0ull);
+            if (total == 0 || total > MAX_WEIGHT)
+                throw std::runtime_error("Sum of priority weights out of range");
+            // Smooth weighted round robin interleaves the levels instead of
+            // serving the weight of one level in a row
+            std::vector<long long> current(_levels, 0);
+            _sequence.reserve(total);
+            for (unsigned long long idx = 0; idx < total; idx += 1)
+            {
+                size_t best = 0;
+                for (size_t level = 0; level < _levels; level += 1)
+                {
+                    current[level] += weights[level];
+                    if (current[level] > current[best]) best = level;
+                }
+                current[best] -= (long long) total;
+                _sequence.push_back((uint32_t) best);
+            }
+        }
+
+        inline size_t levels() const { return _levels; }
+        inline bool enabled() const { return _levels > 1; }
+        inline bool weighted() const { return !_sequence.empty(); }
+
+        /// @brief Level the lease with the given ticket starts at
+        inline size_t first(uint64_t ticket) const
+        {
+            if (_sequence.empty()) return _levels - 1;
+            return _sequence[ticket % _sequence.size()];
+        }
+
+        /// @brief Position of the first level among the keys, as expected
+        /// by the priority lease script
+        inline size_t first_position(uint64_t ticket) const
+        {
+            return _levels - first(ticket);
+        }
+
+        /// @brief Keys of the levels from the highest to the lowest, in the
+        /// order of the priority lease script
+        std::vector<std::string> keys(std::string const &queue) const
+        {
+            std::vector<std::string> keys;
+            keys.reserve(_levels);
+            for (size_t level = _levels; level > 0; level -= 1)
+                keys.push_back(priority_key(queue, level - 1));
+            return keys;
+        }
+    };
+} // namespace rq
+
+#endif // PRIORITY_H
@@ -0,0 +1,79 @@
+#ifndef QUEUE_URI_H
+#define QUEUE_URI_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace rq
+{
+    /// @brief Location of a queue, either redis://host:port/queue for a
+    /// queue on a redis server, redis-cluster://host:port/queue for a queue
+    /// in a redis cluster reached through the given seed node or
+    /// local://queue for an in process queue. Cluster URIs may end with
+    /// ?reads=replica to send read only calls to a replica.
+    struct QueueUri
+    {
+        enum class Scheme
+        {
+            REDIS,
+            LOCAL
+        };
+
+        Scheme scheme = Scheme::REDIS;
+        std::string host = "localhost";
+        uint16_t port = 6379;
+        std::string queue = "foo";
+        /// @brief Whether the host is a seed node of a redis cluster
+        bool cluster = false;
+        /// @brief Whether read only calls go to replicas of the cluster
+        bool replica_reads = false;
+
+        /// @brief Whether the argument is a URI rather than a host name
+        static bool is_uri(std::string const &arg)
+        {
+            return arg.find("://") != std::string::npos;
+        }
+
+        /// @brief Parses a queue URI, missing parts keep their defaults
+        static QueueUri parse(std::string const &uri)
+        {
+            QueueUri parsed;
+            size_t sep = uri.find("://");
+            if (sep == std::string::npos) throw std::runtime_error("Not a queue URI: " + uri);
+            std::string scheme = uri.substr(0, sep);
+            std::string rest = uri.substr(sep + 3);
+            if (scheme == "local")
+            {
+                parsed.scheme = Scheme::LOCAL;
+                if (!rest.empty()) parsed.queue = rest;
+                return parsed;
+            }
+            if (scheme != "redis" && scheme != "redis-cluster") 
+                throw std::runtime_error("Unsupported queue URI scheme: " + scheme);
+            parsed.cluster = scheme == "redis-cluster";
+            size_t query = rest.find('?');
+            if (query != std::string::npos)
+            {
+                if (!parsed.cluster || rest.substr(query + 1) != "reads=replica") 
+                    throw std::runtime_error("Unsupported queue URI option: " + rest.substr(query + 1));
+                parsed.replica_reads = true;
+                rest = rest.substr(0, query);
+            }
+            size_t slash = rest.find('/');
+            std::string authority = rest.substr(0, slash);
+            if (slash != std::string::npos && slash + 1 < rest.size())
+                parsed.queue = rest.substr(slash + 1);
+            size_t colon = authority.rfind(':');
+            if (colon != std::string::npos)
+            {
+                parsed.port = (uint16_t) std::stoul(authority.substr(colon + 1));
+                authority = authority.substr(0, colon);
+            }
+            if (!authority.empty()) parsed.host = authority;
+            return parsed;
+        }
+    };
+} // namespace rq
+
+#endif // QUEUE_URI_H
@@ -0,0 +1,525 @@
+#ifndef SCRIPTS_H
+#define SCRIPTS_H
+
+#include <cstddef>
+
+/// Server side Lua scripts shared by the hiredis and redis-plus-plus queue
+/// clients. Scripts are loaded once with SCRIPT LOAD when a client is
+/// constructed and invoked with EVALSHA afterwards. Lease keys are derived on
+/// the server as <lease_key_prefix><item_id(item)>, so that moving an item to
+/// the processing queue and writing its lease happen in one atomic step.
+
+/// Lua function deriving the id of an item, prepended to every script using
+/// it. Items in an rq1 envelope (see item_id.h) carry the id computed by
+/// their producer, which saves hashing the payload on the server, other
+/// items are identified by the SHA1 digest of the whole item.
+#define RQ_LUA_ITEM_ID \
+    "local function item_id(item)\n" \
+    "    if string.sub(item, 1, 4) == 'rq1:' and string.byte(item, 37) == 58 then\n" \
+    "        return string.sub(item, 5, 36)\n" \
+    "    end\n" \
+    "    return redis.sha1hex(item)\n" \
+    "end\n"
+
+namespace rq
+{
+    /// @brief Layout of the items in processing
+    /// LIST keeps the items in the <queue>:processing list, completing an
+    /// item is O(N) in the number of items in processing.
+    /// ZSET keeps item ids in the <queue>:inflight sorted set scored by the
+    /// lease deadline in milliseconds and the items in the <queue>:payloads
+    /// hash keyed by item id, completing an item is O(log N) and expired
+    /// leases can be found with a range query on the deadline.
+    /// STREAM keeps all items in the <queue>:stream stream, read by the
+    /// workers consumer group. Items in processing are the pending entries
+    /// of the group, completing an item acknowledges and deletes its entry
+    /// and entries idle for longer than the lease duration are claimed by
+    /// the next lease. Producers add entries with an item field.
+    enum class Layout { LIST, ZSET, STREAM };
+
+    /// @brief Number of items waiting in the main queue and in processing,
+    /// read atomically by the DEPTH script
+    struct QueueDepth
+    {
+        size_t pending = 0;
+        size_t processing = 0;
+
+        /// @brief Whether no item is waiting or in processing
+        inline bool empty() const { return pending == 0 && processing == 0; }
+    };
+
+    namespace scripts
+    {
+        /// @brief Moves up to n items from the main queue to the processing
+        /// queue and writes the lease key for each of them.
+        /// KEYS[1] main queue, KEYS[2] processing queue, KEYS[3] payloads hash,
+        /// which is not used by the list layout
+        /// ARGV[1] lease key prefix, ARGV[2] session, ARGV[3] lease duration
+        /// in seconds, ARGV[4] maximum number of items n
+        /// Returns a flat array {item_1, lease_key_1, item_2, ...}, which is
+        /// empty if the main queue is empty.
+        constexpr const char *LEASE = RQ_LUA_ITEM_ID R"lua(
+local leased = {}
+for i = 1, tonumber(ARGV[4]) do
+    local item = redis.call('RPOPLPUSH', KEYS[1], KEYS[2])
+    if not item then break end
+    local key = ARGV[1] .. item_id(item)
+    redis.call('SET', key, ARGV[2], 'EX', ARGV[3])
+    leased[#leased + 1] = item
+    leased[#leased + 1] = key
+end
+return leased
+)lua";
+
+        /// @brief Removes an item from the processing queue and deletes its
+        /// lease key, counting the item as completed if it was in processing.
+        /// KEYS[1] processing queue, KEYS[2] payloads hash, which is not used
+        /// by the list layout, KEYS[3] completed counter
+        /// ARGV[1] lease key prefix, ARGV[2] item
+        /// Returns the number of deleted lease keys.
+        constexpr const char *COMPLETE = RQ_LUA_ITEM_ID R"lua(
+if redis.call('LREM', KEYS[1], 0, ARGV[2]) > 0 then redis.call('INCR', KEYS[3]) end
+return redis.call('DEL', ARGV[1] .. item_id(ARGV[2]))
+)lua";
+
+        /// @brief Sorted set layout variant of LEASE, same keys, arguments and
+        /// reply.
+        constexpr const char *LEASE_ZSET = RQ_LUA_ITEM_ID R"lua(
+local now = redis.call('TIME')
+local deadline = now[1] * 1000 + math.floor(now[2] / 1000) + tonumber(ARGV[3]) * 1000
+local leased = {}
+for i = 1, tonumber(ARGV[4]) do
+    local item = redis.call('RPOP', KEYS[1])
+    if not item then break end
+    local id = item_id(item)
+    redis.call('HSET', KEYS[3], id, item)
+    redis.call('ZADD', KEYS[2], deadline, id)
+    local key = ARGV[1] .. id
+    redis.call('SET', key, ARGV[2], 'EX', ARGV[3])
+    leased[#leased + 1] = item
+    leased[#leased + 1] = key
+end
+return leased
+)lua";
+
+        /// @brief Sorted set layout variant of COMPLETE, same keys, arguments
+        /// and reply.
+        constexpr const char *COMPLETE_ZSET = RQ_LUA_ITEM_ID R"lua(
+local id = item_id(ARGV[2])
+if redis.call('ZREM', KEYS[1], id) > 0 then redis.call('INCR', KEYS[3]) end
+redis.call('HDEL', KEYS[2], id)
+return redis.call('DEL', ARGV[1] .. id)
+)lua";
+
+        /// @brief Priority variant of LEASE and LEASE_ZSET, leasing from the
+        /// highest non-empty level first. The first level may be chosen by
+        /// the client to serve lower levels with a weighted share, the
+        /// remaining items are taken from the highest level downwards. The
+        /// doorbell is removed once every level is empty, a publish after
+        /// this point adds it again.
+        /// KEYS[1] processing queue, KEYS[2] payloads hash, which is not used
+        /// by the list layout, KEYS[3] doorbell, KEYS[4...] levels from the
+        /// highest to the lowest priority
+        /// ARGV[1] lease key prefix, ARGV[2] session, ARGV[3] 'zset' for the
+        /// sorted set layout, ARGV[4] lease duration in seconds, ARGV[5]
+        /// maximum number of items n, ARGV[6] position of the first level,
+        /// 1 for the highest
+        /// Returns a flat array {item_1, lease_key_1, item_2, ...}, which is
+        /// empty if every level is empty.
+        constexpr const char *LEASE_PRIORITY = RQ_LUA_ITEM_ID R"lua(
+local zset = ARGV[3] == 'zset'
+local deadline
+if zset then
+    local now = redis.call('TIME')
+    deadline = now[1] * 1000 + math.floor(now[2] / 1000) + tonumber(ARGV[4]) * 1000
+end
+local n = tonumber(ARGV[5])
+local leased = {}
+local function take(source)
+    while #leased < 2 * n do
+        local item, key
+        if zset then
+            item = redis.call('RPOP', source)
+            if not item then return end
+            local id = item_id(item)
+            redis.call('HSET', KEYS[2], id, item)
+            redis.call('ZADD', KEYS[1], deadline, id)
+            key = ARGV[1] .. id
+        else
+            item = redis.call('RPOPLPUSH', source, KEYS[1])
+            if not item then return end
+            key = ARGV[1] .. item_id(item)
+        end
+        redis.call('SET', key, ARGV[2], 'EX', ARGV[4])
+        leased[#leased + 1] = item
+        leased[#leased + 1] = key
+    end
+end
+local first = tonumber(ARGV[6])
+if first > 1 and first <= #KEYS - 3 then take(KEYS[3 + first]) end
+for idx = 4, #KEYS do take(KEYS[idx]) end
+-- Fewer items than requested means every level was drained
+if #leased < 2 * n then redis.call('DEL', KEYS[3]) end
+return leased
+)lua";
+
+        /// @brief Adds items to a level of a priority queue and rings the
+        /// doorbell, so that consumers blocked on it wake up.
+        /// KEYS[1] level, KEYS[2] doorbell
+        /// ARGV items, at most a few thousand per call
+        /// Returns the length of the level after the push.
+        constexpr const char *PUBLISH_PRIORITY = R"lua(
+local length = redis.call('RPUSH', KEYS[1], unpack(ARGV))
+if redis.call('EXISTS', KEYS[2]) == 0 then redis.call('RPUSH', KEYS[2], 1) end
+return length
+)lua";
+
+        /// @brief Adds the items to a list unless an item with the same id
+        /// was published within the dedupe window. The ids are kept in a
+        /// sorted set scored by their publish time in milliseconds, entries
+        /// older than the window are trimmed on every call. Duplicates in
+        /// one call are dropped as well.
+        /// KEYS[1] main queue or level, KEYS[2] dedupe set, KEYS[3] optional
+        /// doorbell of a priority queue, rung if an item was added
+        /// ARGV[1] dedupe window in milliseconds, ARGV[2...] items, at most a
+        /// few thousand per call
+        /// Returns the number of items added.
+        constexpr const char *PUBLISH_DEDUPE = RQ_LUA_ITEM_ID R"lua(
+local now = redis.call('TIME')
+local ms = now[1] * 1000 + math.floor(now[2] / 1000)
+redis.call('ZREMRANGEBYSCORE', KEYS[2], '-inf', ms - tonumber(ARGV[1]))
+local fresh = {}
+for idx = 2, #ARGV do
+    if redis.call('ZADD', KEYS[2], 'NX', ms, item_id(ARGV[idx])) == 1 then
+        fresh[#fresh + 1] = ARGV[idx]
+    end
+end
+if #fresh == 0 then return 0 end
+redis.call('RPUSH', KEYS[1], unpack(fresh))
+if KEYS[3] and redis.call('EXISTS', KEYS[3]) == 0 then redis.call('RPUSH', KEYS[3], 1) end
+redis.call('PEXPIRE', KEYS[2], ARGV[1])
+return #fresh
+)lua";
+
+        /// @brief Requeues items in processing whose lease key has expired,
+        /// scanning at most chunk items of the processing list per call.
+        /// Orphans are overwritten with a tombstone while scanning and
+        /// removed with one LREM, then pushed back to the main queue with one
+        /// variadic RPUSH.
+        /// KEYS[1] main queue, KEYS[2] processing queue, KEYS[3] payloads
+        /// hash, which is not used by the list layout, KEYS[4] optional
+        /// doorbell of a priority queue, rung if an item was requeued
+        /// ARGV[1] lease key prefix, ARGV[2] cursor, ARGV[3] chunk size,
+        /// ARGV[4] tombstone value
+        /// Returns {next_cursor, requeued}, next_cursor is 0 once the scan
+        /// reached the end of the processing queue.
+        constexpr const char *REAP = RQ_LUA_ITEM_ID R"lua(
+local start = tonumber(ARGV[2])
+local chunk = tonumber(ARGV[3])
+local items = redis.call('LRANGE', KEYS[2], start, start + chunk - 1)
+local orphans = {}
+for idx, item in ipairs(items) do
+    if redis.call('EXISTS', ARGV[1] .. item_id(item)) == 0 then
+        redis.call('LSET', KEYS[2], start + idx - 1, ARGV[4])
+        orphans[#orphans + 1] = item
+    end
+end
+if #orphans > 0 then
+    redis.call('LREM', KEYS[2], 0, ARGV[4])
+    redis.call('RPUSH', KEYS[1], unpack(orphans))
+    if KEYS[4] and redis.call('EXISTS', KEYS[4]) == 0 then redis.call('RPUSH', KEYS[4], 1) end
+end
+local next = start + #items - #orphans
+if #items < chunk then next = 0 end
+return {next, #orphans}
+)lua";
+
+        /// @brief Sorted set layout variant of REAP, same keys, arguments and
+        /// reply. Only ids past their deadline are inspected. Ids whose lease
+        /// key is still alive, e.g., because it was extended, are rescored
+        /// with the remaining lease time instead of being requeued.
+        constexpr const char *REAP_ZSET = R"lua(
+local now = redis.call('TIME')
+local now_ms = now[1] * 1000 + math.floor(now[2] / 1000)
+local chunk = tonumber(ARGV[3])
+local ids = redis.call('ZRANGEBYSCORE', KEYS[2], '-inf', now_ms, 'LIMIT', 0, chunk)
+local orphans = {}
+for _, id in ipairs(ids) do
+    local ttl = redis.call('PTTL', ARGV[1] .. id)
+    if ttl ~= -2 then
+        redis.call('ZADD', KEYS[2], now_ms + math.max(ttl, 1000), id)
+    else
+        local item = redis.call('HGET', KEYS[3], id)
+        redis.call('ZREM', KEYS[2], id)
+        redis.call('HDEL', KEYS[3], id)
+        if item then orphans[#orphans + 1] = item end
+    end
+end
+if #orphans > 0 then
+    redis.call('RPUSH', KEYS[1], unpack(orphans))
+    if KEYS[4] and redis.call('EXISTS', KEYS[4]) == 0 then redis.call('RPUSH', KEYS[4], 1) end
+end
+local next = 1
+if #ids < chunk then next = 0 end
+return {next, #orphans}
+)lua";
+
+        /// @brief Extends the leases held by a session.
+        /// KEYS lease keys
+        /// ARGV[1] session, ARGV[2] lease duration in seconds
+        /// Returns an array with 1 for every extended lease and 0 for every
+        /// lease which expired or is now held by another session.
+        constexpr const char *EXTEND = R"lua(
+local held = {}
+for idx, key in ipairs(KEYS) do
+    if redis.call('GET', key) == ARGV[1] then
+        redis.call('EXPIRE', key, ARGV[2])
+        held[idx] = 1
+    else
+        held[idx] = 0
+    end
+end
+return held
+)lua";
+
+        /// @brief Stream layout variant of LEASE. Entries of the group that
+        /// were idle for longer than the lease duration are claimed first,
+        /// new entries are read for the remainder.
+        /// KEYS[1] stream
+        /// ARGV[1] consumer group, ARGV[2] session, ARGV[3] lease duration
+        /// in seconds, ARGV[4] maximum number of items n, ARGV[5] entry id
+        /// from which idle entries are claimed, '0-0' to start over
+        /// Returns a flat array {item_1, entry_id_1, item_2, ...}. If no
+        /// item was leased, returns {last_id} instead, the id of the newest
+        /// entry, from which XREAD BLOCK waits for the next one. Either way
+        /// the cursor for ARGV[5] of the next call is appended, so that
+        /// repeated leases scan the pending entries once instead of from
+        /// the start every time.
+        constexpr const char *LEASE_STREAM = R"lua(
+local leased = {}
+local function take(entries)
+    for _, entry in ipairs(entries) do
+        -- Entries deleted while pending have no fields
+        local fields = entry[2]
+        if fields then
+            for i = 1, #fields, 2 do
+                if fields[i] == 'item' then
+                    leased[#leased + 1] = fields[i + 1]
+                    leased[#leased + 1] = entry[1]
+                    break
+                end
+            end
+        end
+    end
+end
+local n = tonumber(ARGV[4])
+local claimed = redis.call(
+    'XAUTOCLAIM', KEYS[1], ARGV[1], ARGV[2], tonumber(ARGV[3]) * 1000, ARGV[5] or '0-0',
+    'COUNT', n)
+take(claimed[2])
+local missing = n - #leased / 2
+if missing > 0 then
+    local read = redis.call(
+        'XREADGROUP', 'GROUP', ARGV[1], ARGV[2], 'COUNT', missing, 'STREAMS', KEYS[1], '>')
+    if read then take(read[1][2]) end
+end
+if #leased == 0 then
+    local info = redis.call('XINFO', 'STREAM', KEYS[1])
+    for i = 1, #info, 2 do
+        if info[i] == 'last-generated-id' then leased[1] = info[i + 1] end
+    end
+end
+leased[#leased + 1] = claimed[1]
+return leased
+)lua";
+
+        /// @brief Stream layout variant of EXTEND, resets the idle time of
+        /// pending entries still owned by the session.
+        /// KEYS[1] stream
+        /// ARGV[1] consumer group, ARGV[2] session, ARGV[3...] entry ids
+        /// Returns an array with 1 for every extended lease and 0 for every
+        /// entry which was acknowledged or claimed by another session.
+        constexpr const char *EXTEND_STREAM = R"lua(
+local held = {}
+for i = 3, #ARGV do
+    local pending = redis.call('XPENDING', KEYS[1], ARGV[1], ARGV[i], ARGV[i], 1)
+    if pending[1] and pending[1][2] == ARGV[2] then
+        redis.call('XCLAIM', KEYS[1], ARGV[1], ARGV[2], 0, ARGV[i], 'JUSTID')
+        held[#held + 1] = 1
+    else
+        held[#held + 1] = 0
+    end
+end
+return held
+)lua";
+
+        /// @brief Gives leased items back before their lease expires, e.g.,
+        /// items a consumer prefetched but never started. Only items whose
+        /// lease is still held by the session, or has already expired, are
+        /// touched. Items are pushed to the end of the main queue the next
+        /// lease pops from, priority queues get them back at level 0 like
+        /// the reaper requeues them.
+        /// KEYS[1] main queue, KEYS[2] processing queue, the stream for the
+        /// stream layout, KEYS[3] payloads hash, KEYS[4] optional doorbell
+        /// ARGV[1] 'list', 'zset' or 'stream', ARGV[2] lease key prefix, the
+        /// consumer group for the stream layout, ARGV[3] session,
+        /// ARGV[4...] pairs of item and lease key, entry id for the stream
+        /// layout
+        /// Returns the number of items given back.
+        constexpr const char *RELEASE = RQ_LUA_ITEM_ID R"lua(
+local released = 0
+for i = 4, #ARGV - 1, 2 do
+    local item, key = ARGV[i], ARGV[i + 1]
+    if ARGV[1] == 'stream' then
+        -- A long idle time lets the next lease claim the entry right away
+        local pending = redis.call('XPENDING', KEYS[2], ARGV[2], key, key, 1)
+        if pending[1] and pending[1][2] == ARGV[3] then
+            redis.call('XCLAIM', KEYS[2], ARGV[2], ARGV[3], 0, key, 'IDLE', 2147483647, 'JUSTID')
+            released = released + 1
+        end
+    else
+        local owner = redis.call('GET', key)
+        if not owner or owner == ARGV[3] then
+            local removed
+            if ARGV[1] == 'zset' then
+                local id = item_id(item)
+                removed = redis.call('ZREM', KEYS[2], id)
+                if removed > 0 then redis.call('HDEL', KEYS[3], id) end
+            else
+                removed = redis.call('LREM', KEYS[2], 1, item)
+            end
+            if removed > 0 then
+                if owner then redis.call('DEL', key) end
+                redis.call('RPUSH', KEYS[1], item)
+                released = released + 1
+            end
+        end
+    end
+end
+if released > 0 and ARGV[1] ~= 'stream' and KEYS[4]
+    and redis.call('EXISTS', KEYS[4]) == 0 then
+    redis.call('RPUSH', KEYS[4], 1)
+end
+return released
+)lua";
+
+        /// @brief Reads the length of the main queue and the number of items
+        /// in processing in one atomic step.
+        /// KEYS[1] main queue, KEYS[2] processing queue, the stream for the
+        /// stream layout, KEYS[3...] further priority levels, whose items
+        /// count as pending
+        /// ARGV[1] 'zset' or 'stream' for the sorted set and stream layouts,
+        /// ARGV[2] consumer group of the stream layout
+        /// Returns {pending, processing}.
+        constexpr const char *DEPTH = R"lua(
+if ARGV[1] == 'stream' then
+    local processing = redis.call('XPENDING', KEYS[2], ARGV[2])[1]
+    return {redis.call('XLEN', KEYS[2]) - processing, processing}
+end
+local processing
+if ARGV[1] == 'zset' then
+    processing = redis.call('ZCARD', KEYS[2])
+else
+    processing = redis.call('LLEN', KEYS[2])
+end
+local pending = redis.call('LLEN', KEYS[1])
+for idx = 3, #KEYS do pending = pending + redis.call('LLEN', KEYS[idx]) end
+return {pending, processing}
+)lua";
+
+        /// @brief Reads the state of a queue for operators in one atomic
+        /// step, inspecting at most limit items in processing per call. The
+        /// age of a lease is the time since it was taken or last extended,
+        /// derived from the remaining time of its lease key, its deadline or
+        /// the idle time of its pending entry. Items in processing without a
+        /// lease, or stream entries idle for longer than the lease duration,
+        /// are orphans waiting for the reaper or the next lease.
+        /// KEYS[1] main queue, KEYS[2] processing queue, the stream for the
+        /// stream layout, KEYS[3] completed counter, which is not used by
+        /// the stream layout
+        /// ARGV[1] 'list', 'zset' or 'stream', ARGV[2] lease key prefix, the
+        /// consumer group for the stream layout, ARGV[3] cursor, '0' for the
+        /// first call, ARGV[4] limit, ARGV[5] lease duration in seconds
+        /// Returns {now_ms, pending, processing, completed, next_cursor,
+        /// inspected, orphans, oldest_age_ms, session_1, leases_1, ...},
+        /// next_cursor is '0' once the scan reached the end of processing.
+        /// Completed items of the stream layout are the entries added to the
+        /// stream and deleted since, which needs redis 7.
+        constexpr const char *INSPECT = RQ_LUA_ITEM_ID R"lua(
+local now = redis.call('TIME')
+local now_ms = now[1] * 1000 + math.floor(now[2] / 1000)
+local limit = tonumber(ARGV[4])
+local duration_ms = tonumber(ARGV[5]) * 1000
+local sessions = {}
+local orphans, oldest, inspected = 0, 0, 0
+local pending, processing, completed
+local next = '0'
+local function count(session, age)
+    inspected = inspected + 1
+    if session then
+        sessions[session] = (sessions[session] or 0) + 1
+    else
+        orphans = orphans + 1
+    end
+    if age > oldest then oldest = age end
+end
+if ARGV[1] == 'stream' then
+    processing = redis.call('XPENDING', KEYS[2], ARGV[2])[1]
+    pending = redis.call('XLEN', KEYS[2]) - processing
+    completed = 0
+    local info = redis.call('XINFO', 'STREAM', KEYS[2])
+    for i = 1, #info, 2 do
+        if info[i] == 'entries-added' then completed = info[i + 1] - pending - processing end
+    end
+    local start = '-'
+    if ARGV[3] ~= '0' then start = '(' .. ARGV[3] end
+    local entries = redis.call('XPENDING', KEYS[2], ARGV[2], start, '+', limit)
+    for _, entry in ipairs(entries) do
+        local session = entry[2]
+        if entry[3] > duration_ms then session = nil end
+        count(session, entry[3])
+    end
+    if #entries == limit then next = entries[#entries][1] end
+else
+    pending = redis.call('LLEN', KEYS[1])
+    completed = tonumber(redis.call('GET', KEYS[3]) or 0)
+    local start = tonumber(ARGV[3])
+    if ARGV[1] == 'zset' then
+        processing = redis.call('ZCARD', KEYS[2])
+        -- Ordered by deadline, the oldest leases come first
+        local ids = redis.call('ZRANGE', KEYS[2], start, start + limit - 1, 'WITHSCORES')
+        for i = 1, #ids, 2 do
+            local session = redis.call('GET', ARGV[2] .. ids[i])
+            count(session, now_ms - tonumber(ids[i + 1]) + duration_ms)
+        end
+        if #ids / 2 == limit then next = tostring(start + limit) end
+    else
+        processing = redis.call('LLEN', KEYS[2])
+        local items = redis.call('LRANGE', KEYS[2], start, start + limit - 1)
+        for _, item in ipairs(items) do
+            local key = ARGV[2] .. item_id(item)
+            local session = redis.call('GET', key)
+            local age = 0
+            if session then age = duration_ms - redis.call('PTTL', key) end
+            count(session, age)
+        end
+        if #items == limit then next = tostring(start + limit) end
+    end
+end
+local reply = {now_ms, pending, processing, completed, next, inspected, orphans, oldest}
+for session, leases in pairs(sessions) do
+    reply[#reply + 1] = session
+    reply[#reply + 1] = leases
+end
+return reply
+)lua";
+
+        /// @brief Checks whether a lease on the item exists.
+        /// ARGV[1] lease key prefix, ARGV[2] item
+        constexpr const char *LEASE_EXISTS = RQ_LUA_ITEM_ID R"lua(
+return redis.call('EXISTS', ARGV[1] .. item_id(ARGV[2]))
+)lua";
+    } // namespace scripts
+} // namespace rq
+
+#endif // SCRIPTS_H
@@ -0,0 +1,303 @@
+#ifndef SHARDED_QUEUE_H
+#define SHARDED_QUEUE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "scripts.h"
+
+namespace rq
+{
+    /// @brief Name of a physical shard of a logical queue, each shard is a
+    /// complete queue with its own processing key and leases
+    inline std::string shard_name(std::string const &queue, size_t shard)
+    {
+        return queue + ":shard:" + std::to_string(shard);
+    }
+
+    /// @brief Parses a comma separated list given on the command line, e.g.,
+    /// the hosts the shards of a queue are spread over
+    inline std::vector<std::string> list_from(std::string const &list)
+    {
+        std::vector<std::string> values;
+        size_t start = 0;
+        while (start <= list.size())
+        {
+            size_t comma = std::min(list.find(',', start), list.size());
+            values.push_back(list.substr(start, comma - start));
+            start = comma + 1;
+        }
+        return values;
+    }
+
+    /// @brief 64 bit FNV-1a, stable across processes and platforms unlike
+    /// std::hash, so that every producer maps an item to the same shard
+    inline uint64_t fnv1a(std::string_view data)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c: data)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /// @brief How publishers pick the shard of an item
+    enum class ShardPolicy
+    {
+        /// @brief Spreads items evenly independent of their content
+        ROUND_ROBIN,
+        /// @brief Keeps equal items on the same shard
+        HASH
+    };
+
+    /// @brief Picks the shard of every published item
+    class ShardRouter
+    {
+        size_t _shards;
+        ShardPolicy _policy;
+        uint64_t _next = 0;
+
+        public:
+        explicit ShardRouter(size_t shards, ShardPolicy policy = ShardPolicy::ROUND_ROBIN)
+        :_shards(std::max<size_t>(shards, 1)), _policy(policy)
+        {
+        }
+
+        inline size_t shards() const { return _shards; }
+
+        inline size_t route(std::string_view item)
+        {
+            if (_policy == ShardPolicy::HASH) return fnv1a(item) % _shards;
+            return _next++ % _shards;
+        }
+    };
+
+    /// @brief Seconds of a lease timeout of either client
+    inline double seconds_of(uint8_t seconds) { return seconds; }
+
+    template <typename Rep, typename Period>
+    inline double seconds_of(std::chrono::duration<Rep, Period> duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    /// @brief Publisher distributing items over the shards of a logical
+    /// queue, the shards may live on different redis servers
+    /// @tparam Publisher Publisher of a single queue providing publish and
+    /// publish_batch
+    template <typename Publisher>
+    class ShardedPublisher
+    {
+        std::vector<std::unique_ptr<Publisher>> _shards;
+        ShardRouter _router;
+
+        public:
+        ShardedPublisher() = delete;
+        ShardedPublisher(ShardedPublisher const&) = delete;
+        ShardedPublisher operator=(ShardedPublisher const&) = delete;
+
+        /// @param shards Publishers of the shards in shard order
+        ShardedPublisher(
+            std::vector<std::unique_ptr<Publisher>> shards,
+            ShardPolicy policy = ShardPolicy::ROUND_ROBIN)
+        :_shards(std::move(shards)), _router(_shards.size(), policy)
+        {
+            if (_shards.empty()) throw std::runtime_error("A sharded queue needs at least one shard");
+        }
+
+        inline size_t shards() const { return _shards.size(); }
+
+        /// @brief Client of a shard, e.g., to enable priorities on it
+        inline Publisher &shard(size_t idx) { return *_shards.at(idx); }
+
+        /// @brief Publishes an item to its shard, returns the length of the
+        /// shard. Further arguments e.g., a priority are passed on.
+        template <typename... Args>
+        size_t publish(std::string const &item, Args&&... args)
+        {
+            return _shards[_router.route(item)] -> publish(item, std::forward<Args>(args)...);
+        }
+
+        /// @brief Splits the items by shard and publishes every part with
+        /// the batch publish of its shard, returns the number of items
+        template <typename Input, typename... Args>
+        size_t publish_batch(
+            Input first, Input last, size_t chunk_size = 1000, size_t depth = 16, Args&&... args)
+        {
+            std::vector<std::vector<std::string>> parts(_shards.size());
+            size_t count = 0;
+            for (; first != last; ++first, ++count)
+                parts[_router.route(*first)].emplace_back(*first);
+            for (size_t shard = 0; shard < parts.size(); shard += 1)
+            {
+                if (parts[shard].empty()) continue;
+                _shards[shard] -> publish_batch(parts[shard], chunk_size, depth, args...);
+            }
+            return count;
+        }
+
+        template <typename Range, typename... Args>
+        size_t publish_batch(
+            Range const &items, size_t chunk_size = 1000, size_t depth = 16, Args&&... args)
+        {
+            return publish_batch(
+                std::begin(items), std::end(items), chunk_size, depth, std::forward<Args>(args)...);
+        }
+    };
+
+    /// @brief Consumer of a logical queue spread over several shards. Leases
+    /// are taken from the home shard first and stolen from the other shards
+    /// while the home shard is empty, every item is completed on the shard
+    /// it was leased from. Provides the batch API of the queue clients, so
+    /// that it can be driven by the worker pool. Used by one thread.
+    /// @tparam Queue Queue client of a single shard providing lease_batch,
+    /// complete_batch and depth
+    /// @tparam Duration Lease duration type of the queue client
+    template <typename Queue, typename Duration>
+    class ShardedQueue
+    {
+        public:
+        typedef typename decltype(
+            std::declval<Queue&>().lease_batch(1))::value_type ShardItem;
+
+        /// @brief Leased item together with the shard it was leased from
+        struct Item: ShardItem
+        {
+            size_t shard = 0;
+        };
+
+        private:
+        std::vector<std::unique_ptr<Queue>> _shards;
+        size_t _home;
+        /// @brief Longest time a blocking lease waits on the home shard
+        /// before it looks at the other shards again
+        Duration _steal_interval;
+        /// @brief Rotates the shard steals start at, so that consumers
+        /// sharing a home shard do not all steal from the same shard
+        size_t _rotation = 0;
+        /// @brief Completed items by shard, keeps its capacity
+        std::vector<std::vector<ShardItem>> _completed;
+
+        std::vector<Item> _take(
+            size_t shard, size_t n, Duration duration, Duration timeout, bool blocking)
+        {
+            std::vector<ShardItem> items = _shards[shard] -> lease_batch(
+                n, duration, timeout, blocking);
+            std::vector<Item> leased(items.size());
+            for (size_t idx = 0; idx < items.size(); idx += 1)
+            {
+                static_cast<ShardItem&>(leased[idx]) = std::move(items[idx]);
+                leased[idx].shard = shard;
+            }
+            return leased;
+        }
+
+        /// @brief Leases from the shards without blocking, the home shard
+        /// first and the other shards in rotating order
+        std::vector<Item> _sweep(size_t n, Duration duration)
+        {
+            std::vector<Item> leased = _take(_home, n, duration, Duration(), false);
+            size_t others = _shards.size() - 1;
+            for (size_t offset = 0; offset < others && leased.empty(); offset += 1)
+            {
+                size_t shard = (_home + 1 + (_rotation + offset) % others) % _shards.size();
+                leased = _take(shard, n, duration, Duration(), false);
+            }
+            _rotation += 1;
+            return leased;
+        }
+
+        public:
+        ShardedQueue() = delete;
+        ShardedQueue(ShardedQueue const&) = delete;
+        ShardedQueue operator=(ShardedQueue const&) = delete;
+
+        /// @param shards Clients of the shards in shard order, which may be
+        /// connected to different servers
+        /// @param home Shard leased from first, e.g., the index of the
+        /// fetcher modulo the number of shards
+        /// @param steal_interval Longest time a blocking lease waits on the
+        /// home shard before it tries to steal again
+        ShardedQueue(
+            std::vector<std::unique_ptr<Queue>> shards, size_t home, Duration steal_interval)
+        :_shards(std::move(shards)), _steal_interval(steal_interval)
+        {
+            if (_shards.empty()) throw std::runtime_error("A sharded queue needs at least one shard");
+            _home = home % _shards.size();
+            _completed.resize(_shards.size());
+        }
+
+        inline size_t shards() const { return _shards.size(); }
+        inline size_t home() const { return _home; }
+
+        /// @brief Items waiting and in processing over all shards, each
+        /// shard is read atomically but the shards one after another
+        QueueDepth depth() const
+        {
+            QueueDepth depth;
+            for (std::unique_ptr<Queue> const &shard: _shards)
+            {
+                QueueDepth part = shard -> depth();
+                depth.pending += part.pending;
+                depth.processing += part.processing;
+            }
+            return depth;
+        }
+
+        inline bool empty() const { return depth().empty(); }
+
+        /// @brief Leases up to n items from the first shard that has any,
+        /// blocking on the home shard while all shards are empty. Items
+        /// published to other shards are picked up after at most one steal
+        /// interval, which also bounds how far the timeout is exceeded.
+        /// Durations are in the units of the queue client, i.e., seconds.
+        std::vector<Item> lease_batch(
+            size_t n, Duration duration = Duration(5), Duration timeout = Duration(2),
+            bool blocking = true)
+        {
+            std::vector<Item> leased;
+            if (n == 0) return leased;
+            leased = _sweep(n, duration);
+            if (!leased.empty() || !blocking) return leased;
+            double limit = seconds_of(timeout);
+            auto deadline = std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(limit));
+            while (leased.empty())
+            {
+                // A zero timeout blocks indefinitely like the queue clients
+                if (limit > 0 && std::chrono::steady_clock::now() >= deadline) break;
+                leased = _take(_home, n, duration, _steal_interval, true);
+                if (leased.empty()) leased = _sweep(n, duration);
+            }
+            return leased;
+        }
+
+        /// @brief Completes the items on the shards they were leased from,
+        /// with one batch per shard
+        void complete_batch(std::vector<Item> const &items)
+        {
+            for (Item const &item: items) _completed[item.shard].push_back(item);
+            for (size_t shard = 0; shard < _shards.size(); shard += 1)
+            {
+                if (_completed[shard].empty()) continue;
+                _shards[shard] -> complete_batch(_completed[shard]);
+                _completed[shard].clear();
+            }
+        }
+
+        /// @brief Client of a shard, e.g., to start its lease heartbeat
+        inline Queue &shard(size_t idx) { return *_shards.at(idx); }
+    };
+} // namespace rq
+
+#endif // SHARDED_QUEUE_H
@@ -0,0 +1,487 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rq
+{
+    namespace stats
+    {
+        /// @brief Queue client recording a sample
+        enum class Client
+        {
+            HIREDIS,
+            REDIS_PLUS_PLUS,
+            COUNT
+        };
+
+        /// @brief Timed operations, each one server round trip or one
+        /// blocking wait for an item
+        enum class Command
+        {
+            LEASE,
+            LEASE_BATCH,
+            COMPLETE,
+            COMPLETE_BATCH,
+            /// @brief Blocking wait for the main queue, without the lease
+            BLOCK,
+            EXTEND,
+            DEPTH,
+            /// @brief Leased items given back before they were started
+            RELEASE,
+            COUNT
+        };
+
+        enum class Counter
+        {
+            /// @brief Items leased
+            LEASES,
+            /// @brief Lease calls which found no item
+            EMPTIES,
+            /// @brief Blocking waits which expired without an item
+            TIMEOUTS,
+            /// @brief Connections dropped and replaced after an error
+            RECONNECTS,
+            /// @brief RESP encoded bytes of commands and replies, the 
+            /// redis-plus-plus client only counts those of script calls
+            BYTES_OUT,
+            BYTES_IN,
+            COUNT
+        };
+
+        constexpr size_t CLIENTS = (size_t) Client::COUNT;
+        constexpr size_t COMMANDS = (size_t) Command::COUNT;
+        constexpr size_t COUNTERS = (size_t) Counter::COUNT;
+
+        inline const char *name(Client client)
+        {
+            static const char *names[CLIENTS] = { "hiredis", "redis++" };
+            return names[(size_t) client];
+        }
+
+        inline const char *name(Command command)
+        {
+            static const char *names[COMMANDS] = {
+                "lease", "lease_batch", "complete", "complete_batch", "block", "extend", "depth", 
+                "release" };
+            return names[(size_t) command];
+        }
+
+        inline const char *name(Counter counter)
+        {
+            static const char *names[COUNTERS] = {
+                "leases", "empties", "timeouts", "reconnects", "bytes_out", "bytes_in" };
+            return names[(size_t) counter];
+        }
+
+        /// @brief Log linear bucketing of nanosecond latencies in the style
+        /// of HDR histograms, every power of two is split into 8 buckets,
+        /// so values are reported within 12.5 percent. Latencies beyond
+        /// 2^40 ns (about 18 minutes) fall into the last bucket.
+        struct Buckets
+        {
+            static constexpr unsigned SUB_BITS = 3;
+            static constexpr uint64_t SUB = 1ull << SUB_BITS;
+            static constexpr unsigned MAX_BITS = 40;
+            static constexpr size_t COUNT = (MAX_BITS - SUB_BITS + 1) * SUB;
+
+            static size_t index(uint64_t ns)
+            {
+                if (ns < SUB) return (size_t) ns;
+                unsigned exp = 63 - __builtin_clzll(ns);
+                if (exp >= MAX_BITS) return COUNT - 1;
+                uint64_t mantissa = (ns >> (exp - SUB_BITS)) & (SUB - 1);
+                return ((exp - SUB_BITS + 1) << SUB_BITS) | mantissa;
+            }
+
+            /// @brief Largest value falling into a bucket
+            static uint64_t upper(size_t idx)
+            {
+                if (idx < SUB) return idx;
+                unsigned exp = (unsigned) (idx >> SUB_BITS) + SUB_BITS - 1;
+                uint64_t mantissa = idx & (SUB - 1);
+                uint64_t lower = (SUB + mantissa) << (exp - SUB_BITS);
+                return lower + (1ull << (exp - SUB_BITS)) - 1;
+            }
+        };
+
+        /// @brief Latency histogram written by a single thread and read by
+        /// any thread. Writes are plain relaxed stores, no locked
+        /// instructions are needed on the hot path.
+        class Histogram
+        {
+            std::array<std::atomic<uint64_t>, Buckets::COUNT> _buckets{};
+            std::atomic<uint64_t> _count{0};
+            std::atomic<uint64_t> _sum{0};
+            std::atomic<uint64_t> _max{0};
+
+            static void _add(std::atomic<uint64_t> &value, uint64_t n)
+            {
+                value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            public:
+            void record(uint64_t ns)
+            {
+                _add(_buckets[Buckets::index(ns)], 1);
+                _add(_count, 1);
+                _add(_sum, ns);
+                if (ns > _max.load(std::memory_order_relaxed)) _max.store(ns, std::memory_order_relaxed);
+            }
+
+            friend struct Summary;
+        };
+
+        /// @brief Merged histogram of all threads
+        struct Summary
+        {
+            std::vector<uint64_t> buckets = std::vector<uint64_t>(Buckets::COUNT, 0);
+            uint64_t count = 0;
+            uint64_t sum_ns = 0;
+            uint64_t max_ns = 0;
+
+            void merge(Histogram const &hist)
+            {
+                for (size_t idx = 0; idx < Buckets::COUNT; idx += 1)
+                    buckets[idx] += hist._buckets[idx].load(std::memory_order_relaxed);
+                count += hist._count.load(std::memory_order_relaxed);
+                sum_ns += hist._sum.load(std::memory_order_relaxed);
+                max_ns = std::max(max_ns, hist._max.load(std::memory_order_relaxed));
+            }
+
+            /// @brief Upper bound of the bucket holding the quantile q
+            uint64_t quantile_ns(double q) const
+            {
+                if (count == 0) return 0;
+                uint64_t rank = (uint64_t) (q * count);
+                uint64_t seen = 0;
+                for (size_t idx = 0; idx < Buckets::COUNT; idx += 1)
+                {
+                    seen += buckets[idx];
+                    if (seen > rank) return std::min(Buckets::upper(idx), max_ns);
+                }
+                return max_ns;
+            }
+        };
+
+        /// @brief Samples of one thread, never freed so that counts of
+        /// finished threads remain part of every snapshot
+        struct ThreadStats
+        {
+            Histogram latency[CLIENTS][COMMANDS];
+            std::atomic<uint64_t> counters[CLIENTS][COUNTERS]{};
+        };
+
+        /// @brief Counts and latencies of all threads at one point in time
+        struct Snapshot
+        {
+            std::vector<Summary> latency = std::vector<Summary>(CLIENTS * COMMANDS);
+            std::array<uint64_t, CLIENTS * COUNTERS> counters{};
+
+            inline Summary const &of(Client client, Command command) const
+            {
+                return latency[(size_t) client * COMMANDS + (size_t) command];
+            }
+
+            inline uint64_t of(Client client, Counter counter) const
+            {
+                return counters[(size_t) client * COUNTERS + (size_t) counter];
+            }
+
+            /// @brief Prometheus text exposition, latencies as summaries in
+            /// seconds with the 0.5, 0.99 and 0.999 quantiles
+            std::string prometheus() const
+            {
+                static const double QUANTILES[] = { 0.5, 0.99, 0.999 };
+                std::ostringstream out;
+                out << "# TYPE rqueue_command_duration_seconds summary\n";
+                for (size_t client = 0; client < CLIENTS; client += 1)
+                {
+                    for (size_t command = 0; command < COMMANDS; command += 1)
+                    {
+                        Summary const &sum = of((Client) client, (Command) command);
+                        if (sum.count == 0) continue;
+                        std::string labels = std::string("client=\"") + name((Client) client)
+                            + "\",command=\"" + name((Command) command) + "\"";
+                        for (double q: QUANTILES)
+                        {
+                            out << "rqueue_command_duration_seconds{" << labels
+                                << ",quantile=\"" << q << "\"} "
+                                << sum.quantile_ns(q) / 1e9 << "\n";
+                        }
+                        out << "rqueue_command_duration_seconds_sum{" << labels << "} "
+                            << sum.sum_ns / 1e9 << "\n";
+                        out << "rqueue_command_duration_seconds_count{" << labels << "} "
+                            << sum.count << "\n";
+                    }
+                }
+                for (size_t counter = 0; counter < COUNTERS; counter += 1)
+                {
+                    out << "# TYPE rqueue_" << name((Counter) counter) << "_total counter\n";
+                    for (size_t client = 0; client < CLIENTS; client += 1)
+                    {
+                        out << "rqueue_" << name((Counter) counter) << "_total{client=\""
+                            << name((Client) client) << "\"} "
+                            << of((Client) client, (Counter) counter) << "\n";
+                    }
+                }
+                return out.str();
+            }
+
+            /// @brief JSON object with one entry per client, latencies in
+            /// microseconds
+            std::string json() const
+            {
+                std::ostringstream out;
+                out << std::fixed << std::setprecision(3) << "{";
+                for (size_t client = 0; client < CLIENTS; client += 1)
+                {
+                    out << (client > 0 ? ", " : "") << "\"" << name((Client) client) << "\": {\"commands\": {";
+                    bool first = true;
+                    for (size_t command = 0; command < COMMANDS; command += 1)
+                    {
+                        Summary const &sum = of((Client) client, (Command) command);
+                        if (sum.count == 0) continue;
+                        out << (first ? "" : ", ") << "\"" << name((Command) command) << "\": {"
+                            << "\"count\": " << sum.count
+                            << ", \"sum_us\": " << sum.sum_ns / 1e3
+                            << ", \"p50_us\": " << sum.quantile_ns(0.5) / 1e3
+                            << ", \"p99_us\": " << sum.quantile_ns(0.99) / 1e3
+                            << ", \"p999_us\": " << sum.quantile_ns(0.999) / 1e3
+                            << ", \"max_us\": " << sum.max_ns / 1e3 << "}";
+                        first = false;
+                    }
+                    out << "}, \"counters\": {";
+                    for (size_t counter = 0; counter < COUNTERS; counter += 1)
+                    {
+                        out << (counter > 0 ? ", " : "") << "\"" << name((Counter) counter)
+                            << "\": " << of((Client) client, (Counter) counter);
+                    }
+                    out << "}}";
+                }
+                out << "}\n";
+                return out.str();
+            }
+        };
+
+        /// @brief Process wide registry of the per thread samples. The lock
+        /// is only taken when a thread records its first sample and when a
+        /// snapshot is taken.
+        class Registry
+        {
+            std::mutex _mtx;
+            std::vector<std::unique_ptr<ThreadStats>> _threads;
+            /// @brief Samples of exited threads, taken over by new threads
+            std::vector<ThreadStats*> _free;
+
+            struct Slot
+            {
+                Registry &registry;
+                ThreadStats *stats;
+
+                explicit Slot(Registry &reg): registry(reg), stats(reg._acquire()) {}
+                ~Slot() { registry._release(stats); }
+            };
+
+            ThreadStats *_acquire()
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                if (!_free.empty())
+                {
+                    ThreadStats *stats = _free.back();
+                    _free.pop_back();
+                    return stats;
+                }
+                _threads.push_back(std::make_unique<ThreadStats>());
+                _free.reserve(_threads.size());
+                return _threads.back().get();
+            }
+
+            void _release(ThreadStats *stats)
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                _free.push_back(stats);
+            }
+
+            public:
+            /// @brief The registry is never destroyed, so that threads
+            /// exiting after main can still release their samples
+            static Registry &instance()
+            {
+                static Registry *registry = new Registry();
+                return *registry;
+            }
+
+            /// @brief Samples of the calling thread
+            ThreadStats &local()
+            {
+                static thread_local Slot slot(*this);
+                return *slot.stats;
+            }
+
+            Snapshot snapshot()
+            {
+                Snapshot snap;
+                std::lock_guard<std::mutex> lock(_mtx);
+                for (std::unique_ptr<ThreadStats> const &thread: _threads)
+                {
+                    for (size_t client = 0; client < CLIENTS; client += 1)
+                    {
+                        for (size_t command = 0; command < COMMANDS; command += 1)
+                            snap.latency[client * COMMANDS + command].merge(thread -> latency[client][command]);
+                        for (size_t counter = 0; counter < COUNTERS; counter += 1)
+                            snap.counters[client * COUNTERS + counter] +=
+                                thread -> counters[client][counter].load(std::memory_order_relaxed);
+                    }
+                }
+                return snap;
+            }
+        };
+
+        /// @brief Records the latency of one operation
+        inline void record(Client client, Command command, std::chrono::nanoseconds took)
+        {
+            Registry::instance().local().latency[(size_t) client][(size_t) command].record(
+                (uint64_t) std::max<int64_t>(took.count(), 0));
+        }
+
+        /// @brief Adds to a counter of the calling thread
+        inline void count(Client client, Counter counter, uint64_t n = 1)
+        {
+            std::atomic<uint64_t> &value =
+                Registry::instance().local().counters[(size_t) client][(size_t) counter];
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        /// @brief Counts and latencies of all threads so far
+        inline Snapshot snapshot() { return Registry::instance().snapshot(); }
+
+        /// @brief Length of an array header or integer in RESP encoding
+        inline uint64_t resp_header_bytes(uint64_t n)
+        {
+            uint64_t digits = 1;
+            for (; n >= 10; n /= 10) digits += 1;
+            return 3 + digits;
+        }
+
+        /// @brief Length of a bulk string in RESP encoding
+        inline uint64_t resp_bulk_bytes(uint64_t len) { return resp_header_bytes(len) + len + 2; }
+
+        /// @brief Length of a command in RESP encoding, given the length of
+        /// every argument
+        template <typename Input>
+        uint64_t resp_bytes(Input first, Input last)
+        {
+            uint64_t bytes = resp_header_bytes((uint64_t) std::distance(first, last));
+            for (; first != last; ++first) bytes += resp_bulk_bytes(*first);
+            return bytes;
+        }
+
+        /// @brief Times a scope and records it on destruction
+        class Timer
+        {
+            Client _client;
+            Command _command;
+            std::chrono::steady_clock::time_point _start;
+
+            public:
+            Timer(Client client, Command command)
+            :_client(client), _command(command), _start(std::chrono::steady_clock::now())
+            {
+            }
+
+            Timer(Timer const&) = delete;
+            Timer operator=(Timer const&) = delete;
+
+            ~Timer() { record(_client, _command, std::chrono::steady_clock::now() - _start); }
+        };
+
+        enum class Format
+        {
+            PROMETHEUS,
+            JSON
+        };
+
+        /// @brief Writes a snapshot to a file, replacing it atomically so
+        /// that scrapers never read a partial file
+        inline bool write(std::string const &path, Format format)
+        {
+            Snapshot snap = snapshot();
+            std::string tmp = path + ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::trunc);
+                if (!out) return false;
+                out << ((format == Format::JSON) ? snap.json() : snap.prometheus());
+                if (!out) return false;
+            }
+            return std::rename(tmp.c_str(), path.c_str()) == 0;
+        }
+
+        /// @brief Background thread writing a snapshot to a file on every
+        /// interval and once more when stopped, e.g., for the textfile
+        /// collector of the Prometheus node exporter
+        class Exporter
+        {
+            std::string _path;
+            std::chrono::milliseconds _interval;
+            Format _format;
+            std::mutex _mtx;
+            std::condition_variable _cv;
+            bool _stopping = false;
+            std::thread _thread;
+
+            public:
+            Exporter() = delete;
+            Exporter(Exporter const&) = delete;
+            Exporter operator=(Exporter const&) = delete;
+
+            /// @param path File to write, JSON if it ends with .json and
+            /// Prometheus text otherwise unless a format is given
+            Exporter(std::string const &path, std::chrono::milliseconds interval)
+            :Exporter(path, interval,
+                (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+                    ? Format::JSON : Format::PROMETHEUS)
+            {
+            }
+
+            Exporter(std::string const &path, std::chrono::milliseconds interval, Format format)
+            :_path(path), _interval(interval), _format(format)
+            {
+                _thread = std::thread([this]()
+                {
+                    std::unique_lock<std::mutex> lock(_mtx);
+                    while (!_cv.wait_for(lock, _interval, [this]() { return _stopping; }))
+                        write(_path, _format);
+                    write(_path, _format);
+                });
+            }
+
+            ~Exporter()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(_mtx);
+                    _stopping = true;
+                }
+                _cv.notify_all();
+                if (_thread.joinable()) _thread.join();
+            }
+        };
+    } // namespace stats
+} // namespace rq
+
+#endif // STATS_H
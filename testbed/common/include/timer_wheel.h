@@ -0,0 +1,99 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rq
+{
+    /// @brief Hashed timer wheel tracking deadlines with the resolution of
+    /// one tick. Scheduling is constant time and advancing only visits the
+    /// slots of the ticks that passed, independent of the number of timers.
+    /// Timers are never cancelled, their owner ignores or reschedules ids
+    /// which fire after they were completed or extended. Not thread safe.
+    class TimerWheel
+    {
+        public:
+        typedef std::chrono::steady_clock Clock;
+
+        private:
+        struct Timer
+        {
+            uint64_t id;
+            uint64_t tick;
+        };
+
+        std::chrono::nanoseconds _resolution;
+        Clock::time_point _origin;
+        std::vector<std::vector<Timer>> _slots;
+        /// @brief Next tick whose slot has not been visited
+        uint64_t _current = 0;
+        size_t _size = 0;
+        /// @brief Ids fired by the running advance, keeps its capacity
+        std::vector<uint64_t> _fired;
+
+        uint64_t _tick_of(Clock::time_point time) const
+        {
+            if (time <= _origin) return 0;
+            return (uint64_t) ((time - _origin) / _resolution);
+        }
+
+        public:
+        /// @param resolution Length of one tick, deadlines fire up to one
+        /// tick late
+        /// @param slots Number of slots, timers further out than one turn
+        /// of the wheel stay in their slot for several turns
+        explicit TimerWheel(
+            std::chrono::nanoseconds resolution = std::chrono::milliseconds(10),
+            size_t slots = 512)
+        :_resolution(resolution.count() > 0 ? resolution : std::chrono::nanoseconds(1)),
+        _origin(Clock::now()), _slots(slots > 0 ? slots : 1)
+        {
+        }
+
+        inline size_t size() const { return _size; }
+
+        /// @brief Schedules a timer firing once the deadline has passed
+        void schedule(uint64_t id, Clock::time_point deadline)
+        {
+            // Deadlines in the past fire on the next advance
+            uint64_t tick = _tick_of(deadline) + 1;
+            if (tick < _current) tick = _current;
+            _slots[tick % _slots.size()].push_back({id, tick});
+            _size += 1;
+        }
+
+        /// @brief Fires every timer whose deadline passed before now
+        /// @param fire Called with the id of every expired timer, may
+        /// schedule new timers but must not advance the wheel
+        template <typename Fire>
+        void advance(Clock::time_point now, Fire fire)
+        {
+            uint64_t target = _tick_of(now);
+            if (target < _current) return;
+            // After a long pause every slot is visited once and fires all
+            // timers up to the target tick
+            uint64_t first = _current;
+            if (target - first >= _slots.size()) first = target - _slots.size() + 1;
+            _fired.clear();
+            for (uint64_t tick = first; tick <= target; tick += 1)
+            {
+                std::vector<Timer> &slot = _slots[tick % _slots.size()];
+                size_t kept = 0;
+                for (size_t idx = 0; idx < slot.size(); idx += 1)
+                {
+                    if (slot[idx].tick <= target) _fired.push_back(slot[idx].id);
+                    else slot[kept++] = slot[idx];
+                }
+                slot.resize(kept);
+            }
+            _current = target + 1;
+            _size -= _fired.size();
+            for (uint64_t id: _fired) fire(id);
+        }
+    };
+} // namespace rq
+
+#endif // TIMER_WHEEL_H
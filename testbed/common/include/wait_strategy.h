@@ -0,0 +1,126 @@
+#ifndef WAIT_STRATEGY_H
+#define WAIT_STRATEGY_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace rq
+{
+    /// @brief Exponential backoff for idle workers, which starts short so
+    /// that a briefly empty queue adds little latency and doubles up to a
+    /// ceiling so that a long idle queue is not polled in a tight loop
+    class Backoff
+    {
+        std::chrono::microseconds _min;
+        std::chrono::microseconds _max;
+        std::chrono::microseconds _current;
+
+        public:
+        Backoff(std::chrono::microseconds min, std::chrono::microseconds max)
+        :_min(std::max(min, std::chrono::microseconds(1))), _max(std::max(max, _min)), _current(_min)
+        {
+        }
+
+        /// @brief Delay before the next attempt, doubling on every call
+        std::chrono::microseconds next()
+        {
+            std::chrono::microseconds delay = _current;
+            _current = std::min(_current * 2, _max);
+            return delay;
+        }
+
+        /// @brief Starts over with the shortest delay once work was found
+        void reset() { _current = _min; }
+    };
+
+    /// @brief Wake up signal for idle workers, raised e.g., by a keyspace
+    /// notification subscriber whenever the main queue receives an item.
+    /// Waiters compare generations, so a signal raised between a failed
+    /// lease and the wait is not missed.
+    class Wakeup
+    {
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        uint64_t _generation = 0;
+
+        public:
+        uint64_t generation()
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            return _generation;
+        }
+
+        /// @brief Wakes all idle workers
+        void notify()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                _generation += 1;
+            }
+            _cv.notify_all();
+        }
+
+        /// @brief Waits until a signal newer than the seen generation was
+        /// raised or the timeout expires, returns the current generation
+        template <typename Rep, typename Period>
+        uint64_t wait(uint64_t seen, std::chrono::duration<Rep, Period> const &timeout)
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait_for(lock, timeout, [&]() { return _generation != seen; });
+            return _generation;
+        }
+    };
+
+    /// @brief Options of the wait strategy for idle workers
+    struct WaitOptions
+    {
+        std::chrono::microseconds min_backoff = std::chrono::microseconds(100);
+        std::chrono::microseconds max_backoff = std::chrono::milliseconds(100);
+        /// @brief Optional wake up signal, idle workers only back off while
+        /// it is not raised
+        std::shared_ptr<Wakeup> wakeup;
+    };
+
+    /// @brief Decides how long an idle worker waits before asking the
+    /// server again. Workers call busy() after finding work and idle() after
+    /// finding none, one strategy is owned by every worker thread.
+    class WaitStrategy
+    {
+        Backoff _backoff;
+        std::shared_ptr<Wakeup> _wakeup;
+        uint64_t _seen = 0;
+
+        public:
+        explicit WaitStrategy(WaitOptions const &opts = {})
+        :_backoff(opts.min_backoff, opts.max_backoff), _wakeup(opts.wakeup)
+        {
+            if (_wakeup) _seen = _wakeup -> generation();
+        }
+
+        /// @brief Work was found, the next idle period starts short again
+        void busy() { _backoff.reset(); }
+
+        /// @brief No work was found, backs off or waits for a wake up, for
+        /// at most limit e.g., the time left until a deadline
+        void idle(std::chrono::microseconds limit = std::chrono::microseconds::max())
+        {
+            std::chrono::microseconds delay = std::min(_backoff.next(), limit);
+            if (!_wakeup)
+            {
+                std::this_thread::sleep_for(delay);
+                return;
+            }
+            uint64_t generation = _wakeup -> wait(_seen, delay);
+            // Items arrived, retry right away and with short delays
+            if (generation != _seen) _backoff.reset();
+            _seen = generation;
+        }
+    };
+} // namespace rq
+
+#endif // WAIT_STRATEGY_H
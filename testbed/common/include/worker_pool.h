@@ -0,0 +1,186 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "mpmc_ring.h"
+#include "wait_strategy.h"
+
+namespace rq
+{
+    /// @brief Options for the worker pool
+    /// @tparam Duration Lease duration type of the queue client, e.g.,
+    /// uint8_t seconds for util::RedisQueue or std::chrono::seconds for
+    /// rds::Subscriber
+    template <typename Duration>
+    struct WorkerPoolOptions
+    {
+        /// @brief Threads leasing from redis, each with its own client
+        size_t fetchers = 1;
+        /// @brief Threads processing leased items
+        size_t workers = std::thread::hardware_concurrency();
+        /// @brief Maximum number of items per lease_batch call
+        size_t lease_batch = 16;
+        /// @brief Maximum number of items per complete_batch call
+        size_t ack_batch = 64;
+        /// @brief Capacity of the hand-off and completion rings
+        size_t capacity = 1024;
+        /// @brief Stop the pool once a blocking lease times out while no
+        /// items are in flight
+        bool exit_when_idle = false;
+        /// @brief How fetchers wait while items are in flight and the main
+        /// queue is empty, a wake up signal from a keyspace notifier lets
+        /// them lease new items as soon as they arrive
+        WaitOptions wait;
+        Duration lease_duration;
+        Duration lease_timeout;
+    };
+
+    /// @brief Multi threaded worker pool on top of a queue client. Fetcher
+    /// threads lease items in batches into a bounded lock free hand-off ring,
+    /// worker threads pull items from it and push them into a completion
+    /// ring once processed, which the fetchers acknowledge in batches.
+    /// @tparam Queue Queue client providing lease_batch and complete_batch,
+    /// only ever used from the fetcher thread that created it
+    template <typename Queue, typename Duration>
+    class WorkerPool
+    {
+        public:
+        typedef typename decltype(
+            std::declval<Queue&>().lease_batch(1))::value_type Item;
+        typedef std::function<std::unique_ptr<Queue>()> QueueFactory;
+        typedef std::function<void(WorkerPool&, Item const&)> ItemHandler;
+
+        private:
+        QueueFactory _make_queue;
+        WorkerPoolOptions<Duration> _opts;
+        MpmcRing<Item> _work;
+        MpmcRing<Item> _done;
+        std::atomic<bool> _stopping{false};
+        /// @brief Items leased but not yet acknowledged
+        std::atomic<size_t> _in_flight{0};
+        std::atomic<size_t> _fetchers_leasing{0};
+        std::atomic<size_t> _workers_running{0};
+
+        static void _backoff()
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        /// @brief Acknowledges up to one batch of completed items, returns
+        /// the number of acknowledged items
+        size_t _ack(Queue &q, std::vector<Item> &batch)
+        {
+            batch.clear();
+            Item item;
+            while (batch.size() < _opts.ack_batch && _done.try_pop(item))
+                batch.push_back(std::move(item));
+            if (batch.empty()) return 0;
+            q.complete_batch(batch);
+            _in_flight.fetch_sub(batch.size(), std::memory_order_acq_rel);
+            return batch.size();
+        }
+
+        void _fetch()
+        {
+            std::unique_ptr<Queue> q = _make_queue();
+            WaitStrategy wait(_opts.wait);
+            std::vector<Item> acked;
+            acked.reserve(_opts.ack_batch);
+            while (!_stopping.load(std::memory_order_acquire))
+            {
+                size_t acks = _ack(*q, acked);
+                size_t room = _work.capacity() - std::min(_work.capacity(), _work.size());
+                if (room < _opts.lease_batch)
+                {
+                    if (acks == 0) _backoff();
+                    continue;
+                }
+                // Only block on the main queue while nothing needs to be
+                // acknowledged, otherwise acks would wait for the timeout
+                bool blocking = _in_flight.load(std::memory_order_acquire) == 0;
+                std::vector<Item> leased = q -> lease_batch(
+                    _opts.lease_batch, _opts.lease_duration, _opts.lease_timeout, blocking);
+                if (leased.empty())
+                {
+                    if (blocking && _opts.exit_when_idle
+                        && _in_flight.load(std::memory_order_acquire) == 0) stop();
+                    else if (!blocking && acks == 0) wait.idle();
+                    continue;
+                }
+                wait.busy();
+                _in_flight.fetch_add(leased.size(), std::memory_order_acq_rel);
+                for (Item &item: leased)
+                    while (!_work.try_push(std::move(item))) _backoff();
+            }
+            _fetchers_leasing.fetch_sub(1, std::memory_order_acq_rel);
+            // Keep acknowledging until every worker has drained the hand-off
+            // ring and the last completions have been collected
+            while (_workers_running.load(std::memory_order_acquire) > 0 || !_done.empty())
+            {
+                if (_ack(*q, acked) == 0) _backoff();
+            }
+        }
+
+        void _work_loop(ItemHandler const &handler)
+        {
+            Item item;
+            while (true)
+            {
+                if (_work.try_pop(item))
+                {
+                    handler(*this, item);
+                    while (!_done.try_push(std::move(item))) _backoff();
+                    continue;
+                }
+                if (_fetchers_leasing.load(std::memory_order_acquire) == 0 && _work.empty()) break;
+                _backoff();
+            }
+            _workers_running.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        public:
+        WorkerPool() = delete;
+        WorkerPool(WorkerPool const&) = delete;
+        WorkerPool operator=(WorkerPool const&) = delete;
+
+        WorkerPool(QueueFactory make_queue, WorkerPoolOptions<Duration> const &opts)
+        :_make_queue(std::move(make_queue)), _opts(opts),
+        _work(opts.capacity), _done(opts.capacity)
+        {
+            _opts.fetchers = std::max<size_t>(_opts.fetchers, 1);
+            _opts.workers = std::max<size_t>(_opts.workers, 1);
+            _opts.lease_batch = std::max<size_t>(
+                std::min(_opts.lease_batch, _work.capacity()), 1);
+            _opts.ack_batch = std::max<size_t>(_opts.ack_batch, 1);
+        }
+
+        /// @brief Runs fetcher and worker threads until stop() is called,
+        /// or the queue is idle when exit_when_idle is set. Items already
+        /// leased are processed and acknowledged before run() returns.
+        void run(ItemHandler handler)
+        {
+            _stopping.store(false, std::memory_order_release);
+            _fetchers_leasing.store(_opts.fetchers, std::memory_order_release);
+            _workers_running.store(_opts.workers, std::memory_order_release);
+            std::vector<std::thread> threads;
+            threads.reserve(_opts.fetchers + _opts.workers);
+            for (size_t idx = 0; idx < _opts.fetchers; idx += 1)
+                threads.emplace_back([this]() { _fetch(); });
+            for (size_t idx = 0; idx < _opts.workers; idx += 1)
+                threads.emplace_back([this, &handler]() { _work_loop(handler); });
+            for (std::thread &thread: threads) thread.join();
+        }
+
+        /// @brief Stops leasing new items, safe to call from any thread
+        void stop() { _stopping.store(true, std::memory_order_release); }
+    };
+} // namespace rq
+
+#endif // WORKER_POOL_H
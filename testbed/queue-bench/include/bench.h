@@ -0,0 +1,114 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+
+namespace bench
+{
+    /// @brief Throughput and latency of one operation of one client
+    struct Result
+    {
+        std::string client;
+        std::string operation;
+        /// @brief Number of timed calls and of items they handled, calls of
+        /// batched operations handle several items each
+        size_t calls = 0;
+        size_t items = 0;
+        double seconds = 0;
+        double p50_us = 0;
+        double p99_us = 0;
+        double p999_us = 0;
+
+        inline double calls_per_second() const { return seconds > 0 ? calls / seconds : 0; }
+        inline double items_per_second() const { return seconds > 0 ? items / seconds : 0; }
+    };
+
+    /// @brief Records the latency of every call of an operation, samples
+    /// are kept so that tail percentiles are exact
+    class Recorder
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        std::vector<uint64_t> _samples;
+        size_t _items = 0;
+        Clock::duration _total = Clock::duration::zero();
+
+        static double _percentile(std::vector<uint64_t> const &sorted, double p)
+        {
+            if (sorted.empty()) return 0;
+            // Nearest rank on the sorted samples
+            size_t rank = (size_t) (p * sorted.size());
+            return sorted[std::min(rank, sorted.size() - 1)] / 1000.0;
+        }
+
+        public:
+        explicit Recorder(size_t calls = 0) { _samples.reserve(calls); }
+
+        /// @brief Times a single call, which returns the number of items it
+        /// handled, and passes that number on
+        template <typename Call>
+        size_t time(Call call)
+        {
+            Clock::time_point start = Clock::now();
+            size_t items = call();
+            Clock::duration took = Clock::now() - start;
+            _samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(took).count());
+            _total += took;
+            _items += items;
+            return items;
+        }
+
+        Result result(std::string const &client, std::string const &operation)
+        {
+            std::sort(_samples.begin(), _samples.end());
+            Result res;
+            res.client = client;
+            res.operation = operation;
+            res.calls = _samples.size();
+            res.items = _items;
+            res.seconds = std::chrono::duration<double>(_total).count();
+            res.p50_us = _percentile(_samples, 0.5);
+            res.p99_us = _percentile(_samples, 0.99);
+            res.p999_us = _percentile(_samples, 0.999);
+            return res;
+        }
+    };
+
+    /// @brief Writes results as a JSON array, one object per operation
+    void write_json(std::ostream &out, std::vector<Result> const &results);
+
+    /// @brief Writes results as an aligned table for humans
+    void write_table(std::ostream &out, std::vector<Result> const &results);
+
+    /// @brief redis-server child process without persistence, which is
+    /// killed when the handle is destroyed
+    class RedisServer
+    {
+        pid_t _pid = -1;
+        uint16_t _port;
+
+        public:
+        RedisServer() = delete;
+        RedisServer(RedisServer const&) = delete;
+        RedisServer operator=(RedisServer const&) = delete;
+
+        /// @brief Spawns the server and waits until it answers PING
+        /// @param port Port to listen on, should be unused
+        /// @param executable Path of redis-server, looked up in PATH by
+        /// default
+        explicit RedisServer(uint16_t port, std::string const &executable = "redis-server");
+        ~RedisServer();
+
+        inline uint16_t port() const { return _port; }
+    };
+} // namespace bench
+
+
+#endif // BENCH_H
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <iomanip>
+#include <stdexcept>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <hiredis.h>
+#include "bench.h"
+
+void bench::write_json(std::ostream &out, std::vector<Result> const &results)
+{
+    out << "[\n";
+    for (size_t idx = 0; idx < results.size(); idx += 1)
+    {
+        Result const &res = results[idx];
+        out << std::fixed << std::setprecision(3)
+            << "  {\"client\": \"" << res.client << "\""
+            << ", \"operation\": \"" << res.operation << "\""
+            << ", \"calls\": " << res.calls
+            << ", \"items\": " << res.items
+            << ", \"seconds\": " << res.seconds
+            << ", \"calls_per_second\": " << res.calls_per_second()
+            << ", \"items_per_second\": " << res.items_per_second()
+            << ", \"p50_us\": " << res.p50_us
+            << ", \"p99_us\": " << res.p99_us
+            << ", \"p999_us\": " << res.p999_us << "}"
+            << ((idx + 1 < results.size()) ? ",\n" : "\n");
+    }
+    out << "]\n";
+}
+
+void bench::write_table(std::ostream &out, std::vector<Result> const &results)
+{
+    out << std::left << std::setw(10) << "client" << std::setw(16) << "operation"
+        << std::right << std::setw(14) << "items/s" << std::setw(12) << "p50 us"
+        << std::setw(12) << "p99 us" << std::setw(12) << "p999 us" << "\n";
+    for (Result const &res: results)
+    {
+        out << std::left << std::setw(10) << res.client << std::setw(16) << res.operation
+            << std::right << std::fixed << std::setprecision(0)
+            << std::setw(14) << res.items_per_second() << std::setprecision(1)
+            << std::setw(12) << res.p50_us << std::setw(12) << res.p99_us
+            << std::setw(12) << res.p999_us << "\n";
+    }
+}
+
+bench::RedisServer::RedisServer(uint16_t port, std::string const &executable): _port(port)
+{
+    std::string port_arg = std::to_string(port);
+    _pid = fork();
+    if (_pid < 0) throw std::runtime_error("Could not fork redis-server");
+    if (_pid == 0)
+    {
+        // Persistence would add disk latency to the measurements
+        execlp(
+            executable.c_str(), executable.c_str(), 
+            "--port", port_arg.c_str(), "--bind", "127.0.0.1", 
+            "--save", "", "--appendonly", "no", "--loglevel", "warning", 
+            (char*) nullptr);
+        perror("Could not start redis-server");
+        _exit(127);
+    }
+    for (int attempt = 0; attempt < 100; attempt += 1)
+    {
+        redisContext *ctx = redisConnect("127.0.0.1", port);
+        bool ready = false;
+        if (ctx != nullptr && !ctx -> err)
+        {
+            redisReply *reply = (redisReply*) redisCommand(ctx, "PING");
+            ready = reply != nullptr && reply -> type == REDIS_REPLY_STATUS;
+            if (reply != nullptr) freeReplyObject(reply);
+        }
+        if (ctx != nullptr) redisFree(ctx);
+        if (ready) return;
+        int status = 0;
+        if (waitpid(_pid, &status, WNOHANG) == _pid)
+        {
+            _pid = -1;
+            throw std::runtime_error("redis-server exited during startup");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    kill(_pid, SIGKILL);
+    waitpid(_pid, nullptr, 0);
+    _pid = -1;
+    throw std::runtime_error("redis-server did not answer PING within 5 seconds");
+}
+
+bench::RedisServer::~RedisServer()
+{
+    if (_pid <= 0) return;
+    kill(_pid, SIGTERM);
+    waitpid(_pid, nullptr, 0);
+}
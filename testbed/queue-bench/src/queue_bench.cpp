@@ -0,0 +1,214 @@
+#include <string.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "rqueue.h"
+#include "publisher.h"
+#include "subscriber.h"
+#include "local_queue.h"
+
+namespace
+{
+    const char *QUEUE = "bench";
+
+    /// @brief Drops the keys of the previous client, script caches survive
+    void flush(util::RedisPool &pool)
+    {
+        util::RedisPool::Connection conn = pool.acquire();
+        redisReply *reply = (redisReply*) redisCommand(conn.get(), "FLUSHALL");
+        if (reply == nullptr) throw std::runtime_error("Could not flush the benchmark server");
+        freeReplyObject(reply);
+    }
+
+    void bench_hiredis(
+        uint16_t port, std::vector<std::string> const &items, size_t batch, 
+        std::vector<bench::Result> &results)
+    {
+        const std::string client = "hiredis";
+        auto pool = std::make_shared<util::RedisPool>("127.0.0.1", port, 2);
+        flush(*pool);
+        util::RedisQueue q = { QUEUE, pool };
+        q.use_arena(std::make_shared<util::ReplyArena>());
+        {
+            // Producers push with plain RPUSH commands, like producer.c
+            util::RedisPool::Connection conn = pool -> acquire();
+            bench::Recorder publish(items.size());
+            for (std::string const &item: items) publish.time([&]()
+            {
+                redisReply *reply = (redisReply*) redisCommand(
+                    conn.get(), "RPUSH %s %b", QUEUE, item.data(), item.size());
+                if (reply == nullptr) throw std::runtime_error("RPUSH failed");
+                freeReplyObject(reply);
+                return 1;
+            });
+            results.push_back(publish.result(client, "publish"));
+        }
+        bench::Recorder lease(items.size());
+        bench::Recorder complete(items.size());
+        for (size_t idx = 0; idx < items.size(); idx += 1)
+        {
+            util::Lease leased;
+            if (lease.time([&]() { leased = q.lease_item(5, 0, false); return leased ? 1 : 0; }) == 0) break;
+            complete.time([&]() { q.complete(std::move(leased)); return 1; });
+        }
+        results.push_back(lease.result(client, "lease"));
+        results.push_back(complete.result(client, "complete"));
+        {
+            util::RedisPool::Connection conn = pool -> acquire();
+            bench::Recorder publish(items.size() / batch + 1);
+            std::vector<const char*> argv;
+            std::vector<size_t> argvlen;
+            for (size_t first = 0; first < items.size(); first += batch)
+            {
+                size_t last = std::min(first + batch, items.size());
+                argv.assign({"RPUSH", QUEUE});
+                argvlen.assign({(size_t) 5, strlen(QUEUE)});
+                for (size_t idx = first; idx < last; idx += 1)
+                {
+                    argv.push_back(items[idx].data());
+                    argvlen.push_back(items[idx].size());
+                }
+                publish.time([&]()
+                {
+                    redisReply *reply = (redisReply*) redisCommandArgv(
+                        conn.get(), (int) argv.size(), argv.data(), argvlen.data());
+                    if (reply == nullptr) throw std::runtime_error("RPUSH failed");
+                    freeReplyObject(reply);
+                    return last - first;
+                });
+            }
+            results.push_back(publish.result(client, "publish_batch"));
+        }
+        bench::Recorder lease_batch(items.size() / batch + 1);
+        bench::Recorder complete_batch(items.size() / batch + 1);
+        while (true)
+        {
+            std::vector<util::LeasedItem> leased;
+            if (lease_batch.time([&]() { leased = q.lease_batch(batch, 5, 0, false); return leased.size(); }) == 0) break;
+            complete_batch.time([&]() { q.complete_batch(leased); return leased.size(); });
+        }
+        results.push_back(lease_batch.result(client, "lease_batch"));
+        results.push_back(complete_batch.result(client, "complete_batch"));
+    }
+
+    void bench_redis_plus_plus(
+        uint16_t port, std::vector<std::string> const &items, size_t batch, 
+        std::vector<bench::Result> &results)
+    {
+        const std::string client = "redis++";
+        rds::Publisher pub = rds::Publisher("127.0.0.1", port, QUEUE);
+        rds::Subscriber sub = rds::Subscriber("127.0.0.1", port, QUEUE);
+        const std::chrono::seconds duration(5);
+        const std::chrono::seconds no_wait(0);
+        bench::Recorder publish(items.size());
+        for (std::string const &item: items) publish.time([&]() { pub.publish(item); return 1; });
+        results.push_back(publish.result(client, "publish"));
+        bench::Recorder lease(items.size());
+        bench::Recorder complete(items.size());
+        for (size_t idx = 0; idx < items.size(); idx += 1)
+        {
+            sw::redis::OptionalString leased;
+            if (lease.time([&]() { leased = sub.lease(duration, no_wait, false); return leased ? 1 : 0; }) == 0) break;
+            complete.time([&]() { sub.complete(*leased); return 1; });
+        }
+        results.push_back(lease.result(client, "lease"));
+        results.push_back(complete.result(client, "complete"));
+        bench::Recorder publish_batch(items.size() / batch + 1);
+        for (size_t first = 0; first < items.size(); first += batch)
+        {
+            size_t last = std::min(first + batch, items.size());
+            publish_batch.time([&]()
+            {
+                pub.publish_batch(items.begin() + first, items.begin() + last, batch, 1);
+                return last - first;
+            });
+        }
+        results.push_back(publish_batch.result(client, "publish_batch"));
+        bench::Recorder lease_batch(items.size() / batch + 1);
+        bench::Recorder complete_batch(items.size() / batch + 1);
+        while (true)
+        {
+            std::vector<rds::LeasedItem> leased;
+            if (lease_batch.time([&]() { leased = sub.lease_batch(batch, duration, no_wait, false); return leased.size(); }) == 0) break;
+            complete_batch.time([&]() { sub.complete_batch(leased); return leased.size(); });
+        }
+        results.push_back(lease_batch.result(client, "lease_batch"));
+        results.push_back(complete_batch.result(client, "complete_batch"));
+    }
+
+    /// @brief In process baseline without a server round trip
+    void bench_local(
+        std::vector<std::string> const &items, size_t batch, 
+        std::vector<bench::Result> &results)
+    {
+        const std::string client = "local";
+        rq::LocalQueue q = rq::LocalQueue(QUEUE, items.size());
+        const std::chrono::seconds duration(5);
+        const std::chrono::seconds no_wait(0);
+        bench::Recorder publish(items.size());
+        for (std::string const &item: items) publish.time([&]() { return q.publish(item) ? 1 : 0; });
+        results.push_back(publish.result(client, "publish"));
+        bench::Recorder lease(items.size());
+        bench::Recorder complete(items.size());
+        for (size_t idx = 0; idx < items.size(); idx += 1)
+        {
+            std::optional<std::string> leased;
+            if (lease.time([&]() { leased = q.lease(duration, no_wait, false); return leased ? 1 : 0; }) == 0) break;
+            complete.time([&]() { q.complete(*leased); return 1; });
+        }
+        results.push_back(lease.result(client, "lease"));
+        results.push_back(complete.result(client, "complete"));
+        bench::Recorder publish_batch(items.size() / batch + 1);
+        for (size_t first = 0; first < items.size(); first += batch)
+        {
+            size_t last = std::min(first + batch, items.size());
+            publish_batch.time([&]()
+            {
+                return q.publish_batch(items.begin() + first, items.begin() + last);
+            });
+        }
+        results.push_back(publish_batch.result(client, "publish_batch"));
+        bench::Recorder lease_batch(items.size() / batch + 1);
+        bench::Recorder complete_batch(items.size() / batch + 1);
+        while (true)
+        {
+            std::vector<rq::LeasedItem> leased;
+            if (lease_batch.time([&]() { leased = q.lease_batch(batch, duration, no_wait, false); return leased.size(); }) == 0) break;
+            complete_batch.time([&]() { q.complete_batch(leased); return leased.size(); });
+        }
+        results.push_back(lease_batch.result(client, "lease_batch"));
+        results.push_back(complete_batch.result(client, "complete_batch"));
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t count = (argc > 1) ? std::stoul(argv[1]) : 10000;
+    const size_t batch = std::max<size_t>((argc > 2) ? std::stoul(argv[2]) : 16, 1);
+    const uint16_t port = (argc > 3) ? (uint16_t) std::stoul(argv[3]) : 6399;
+    // JSON by default so that CI can compare runs, "table" for humans
+    const std::string format = (argc > 4) ? argv[4] : "json";
+    std::vector<std::string> items;
+    items.reserve(count);
+    for (size_t idx = 0; idx < count; idx += 1) items.push_back("item-" + std::to_string(idx));
+    std::vector<bench::Result> results;
+    try
+    {
+        bench::RedisServer server(port);
+        std::cerr << "Benchmarking " << count << " items, batches of " << batch 
+            << ", redis-server on port " << port << "\n";
+        bench_hiredis(port, items, batch, results);
+        bench_redis_plus_plus(port, items, batch, results);
+        bench_local(items, batch, results);
+    }
+    catch(std::exception const &err)
+    {
+        std::cerr << "Benchmark failed: " << err.what() << "\n";
+        return 1;
+    }
+    if (format == "table") bench::write_table(std::cout, results);
+    else bench::write_json(std::cout, results);
+    return 0;
+}
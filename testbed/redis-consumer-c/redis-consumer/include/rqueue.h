@@ -4,6 +4,7 @@
 #include <string>
 #include <hiredis.h>
 #include <stdint.h>
+#include "keys.h"
 
 
 namespace util
@@ -20,20 +21,27 @@ namespace util
             std::string _session;
             std::string _main_q_name;
             std::string _processing_q_name;
+            std::string _payloads_name;
+            std::string _completed_name;
             std::string _lease_key_prefix;
+            /// Digests of the shared scripts, lease keys are derived from 
+            /// the item id on the server like in the other clients
+            std::string _lease_sha;
+            std::string _complete_sha;
+            std::string _lease_exists_sha;
 
             /// Redis command stubs
             const char *LLEN = "LLEN";
-            const char *EXISTS = "EXISTS";
-            const char *RPOPLPUSH = "RPOPLPUSH";
-            const char *BRPOPLPUSH = "BRPOPLPUSH";
-            const char *SETEX = "SETEX";
-            const char *LREM = "LREM";
-            const char *DEL = "DEL";
+            const char *BLMOVE = "BLMOVE";
+            const char *EVALSHA = "EVALSHA";
 
-            /// @brief Internal utility function to generate a unique hash value 
-            /// for the item
-            inline size_t _key_for(const char *item);
+            /// @brief Internal utility function to load a script, returns 
+            /// its digest
+            std::string _load(const char *script);
+            /// @brief Internal utility function to run a script by its 
+            /// digest, the first two arguments are filled in and the script 
+            /// is loaded again if the server does not know it
+            redisReply *_evalsha(std::string &sha, const char *script, int argc, const char **argv);
             /// @brief Internal utility function to checks if the item exists in 
             /// the redis queue of leased items 
             bool _lease_exists(const char *item);
@@ -41,10 +49,8 @@ namespace util
             /// Internal utility functions corresponding to redis 
             /// commands used in the implementation 
             size_t _llen(RedisQueue::QType _q) const;
-            void _rpoplpush(bool blocking, uint8_t timeout, char *item);
-            void _setex(const char* item, uint8_t duration);
-            void _lrem(const char* item, uint8_t count = 0);
-            void _del(const char *item);
+            void _lease(uint8_t duration, char *&item);
+            void _wait(uint8_t timeout);
         
         public:
             RedisQueue() = delete;
@@ -77,13 +83,14 @@ namespace util
             /// @brief Leases a given item from the queue, which essentially 
             /// means to pop the item from the main queue to and push to 
             /// internal processing queue.
-            /// @param item Buffer for storing the item currently in processing
+            /// @param item Set to a newly allocated copy of the item, which the 
+            /// caller frees, left untouched if no item was leased
             /// @param duration Maximum duration to keep the item in the 
             /// processing queue
             /// @param timeout Timeout for blocking the main queue
-            /// @param blocking Whether blocking variant of the RPOPLPUSH will 
-            /// be used.
-            void lease(char *item, uint8_t duration = 5, uint8_t timeout = 2, bool blocking = true);
+            /// @param blocking Whether to wait for an item if the main queue 
+            /// is empty.
+            void lease(char *&item, uint8_t duration = 5, uint8_t timeout = 2, bool blocking = true);
 
             /// @brief Marks the completion of processing a given item
             void complete(const char* item);
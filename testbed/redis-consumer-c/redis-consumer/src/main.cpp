@@ -6,7 +6,7 @@
 int main(int argc, char **argv)
 {
     std::string host_name = (argc > 1) ? argv[1] : "redis";
-    uint16_t port = (argc > 2) ? *argv[2] : 6379;
+    uint16_t port = (argc > 2) ? (uint16_t) std::stoul(argv[2]) : 6379;
     std::string queue_name = (argc > 3) ? argv[3] : "foo";
     util::RedisQueue q = { queue_name, host_name, port  };
     std::cout << "Worker with Session ID: " << q.session_id() << "\n";
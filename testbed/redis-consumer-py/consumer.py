@@ -5,6 +5,21 @@ import uuid
 import hashlib
 import time
 
+# Tag of the versioned envelope rq1:<id>:<payload>, where id is the
+# xxh3_128_hexdigest of the payload (see common/include/item_id.h)
+ENVELOPE_TAG: bytes = b"rq1:"
+ENVELOPE_HEADER_SIZE: int = 37
+
+
+def is_envelope(item: bytes) -> bool:
+    """Returns whether an item is wrapped in an envelope"""
+    return item[:4] == ENVELOPE_TAG and item[36:37] == b":"
+
+
+def payload_of(item: bytes) -> bytes:
+    """Returns the payload of an item, the item itself if it has no envelope"""
+    return item[ENVELOPE_HEADER_SIZE:] if is_envelope(item) else item
+
 
 class RQueue:
     """Encapsulates Redis object to monitor the incoming items"""
@@ -28,6 +43,7 @@ class RQueue:
         self._q_name = name
         self._processing_q_name = self._q_name + ":processing"
         self._lease_key_prefix = self._q_name + ":leased_by_session:"
+        self._completed_name = self._q_name + ":completed"
 
     def session_id(self) -> str:
         """Returns the if for the session"""
@@ -52,11 +68,17 @@ class RQueue:
 
     def _item_key(self, item: bytes) -> str:
         """Returns a string that uniquely identifies an item from the queue
+
+        NOTE: Matches the item ids of the server side scripts, so that lease
+        keys are shared with the C++ clients and the reaper. Enveloped items
+        carry their id, other items are identified by their SHA1 digest.
         
         Args:
             item: Received item from the queue as bytes
         """
-        return hashlib.sha224(item).hexdigest()
+        if is_envelope(item):
+            return item[4:36].decode("ascii")
+        return hashlib.sha1(item).hexdigest()
 
     def _lease_exists(self, item: bytes) -> int:
         """Returns True if a lease on the item exists
@@ -107,7 +129,8 @@ class RQueue:
         guaranteed that the item is processed by current worker or some other
         worker picked up the same.
         """
-        self._q.lrem(name=self._processing_q_name, count=0, value=value)
+        if self._q.lrem(name=self._processing_q_name, count=0, value=value) > 0:
+            self._q.incr(name=self._completed_name)
         item_key: str = self._item_key(item=value)
         self._q.delete(self._lease_key_prefix + item_key)
 
@@ -119,7 +142,7 @@ if __name__ == "__main__":
     while not q.empty():
         item = q.lease(lease_dur=5, blocking=True, timeout=2) 
         if item is not None:
-            item_str: str = item.decode("utf-8")
+            item_str: str = payload_of(item).decode("utf-8")
             print(f"Working on: {item_str}")
             # Here we would do some actual work instead of sleeping like 
             # executing a CUDA kernel
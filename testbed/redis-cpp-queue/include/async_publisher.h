@@ -0,0 +1,97 @@
+#ifndef ASYNC_PUBLISHER_H
+#define ASYNC_PUBLISHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "publisher.h"
+
+namespace rds
+{
+    struct AsyncPublisherOptions
+    {
+        // Items buffered in memory at most, publish blocks while it is full
+        size_t capacity = 100000;
+        // Items per RPUSH and commands per pipeline of a flush
+        size_t chunk_size = 1000;
+        size_t depth = 16;
+        // Flushing pauses once the queue holds high_watermark items and 
+        // resumes once it is down to low_watermark, zero disables the 
+        // throttle
+        size_t high_watermark = 0;
+        size_t low_watermark = 0;
+        // Time between two length checks while flushing is paused
+        std::chrono::milliseconds poll_interval{100};
+    };
+
+    // Buffers published items in memory and pushes them from a flusher 
+    // thread, which coalesces everything buffered into the pipelined 
+    // variadic RPUSH calls of publish_batch. Producers only wait while the 
+    // buffer is full, which happens when redis is slow or the queue is 
+    // above its high watermark, so that a fast producer cannot flood the 
+    // redis memory. Safe to use from several producer threads.
+    class AsyncPublisher
+    {
+        struct Pending
+        {
+            std::string item;
+            size_t priority;
+            std::promise<size_t> published;
+        };
+
+        Publisher _pub;
+        AsyncPublisherOptions _opts;
+        std::mutex _mtx;
+        // Signals producers waiting for room and callers of flush()
+        std::condition_variable _room_cv;
+        // Signals the flusher, new items or a close
+        std::condition_variable _items_cv;
+        std::deque<Pending> _buffer;
+        // Items taken by the flusher and not yet answered
+        size_t _flushing = 0;
+        bool _closing = false;
+        std::thread _flusher;
+
+        void _run();
+        // Waits while the queue is above the high watermark, until it has 
+        // drained to the low watermark
+        void _throttle();
+        // Publishes a batch with one publish_batch call per run of items of 
+        // the same priority and answers their futures
+        void _flush(std::deque<Pending> &batch);
+
+        public:
+        AsyncPublisher() = delete;
+        AsyncPublisher(AsyncPublisher const&) = delete;
+        AsyncPublisher operator=(AsyncPublisher const&) = delete;
+
+        // Takes over a configured publisher e.g., with priorities or 
+        // envelopes, which must not be used elsewhere afterwards
+        AsyncPublisher(Publisher &&pub, AsyncPublisherOptions const &opts = {});
+
+        // Flushes the buffered items before returning
+        ~AsyncPublisher();
+
+        // Buffers an item, blocks while the buffer is full. The future 
+        // receives the position publish_batch reported for the item, i.e., 
+        // the queue length right after the item was pushed. With a dedupe 
+        // window it is the number of items added by the chunk of the item
+        // instead. It holds the exception if the chunk of the item could 
+        // not be published, items of other chunks are not affected.
+        std::future<size_t> publish(std::string item, size_t priority = 0);
+
+        // Waits until every item buffered so far was published
+        void flush();
+
+        // Flushes the buffer and stops the flusher, publishing afterwards 
+        // throws
+        void close();
+    };
+} // namespace rds
+
+#endif // ASYNC_PUBLISHER_H
@@ -4,6 +4,7 @@
 #include <string>
 #include <memory>
 #include <sw/redis++/redis++.h>
+#include "cluster.h"
 
 namespace rds
 {
@@ -12,12 +13,27 @@ namespace rds
     struct RedisBase
     {
         protected:
+        // Cluster clients of the primaries and replicas, the queue calls go
+        // through clients bound to the node of the queue slot
+        std::unique_ptr<sw::redis::RedisCluster> _cluster;
+        std::unique_ptr<sw::redis::RedisCluster> _replicas;
         RedisPtr ctx;
+        // Client of the read only calls, the queue client itself unless 
+        // reads go to a replica
+        RedisPtr _reader;
         std::string _q_name;
 
+        inline sw::redis::Redis &reader() const { return _reader ? *_reader : *ctx; }
+
         public:
-        RedisBase(std::string const &host, uint16_t port, std::string const &queue)
-        :_q_name(queue)
+        // On a cluster the host is a seed node and the queue name is hash 
+        // tagged, so that all keys of the queue live in the slot of the tag 
+        // and the multi key scripts run on a single node. The slot is looked
+        // up once, moving it to another node needs a restart.
+        RedisBase(
+            std::string const &host, uint16_t port, std::string const &queue, 
+            bool cluster = false, bool replica_reads = false)
+        :_q_name(cluster ? rq::hash_tag(queue) : queue)
         {
             sw::redis::ConnectionOptions opts;
             opts.host = host;
@@ -25,7 +41,27 @@ namespace rds
             opts.db = 0;
             opts.connect_timeout = std::chrono::seconds(2);
             opts.keep_alive = true;
-            ctx = std::make_unique<sw::redis::Redis>(opts);
+            // A second connection lets background calls e.g., the lease 
+            // heartbeat run while a blocking command holds the first one
+            sw::redis::ConnectionPoolOptions pool_opts;
+            pool_opts.size = 2;
+            if (!cluster)
+            {
+                ctx = std::make_unique<sw::redis::Redis>(opts, pool_opts);
+                return;
+            }
+            _cluster = std::make_unique<sw::redis::RedisCluster>(opts, pool_opts);
+            // A new connection gives the node client a pool of its own, 
+            // without it the client wraps a single connection that the 
+            // heartbeat, prefetch and batch threads would share
+            ctx = std::make_unique<sw::redis::Redis>(_cluster -> redis(_q_name, true));
+            if (replica_reads)
+            {
+                // Replica connections are opened in READONLY mode
+                _replicas = std::make_unique<sw::redis::RedisCluster>(
+                    opts, pool_opts, sw::redis::Role::SLAVE);
+                _reader = std::make_unique<sw::redis::Redis>(_replicas -> redis(_q_name, true));
+            }
         }
 
         // Has not default constructor
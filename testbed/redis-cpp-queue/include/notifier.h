@@ -0,0 +1,46 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <sw/redis++/redis++.h>
+#include "wait_strategy.h"
+
+namespace rds
+{
+    // Subscribes to the keyspace notifications of a main queue and raises a 
+    // wake up signal for idle workers whenever an item is pushed. Requires 
+    // notify-keyspace-events to contain the K and l classes, t for streams, 
+    // configure adds them with CONFIG SET.
+    class KeyspaceNotifier
+    {
+        std::string _channel;
+        std::shared_ptr<rq::Wakeup> _wakeup;
+        std::unique_ptr<sw::redis::Redis> _redis;
+        std::atomic<bool> _stopping{false};
+        std::thread _thread;
+
+        void _configure();
+        void _run();
+
+        public:
+        // KeyspaceNotifier has not default constructor
+        KeyspaceNotifier() = delete;
+        // KeyspaceNotifier is not copyable
+        KeyspaceNotifier(KeyspaceNotifier const&) = delete;
+        KeyspaceNotifier operator=(KeyspaceNotifier const&) = delete;
+
+        KeyspaceNotifier(
+            std::string const &host, uint16_t port, std::string const &queue, 
+            bool configure = false, 
+            std::shared_ptr<rq::Wakeup> wakeup = std::make_shared<rq::Wakeup>());
+
+        ~KeyspaceNotifier();
+
+        inline std::shared_ptr<rq::Wakeup> wakeup() const { return _wakeup; }
+    };
+} // namespace rds
+
+#endif // NOTIFIER_H
@@ -1,12 +1,68 @@
 #ifndef PUBLISHER_H
 #define PUBLISHER_H
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include "base.h"
+#include "keys.h"
+#include "priority.h"
+#include "scripts.h"
+#include "item_id.h"
 
 namespace rds
 {
     class Publisher: protected RedisBase
     {
+        // Stream consumers read entries of the stream instead of the main 
+        // queue, empty for the other layouts
+        std::string _stream_name;
+        // Number of priority levels, items of every level are published 
+        // with a script ringing the doorbell of the queue
+        size_t _levels = 1;
+        std::string _doorbell_name;
+        // Items are wrapped in an envelope carrying their id
+        bool _envelopes = false;
+        // Items whose id was published within the window are dropped, the 
+        // window is passed to the script in milliseconds
+        std::chrono::milliseconds _dedupe_window{0};
+        std::string _window_arg;
+        std::string _dedupe_name;
+        // Script publishing the items of priority queues or dropping 
+        // duplicates, null while items are pushed directly
+        const char *_publish_script = nullptr;
+        std::string _publish_sha;
+
+        // Key of the level of a priority, throws for unknown levels
+        std::string _level_name(size_t priority) const;
+        void _load_script();
+        // Keys of the publish script for a level
+        std::vector<std::string> _script_keys(size_t priority) const;
+
+        // Runs the publish script in a pipeline, reloading the script once 
+        // if the server script cache was flushed
+        template <typename Call>
+        void _with_script(Call call);
+        // Sends a pipeline. With failures, an error is kept in error instead 
+        // of thrown and no replies are returned, so that it only fails the 
+        // items of this pipeline.
+        std::optional<sw::redis::QueuedReplies> _send(
+            sw::redis::Pipeline &pipe, std::vector<std::exception_ptr> const *failures, 
+            std::exception_ptr &error);
+        // Reply of a command of a sent pipeline. With failures, an error reply 
+        // is kept in error and a default value returned, so that it only 
+        // fails the items of this command. Nothing is read once error is set.
+        template <typename Result>
+        Result _reply_of(
+            std::optional<sw::redis::QueuedReplies> &replies, size_t idx, 
+            std::vector<std::exception_ptr> const *failures, std::exception_ptr &error);
+
         public:
         // Subscriber has not default constructor
         Publisher() = delete;
@@ -17,12 +73,241 @@ namespace rds
         Publisher(Publisher &&) = default;
         Publisher& operator=(Publisher &&) = default;
 
-        Publisher(std::string const &host, uint16_t port, std::string const &queue);
+        // On a cluster the host is a seed node and the queue name is hash 
+        // tagged like the subscribers tag it
+        Publisher(
+            std::string const &host, uint16_t port, std::string const &queue, 
+            rq::Layout layout = rq::Layout::LIST, bool cluster = false);
 
         ~Publisher() {};
 
-        size_t publish(std::string const &item);
+        // Publishes to levels 0 to levels - 1 of a priority queue, level 0 
+        // is the main queue. Must match the levels of the subscribers, not 
+        // supported by the stream layout.
+        void use_priorities(size_t levels);
+
+        // Wraps every item in an rq1 envelope carrying the XXH3 128 bit id 
+        // of its payload, so that the scripts neither hash payloads on the 
+        // server nor disagree with other clients about item ids. With a 
+        // dedupe window, items whose id was published within the window are
+        // dropped and publishing returns the number of items added. Dropping 
+        // duplicates is not supported by the stream layout.
+        void use_envelopes(
+            std::chrono::milliseconds dedupe_window = std::chrono::milliseconds(0));
+
+        size_t publish(std::string const &item, size_t priority = 0);
+
+        // Items waiting in the queue summed over the priority levels, the 
+        // entries of the stream for the stream layout
+        size_t length() const;
+
+        // Publishes the items with variadic RPUSH commands of up to chunk_size 
+        // items each, flushing the pipeline after depth commands. Returns the 
+        // queue length after the last chunk. Streams receive one XADD per 
+        // item and return the number of entries added. Priority queues 
+        // receive one script call per chunk, which returns the length of 
+        // the level. With a dedupe window the number of items added is 
+        // returned instead.
+        // If given, positions receives one value per item, derived from the 
+        // reply of its chunk: the queue (or level) length right after the 
+        // item was pushed, i.e., its position counted from the head when it 
+        // was added, or the running count of entries added for streams. With 
+        // a dedupe window it is the number of items its chunk added, not a 
+        // position, since the reply does not tell which items were dropped.
+        // If given, failures receives one entry per item as well and a 
+        // failed command no longer ends the batch: the items of its chunk 
+        // get its exception and position 0, all other items a null entry, 
+        // and the following chunks are still published.
+        template <typename Input>
+        size_t publish_batch(
+            Input first, Input last, size_t chunk_size = 1000, size_t depth = 16, 
+            size_t priority = 0, std::vector<size_t> *positions = nullptr, 
+            std::vector<std::exception_ptr> *failures = nullptr);
+
+        template <typename Range>
+        size_t publish_batch(
+            Range const &items, size_t chunk_size = 1000, size_t depth = 16, 
+            size_t priority = 0, std::vector<size_t> *positions = nullptr, 
+            std::vector<std::exception_ptr> *failures = nullptr)
+        {
+            return publish_batch(
+                std::begin(items), std::end(items), chunk_size, depth, priority, 
+                positions, failures);
+        }
     };
+
+    template <typename Call>
+    void Publisher::_with_script(Call call)
+    {
+        try
+        {
+            call();
+        }
+        catch(sw::redis::ReplyError const &err)
+        {
+            // A flushed script cache fails every call of the pipeline, so 
+            // that no item was published
+            if (std::string(err.what()).rfind("NOSCRIPT", 0) != 0) throw;
+            _publish_sha = ctx -> script_load(_publish_script);
+            call();
+        }
+    }
+
+    template <typename Result>
+    Result Publisher::_reply_of(
+        std::optional<sw::redis::QueuedReplies> &replies, size_t idx, 
+        std::vector<std::exception_ptr> const *failures, std::exception_ptr &error)
+    {
+        if (error) return Result();
+        try
+        {
+            return replies -> template get<Result>(idx);
+        }
+        catch(sw::redis::ReplyError const &err)
+        {
+            // A flushed script cache is passed on, the pipeline is sent again
+            if (failures == nullptr || std::string(err.what()).rfind("NOSCRIPT", 0) == 0) throw;
+            error = std::current_exception();
+        }
+        return Result();
+    }
+
+    template <typename Input>
+    size_t Publisher::publish_batch(
+        Input first, Input last, size_t chunk_size, size_t depth, size_t priority, 
+        std::vector<size_t> *positions, std::vector<std::exception_ptr> *failures)
+    {
+        chunk_size = std::max<size_t>(chunk_size, 1);
+        depth = std::max<size_t>(depth, 1);
+        size_t length = 0;
+        if (_levels == 1 && priority > 0) throw std::runtime_error("Priority level out of range");
+        // Envelopes of the items in flight, a deque keeps them in place for 
+        // the views queued in the pipeline
+        std::deque<std::string> envelopes;
+        auto value = [&](auto const &item) -> sw::redis::StringView
+        {
+            if (!_envelopes) return item;
+            envelopes.push_back(rq::envelope(item));
+            return envelopes.back();
+        };
+        // Outcome of the count items of a command, position 0 if it failed
+        auto settle = [&](size_t count, size_t reply, bool running, std::exception_ptr error)
+        {
+            for (size_t item = 0; item < count; item += 1)
+            {
+                if (positions != nullptr) 
+                    positions -> push_back(error ? 0 : running ? reply : reply - (count - 1 - item));
+                if (failures != nullptr) failures -> push_back(error);
+            }
+        };
+        if (!_stream_name.empty())
+        {
+            std::pair<sw::redis::StringView, sw::redis::StringView> entry[1];
+            entry[0].first = rq::STREAM_FIELD;
+            while (first != last)
+            {
+                sw::redis::Pipeline pipe = ctx -> pipeline(false);
+                size_t queued = 0;
+                for (; queued < depth * chunk_size && first != last; queued += 1)
+                {
+                    entry[0].second = value(*first);
+                    pipe.xadd(_stream_name, "*", entry, entry + 1);
+                    ++first;
+                }
+                std::exception_ptr sent;
+                std::optional<sw::redis::QueuedReplies> replies = _send(pipe, failures, sent);
+                for (size_t idx = 0; idx < queued; idx += 1)
+                {
+                    std::exception_ptr error = sent;
+                    _reply_of<std::string>(replies, idx, failures, error);
+                    if (!error) length += 1;
+                    settle(1, length, true, error);
+                }
+                envelopes.clear();
+            }
+            return length;
+        }
+        std::vector<sw::redis::StringView> chunk;
+        if (_publish_script != nullptr)
+        {
+            // Script arguments are unpacked onto the Lua stack, which only 
+            // holds a few thousand values
+            chunk_size = std::min<size_t>(chunk_size, 4096);
+            std::vector<std::string> keys = _script_keys(priority);
+            chunk.reserve(chunk_size + 1);
+            bool dedupe = _dedupe_window.count() > 0;
+            while (first != last)
+            {
+                // Items of the whole pipeline are copied, so that it can be 
+                // sent again after a reload
+                std::vector<std::vector<std::string>> chunks;
+                for (size_t queued = 0; queued < depth && first != last; queued += 1)
+                {
+                    chunks.emplace_back();
+                    for (; chunks.back().size() < chunk_size && first != last; ++first)
+                        chunks.back().emplace_back(
+                            _envelopes ? rq::envelope(*first) : std::string(*first));
+                }
+                _with_script([&]()
+                {
+                    sw::redis::Pipeline pipe = ctx -> pipeline(false);
+                    for (std::vector<std::string> const &items: chunks)
+                    {
+                        chunk.clear();
+                        if (dedupe) chunk.emplace_back(_window_arg);
+                        chunk.insert(chunk.end(), items.begin(), items.end());
+                        pipe.evalsha(_publish_sha, keys.begin(), keys.end(), chunk.begin(), chunk.end());
+                    }
+                    std::exception_ptr sent;
+                    std::optional<sw::redis::QueuedReplies> replies = _send(pipe, failures, sent);
+                    // Priority scripts reply with the length of the level, 
+                    // dedupe scripts with the number of items added. All 
+                    // replies are read before any outcome is recorded, since 
+                    // NOSCRIPT sends the pipeline again.
+                    std::vector<long long> counts(chunks.size(), 0);
+                    std::vector<std::exception_ptr> errors(chunks.size(), sent);
+                    for (size_t idx = 0; idx < chunks.size(); idx += 1)
+                        counts[idx] = _reply_of<long long>(replies, idx, failures, errors[idx]);
+                    for (size_t idx = 0; idx < chunks.size(); idx += 1)
+                    {
+                        if (!errors[idx]) length = dedupe ? length + counts[idx] : counts[idx];
+                        settle(chunks[idx].size(), counts[idx], dedupe, errors[idx]);
+                    }
+                });
+            }
+            return length;
+        }
+        chunk.reserve(chunk_size);
+        // Number of items of every chunk in the pipeline
+        std::vector<size_t> counts;
+        while (first != last)
+        {
+            sw::redis::Pipeline pipe = ctx -> pipeline(false);
+            counts.clear();
+            for (size_t queued = 0; queued < depth && first != last; queued += 1)
+            {
+                // Views stay valid until exec, the pipeline copies arguments 
+                // into its buffer when a command is queued
+                chunk.clear();
+                for (; chunk.size() < chunk_size && first != last; ++first)
+                    chunk.emplace_back(value(*first));
+                pipe.rpush(_q_name, chunk.begin(), chunk.end());
+                counts.push_back(chunk.size());
+            }
+            std::exception_ptr sent;
+            std::optional<sw::redis::QueuedReplies> replies = _send(pipe, failures, sent);
+            envelopes.clear();
+            // Each RPUSH replies with the length after its last item
+            for (size_t idx = 0; idx < counts.size(); idx += 1)
+            {
+                std::exception_ptr error = sent;
+                size_t reply = _reply_of<long long>(replies, idx, failures, error);
+                if (!error) length = reply;
+                settle(counts[idx], reply, false, error);
+            }
+        }
+        return length;
+    }
 } // namespace rds
 
 #endif // PUBLISHER
\ No newline at end of file
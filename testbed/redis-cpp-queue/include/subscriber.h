@@ -3,18 +3,77 @@
 
 #include <chrono>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "base.h"
+#include "keys.h"
+#include "scripts.h"
+#include "heartbeat.h"
+#include "priority.h"
 
 namespace rds
 {
+    struct LeasedItem
+    {
+        std::string item;
+        std::string lease_key;
+    };
+
     class Subscriber: protected RedisBase
     {
         std::string _proc_q_name;
+        std::string _payloads_name;
         std::string _session;
         std::string _lease_key_pref;
+        // Counter of completed items, read by the inspector
+        std::string _completed_name;
+        rq::Layout _layout;
+        // Consumer group of the stream layout
+        std::string _group;
+        // Last entry id seen by a failed stream lease, blocking reads wait 
+        // for entries after it
+        std::string _stream_cursor;
+        // Entry id from which the next stream lease claims idle entries
+        std::string _claim_cursor = "0-0";
+        // Entry ids of the items leased through lease(), since complete() 
+        // only receives the item. Equal items leased more than once keep one 
+        // entry each, and completing the item acknowledges one of them.
+        std::unordered_multimap<std::string, std::string> _stream_ids;
+        const char *_lease_script;
+        const char *_complete_script;
+        std::string _lease_sha;
+        std::string _complete_sha;
+        std::string _release_sha;
+        // Digests are the same on every node, but replicas load scripts 
+        // into their own cache
+        mutable std::string _lease_exist_sha;
+        mutable std::string _depth_sha;
+        // Priority levels leased from, a single level leases from the main 
+        // queue only. Level keys are kept from the highest to the lowest.
+        rq::PrioritySchedule _priorities;
+        std::vector<std::string> _level_names;
+        std::string _doorbell_name;
+        uint64_t _priority_ticket = 0;
+        // Declared last, so that the heartbeat thread stops first
+        std::unique_ptr<rq::Heartbeat> _heartbeat;
 
-        inline size_t _key_for(std::string const &item) const;
-        bool _lease_exist(std::string const &item) const;
+        bool _lease_exist(std::string const &item);
+        void _create_group();
+        void _ack(std::vector<sw::redis::StringView> const &ids);
+        // Keys and arguments are braced lists, or vectors where their number 
+        // is only known at runtime
+        template <
+            typename Result, 
+            typename Keys = std::initializer_list<sw::redis::StringView>, 
+            typename Args = std::initializer_list<sw::redis::StringView>>
+        Result _evalsha(
+            std::string &sha, const char *script, Keys const &keys, Args const &args, 
+            sw::redis::Redis *client = nullptr) const;
+        std::vector<std::string> _lease(size_t count, std::chrono::seconds const &duration);
+        template <typename Attempt>
+        bool _await(std::chrono::seconds const &timeout, Attempt attempt);
 
         public:
         // Subscriber has not default constructor
@@ -26,17 +85,51 @@ namespace rds
         Subscriber(Subscriber &&) = default;
         Subscriber& operator=(Subscriber &&) = default;
 
-        Subscriber(std::string const &host, uint16_t port, std::string const &queue);
+        // On a cluster the host is a seed node and the queue name is hash 
+        // tagged. Replica reads send depth and lease checks to a replica of
+        // the queue slot, which may lag slightly behind the primary.
+        Subscriber(
+            std::string const &host, uint16_t port, std::string const &queue, 
+            rq::Layout layout = rq::Layout::LIST, bool cluster = false, 
+            bool replica_reads = false);
 
         ~Subscriber() {};
 
         inline std::string session() const { return _session; }
-        bool empty() const;
+        // Items waiting and in processing, read in one atomic snapshot
+        rq::QueueDepth depth() const;
+        // No item is waiting and no item is in processing
+        inline bool empty() const { return depth().empty(); }
         sw::redis::OptionalString lease(
             std::chrono::seconds const &duration = std::chrono::seconds(5), 
             std::chrono::seconds const &timeout = std::chrono::seconds(2), 
             bool blocking = true);
+        std::vector<LeasedItem> lease_batch(
+            size_t n,
+            std::chrono::seconds const &duration = std::chrono::seconds(5), 
+            std::chrono::seconds const &timeout = std::chrono::seconds(2), 
+            bool blocking = true);
         void complete(std::string const &item);
+        void complete_batch(std::vector<LeasedItem> const &items);
+        // Gives leased items back to the main queue before their leases 
+        // expire, e.g., items leased ahead but never started. Items taken 
+        // over by another session are left alone, stream entries become 
+        // claimable by the next lease. Returns the number given back.
+        size_t release_batch(std::vector<LeasedItem> const &items);
+        // Extends all leases held by this subscriber from a background 
+        // thread until their items are completed, on_lost is called with 
+        // the item and lease key of leases which expired in between
+        void start_heartbeat(
+            std::chrono::seconds const &duration, 
+            std::chrono::milliseconds const &interval, 
+            rq::Heartbeat::LostHandler on_lost = {});
+        bool lease_held(std::string const &lease_key) const;
+        // Leases from several priority levels, the highest non-empty level 
+        // first, and waits on the doorbell of the queue while all levels 
+        // are empty. Weights give every level from level 0 a share of the 
+        // leases, empty weights select strict priorities. Must be called 
+        // before the first lease, not supported by the stream layout.
+        void use_priorities(size_t levels, std::vector<unsigned> const &weights = {});
     };
 } // namespace rds
 
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "async_publisher.h"
+
+rds::AsyncPublisher::AsyncPublisher(Publisher &&pub, AsyncPublisherOptions const &opts)
+:_pub(std::move(pub)), _opts(opts)
+{
+    _opts.capacity = std::max<size_t>(_opts.capacity, 1);
+    _opts.chunk_size = std::max<size_t>(_opts.chunk_size, 1);
+    _opts.depth = std::max<size_t>(_opts.depth, 1);
+    _opts.low_watermark = std::min(_opts.low_watermark, _opts.high_watermark);
+    _flusher = std::thread([this]() { _run(); });
+}
+
+rds::AsyncPublisher::~AsyncPublisher()
+{
+    close();
+}
+
+std::future<size_t> rds::AsyncPublisher::publish(std::string item, size_t priority)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    // Items being flushed still count, so that the buffer never holds more 
+    // than its capacity
+    _room_cv.wait(lock, [&]() { return _buffer.size() + _flushing < _opts.capacity || _closing; });
+    if (_closing) throw std::runtime_error("Publishing to a closed publisher");
+    _buffer.push_back({ std::move(item), priority, std::promise<size_t>() });
+    std::future<size_t> published = _buffer.back().published.get_future();
+    _items_cv.notify_one();
+    return published;
+}
+
+void rds::AsyncPublisher::flush()
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    _room_cv.wait(lock, [&]() { return _buffer.empty() && _flushing == 0; });
+}
+
+void rds::AsyncPublisher::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _closing = true;
+        _items_cv.notify_all();
+        _room_cv.notify_all();
+    }
+    if (_flusher.joinable()) _flusher.join();
+}
+
+void rds::AsyncPublisher::_run()
+{
+    // Coalesces at most one pipeline of full chunks per flush
+    size_t limit = _opts.chunk_size * _opts.depth;
+    std::deque<Pending> batch;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _items_cv.wait(lock, [&]() { return !_buffer.empty() || _closing; });
+            // Closing only ends the flusher once the buffer was drained
+            if (_buffer.empty()) break;
+            size_t count = std::min(_buffer.size(), limit);
+            std::move(_buffer.begin(), _buffer.begin() + count, std::back_inserter(batch));
+            _buffer.erase(_buffer.begin(), _buffer.begin() + count);
+            _flushing = count;
+        }
+        bool checked = false;
+        try
+        {
+            _throttle();
+            checked = true;
+        }
+        catch(...)
+        {
+            // The length could not be read, the batch fails as a whole
+            for (Pending &pending: batch) 
+                pending.published.set_exception(std::current_exception());
+        }
+        if (checked) _flush(batch);
+        batch.clear();
+        std::lock_guard<std::mutex> lock(_mtx);
+        _flushing = 0;
+        _room_cv.notify_all();
+    }
+}
+
+void rds::AsyncPublisher::_throttle()
+{
+    if (_opts.high_watermark == 0 || _pub.length() < _opts.high_watermark) return;
+    // Producers block on the full buffer meanwhile. A close publishes what
+    // is left without waiting for consumers, which may be gone already.
+    while (_pub.length() > _opts.low_watermark)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_items_cv.wait_for(lock, _opts.poll_interval, [&]() { return _closing; })) return;
+    }
+}
+
+void rds::AsyncPublisher::_flush(std::deque<Pending> &batch)
+{
+    std::vector<std::string> items;
+    std::vector<size_t> positions;
+    std::vector<std::exception_ptr> failures;
+    auto first = batch.begin();
+    while (first != batch.end())
+    {
+        size_t priority = first -> priority;
+        auto last = std::find_if(first, batch.end(), [&](Pending const &pending) 
+        { 
+            return pending.priority != priority; 
+        });
+        items.clear();
+        for (auto pending = first; pending != last; ++pending) 
+            items.push_back(std::move(pending -> item));
+        // A failed chunk only fails the futures of its items, so that a 
+        // producer retrying them does not publish the others twice. An error
+        // ending the run e.g., a script that cannot be reloaded fails the 
+        // items without an outcome yet.
+        std::exception_ptr error;
+        positions.clear();
+        failures.clear();
+        try
+        {
+            _pub.publish_batch(
+                items, _opts.chunk_size, _opts.depth, priority, &positions, &failures);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+        for (size_t idx = 0; first != last; ++first, idx += 1)
+        {
+            if (idx >= failures.size()) first -> published.set_exception(error);
+            else if (failures[idx]) first -> published.set_exception(failures[idx]);
+            else first -> published.set_value(positions[idx]);
+        }
+    }
+}
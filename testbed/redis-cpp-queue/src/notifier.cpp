@@ -0,0 +1,74 @@
+#include <iostream>
+#include "notifier.h"
+#include "keyspace.h"
+
+rds::KeyspaceNotifier::KeyspaceNotifier(
+    std::string const &host, uint16_t port, std::string const &queue, 
+    bool configure, std::shared_ptr<rq::Wakeup> wakeup)
+:_channel(rq::keyspace::channel(queue)), _wakeup(std::move(wakeup))
+{
+    sw::redis::ConnectionOptions opts;
+    opts.host = host;
+    opts.port = port;
+    opts.db = 0;
+    opts.connect_timeout = std::chrono::seconds(2);
+    // Consuming times out regularly, so that the destructor does not wait 
+    // for the next notification
+    opts.socket_timeout = std::chrono::milliseconds(100);
+    opts.keep_alive = true;
+    _redis = std::make_unique<sw::redis::Redis>(opts);
+    if (configure) _configure();
+    _thread = std::thread([this]() { _run(); });
+}
+
+rds::KeyspaceNotifier::~KeyspaceNotifier()
+{
+    _stopping = true;
+    if (_thread.joinable()) _thread.join();
+}
+
+void rds::KeyspaceNotifier::_configure()
+{
+    std::vector<std::string> current = _redis -> command<std::vector<std::string>>(
+        "CONFIG", "GET", "notify-keyspace-events");
+    std::string flags = (current.size() == 2) ? current[1] : "";
+    std::string required = rq::keyspace::with_queue_events(flags);
+    if (required != flags)
+        _redis -> command<std::string>("CONFIG", "SET", "notify-keyspace-events", required);
+}
+
+void rds::KeyspaceNotifier::_run()
+{
+    while (!_stopping)
+    {
+        try
+        {
+            sw::redis::Subscriber sub = _redis -> subscriber();
+            sub.on_message([this](std::string channel, std::string event)
+            {
+                (void) channel;
+                if (rq::keyspace::is_push(event)) _wakeup -> notify();
+            });
+            sub.subscribe(_channel);
+            // Pushes may have been missed while disconnected
+            _wakeup -> notify();
+            while (!_stopping)
+            {
+                try
+                {
+                    sub.consume();
+                }
+                catch(sw::redis::TimeoutError const&)
+                {
+                    continue;
+                }
+            }
+        }
+        catch(sw::redis::Error const &err)
+        {
+            // Idle workers fall back to their backoff until resubscribed
+            std::cout << "Keyspace notifications lost: " << err.what() << "\n";
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+}
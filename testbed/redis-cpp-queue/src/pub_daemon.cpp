@@ -1,19 +1,177 @@
 #include <iostream>
 #include <unistd.h>
+#include <getopt.h>
 #include "publisher.h"
+#include "async_publisher.h"
+#include "keys.h"
+#include "sharded_queue.h"
+#include "cli.h"
 
-int main(int argc, const char** argv)
+// Options of the publisher, every mode is selected by its own option
+static const char *USAGE = 
+    "Usage: pub_daemon [options]\n"
+    "  -H, --host HOST          redis server, cluster seed node, or comma separated\n"
+    "                           servers of the shards\n"
+    "  -p, --port PORT          redis port, default 8888\n"
+    "  -q, --queue NAME         queue name, default foo\n"
+    "  -c, --count N            number of items, default 15\n"
+    "      --chunk N            publish in throughput mode with N items per RPUSH\n"
+    "      --depth N            RPUSH commands per pipeline, default 16\n"
+    "  -l, --layout LAYOUT      list, zset or stream, default list\n"
+    "      --levels N           number of priority levels, default 1\n"
+    "      --priority P         level the items are published to, default 0\n"
+    "      --shards N           spread the items over N shards\n"
+    "      --shard-by-hash      route items by their hash instead of round robin\n"
+    "      --cluster            the host is a seed node of a redis cluster\n"
+    "      --dedupe MS          wrap items in envelopes and drop duplicates published\n"
+    "                           within MS milliseconds, zero keeps duplicates\n"
+    "      --high-watermark N   publish through a buffer flushed in the background,\n"
+    "                           pausing while the queue holds N items or more\n"
+    "      --low-watermark N    queue length flushing resumes at, default half of\n"
+    "                           the high watermark\n"
+    "  -h, --help               show this help\n";
+
+int main(int argc, char** argv)
 {
-    const std::string host = (argc > 1) ? argv[1] : "localhost";
-    const uint16_t port = (argc > 2) ? *argv[2] : 8888;
-    const std::string queue = (argc > 3) ? argv[3] : "foo";
-    rds::Publisher pub = rds::Publisher(host, port, queue);
-    for(size_t idx = 1; idx <= 15; idx += 1)
+    std::string host = "localhost";
+    uint16_t port = 8888;
+    std::string queue = "foo";
+    size_t count = 15;
+    // Throughput mode is enabled by a non zero chunk size
+    size_t chunk = 0;
+    size_t depth = 16;
+    rq::Layout layout = rq::Layout::LIST;
+    // Items are published to one level of a queue with the given number of
+    // priority levels
+    size_t levels = 1;
+    size_t priority = 0;
+    // Spreads the items over shards round robin, or by item hash, the host 
+    // may be a comma separated list of servers holding the shards in turn
+    size_t shards = 1;
+    rq::ShardPolicy policy = rq::ShardPolicy::ROUND_ROBIN;
+    bool cluster = false;
+    // Items are wrapped in an envelope carrying their id if a dedupe window
+    // in milliseconds is given, zero keeps every duplicate
+    bool envelopes = false;
+    std::chrono::milliseconds dedupe_window(0);
+    // Publishes through a buffer flushed in the background if a high 
+    // watermark is given, flushing pauses while the queue holds more items 
+    // until it has drained to the low watermark, zero never pauses
+    bool buffered = false;
+    size_t high_watermark = 0;
+    bool has_low_watermark = false;
+    size_t low_watermark = 0;
+    enum { 
+        CHUNK = 256, DEPTH, LEVELS, PRIORITY, SHARDS, SHARD_BY_HASH, CLUSTER, DEDUPE, 
+        HIGH_WATERMARK, LOW_WATERMARK };
+    const option options[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "queue", required_argument, nullptr, 'q' },
+        { "count", required_argument, nullptr, 'c' },
+        { "chunk", required_argument, nullptr, CHUNK },
+        { "depth", required_argument, nullptr, DEPTH },
+        { "layout", required_argument, nullptr, 'l' },
+        { "levels", required_argument, nullptr, LEVELS },
+        { "priority", required_argument, nullptr, PRIORITY },
+        { "shards", required_argument, nullptr, SHARDS },
+        { "shard-by-hash", no_argument, nullptr, SHARD_BY_HASH },
+        { "cluster", no_argument, nullptr, CLUSTER },
+        { "dedupe", required_argument, nullptr, DEDUPE },
+        { "high-watermark", required_argument, nullptr, HIGH_WATERMARK },
+        { "low-watermark", required_argument, nullptr, LOW_WATERMARK },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 } };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "H:p:q:c:l:h", options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host = optarg; break;
+            case 'p': port = rq::cli::port(optarg); break;
+            case 'q': queue = optarg; break;
+            case 'c': count = rq::cli::number("count", optarg); break;
+            case CHUNK: chunk = rq::cli::number("chunk", optarg); break;
+            case DEPTH: depth = rq::cli::number("depth", optarg); break;
+            case 'l': layout = rq::layout_from(optarg); break;
+            case LEVELS: levels = rq::cli::number("levels", optarg); break;
+            case PRIORITY: priority = rq::cli::number("priority", optarg); break;
+            case SHARDS: shards = rq::cli::number("shards", optarg); break;
+            case SHARD_BY_HASH: policy = rq::ShardPolicy::HASH; break;
+            case CLUSTER: cluster = true; break;
+            case DEDUPE:
+                envelopes = true;
+                dedupe_window = std::chrono::milliseconds(rq::cli::number("dedupe", optarg));
+                break;
+            case HIGH_WATERMARK:
+                buffered = true;
+                high_watermark = rq::cli::number("high-watermark", optarg);
+                break;
+            case LOW_WATERMARK:
+                has_low_watermark = true;
+                low_watermark = rq::cli::number("low-watermark", optarg);
+                break;
+            case 'h':
+                std::cout << USAGE;
+                return EXIT_SUCCESS;
+            default:
+                std::cout << USAGE;
+                return EXIT_FAILURE;
+        }
+    }
+    if (!has_low_watermark) low_watermark = high_watermark / 2;
+    auto run = [&](auto &pub)
+    {
+        if (chunk > 0)
+        {
+            std::vector<std::string> items;
+            items.reserve(count);
+            for(size_t idx = 1; idx <= count; idx += 1)
+                items.push_back("WorkItem-" + std::to_string(idx));
+            size_t length = pub.publish_batch(items, chunk, depth, priority);
+            std::cout << "Published " << count << " items, queue length: " << length << "\n";
+            return EXIT_SUCCESS;
+        }
+        for(size_t idx = 1; idx <= count; idx += 1)
+        {
+            std::string stub = "WorkItem";
+            pub.publish(stub + "-" + std::to_string(idx), priority);
+            std::cout << "Publishing: " << stub + "-" + std::to_string(idx) << "\n";
+            sleep(1);
+        }
+        return EXIT_SUCCESS;
+    };
+    if (shards > 1)
+    {
+        std::vector<std::string> hosts = rq::list_from(host);
+        std::vector<std::unique_ptr<rds::Publisher>> pubs;
+        for (size_t shard = 0; shard < shards; shard += 1)
+        {
+            pubs.push_back(std::make_unique<rds::Publisher>(
+                hosts[shard % hosts.size()], port, rq::shard_name(queue, shard), layout, cluster));
+            if (levels > 1) pubs.back() -> use_priorities(levels);
+            if (envelopes) pubs.back() -> use_envelopes(dedupe_window);
+        }
+        rq::ShardedPublisher<rds::Publisher> pub = { std::move(pubs), policy };
+        return run(pub);
+    }
+    rds::Publisher pub = rds::Publisher(host, port, queue, layout, cluster);
+    if (levels > 1) pub.use_priorities(levels);
+    if (envelopes) pub.use_envelopes(dedupe_window);
+    if (buffered)
     {
-        std::string stub = "WorkItem";
-        pub.publish(stub + "-" + std::to_string(idx));
-        std::cout << "Publishing: " << stub + "-" + std::to_string(idx) << "\n";
-        sleep(1);
+        rds::AsyncPublisherOptions opts;
+        if (chunk > 0) opts.chunk_size = chunk;
+        opts.depth = depth;
+        opts.high_watermark = high_watermark;
+        opts.low_watermark = low_watermark;
+        rds::AsyncPublisher buffer = { std::move(pub), opts };
+        std::future<size_t> last;
+        for(size_t idx = 1; idx <= count; idx += 1)
+            last = buffer.publish("WorkItem-" + std::to_string(idx), priority);
+        size_t length = last.valid() ? last.get() : 0;
+        std::cout << "Published " << count << " items, queue length: " << length << "\n";
+        return EXIT_SUCCESS;
     }
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return run(pub);
+}
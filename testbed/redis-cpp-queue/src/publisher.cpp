@@ -1,9 +1,101 @@
 #include "publisher.h"
 
-rds::Publisher::Publisher(std::string const &host, uint16_t port, std::string const &queue)
-:RedisBase(host, port, queue){}
+rds::Publisher::Publisher(
+    std::string const &host, uint16_t port, std::string const &queue, rq::Layout layout, 
+    bool cluster)
+:RedisBase(host, port, queue, cluster)
+{
+    if (layout == rq::Layout::STREAM) _stream_name = rq::QueueKeys(_q_name, layout).processing;
+}
+
+void rds::Publisher::use_priorities(size_t levels)
+{
+    if (!_stream_name.empty())
+        throw std::runtime_error("Priority levels are not supported by the stream layout");
+    _levels = std::max<size_t>(levels, 1);
+    _doorbell_name = rq::doorbell_key(_q_name);
+    _load_script();
+}
+
+void rds::Publisher::use_envelopes(std::chrono::milliseconds dedupe_window)
+{
+    if (dedupe_window.count() > 0 && !_stream_name.empty())
+        throw std::runtime_error("Dropping duplicates is not supported by the stream layout");
+    _envelopes = true;
+    _dedupe_window = dedupe_window;
+    _window_arg = std::to_string(dedupe_window.count());
+    _dedupe_name = rq::QueueKeys(_q_name).dedupe;
+    _load_script();
+}
+
+void rds::Publisher::_load_script()
+{
+    _publish_script = (_dedupe_window.count() > 0) ? rq::scripts::PUBLISH_DEDUPE 
+        : (_levels > 1) ? rq::scripts::PUBLISH_PRIORITY : nullptr;
+    if (_publish_script != nullptr) _publish_sha = ctx -> script_load(_publish_script);
+}
+
+std::vector<std::string> rds::Publisher::_script_keys(size_t priority) const
+{
+    std::vector<std::string> keys = {_level_name(priority)};
+    if (_dedupe_window.count() > 0) keys.push_back(_dedupe_name);
+    if (_levels > 1) keys.push_back(_doorbell_name);
+    return keys;
+}
+
+std::optional<sw::redis::QueuedReplies> rds::Publisher::_send(
+    sw::redis::Pipeline &pipe, std::vector<std::exception_ptr> const *failures, 
+    std::exception_ptr &error)
+{
+    try
+    {
+        return pipe.exec();
+    }
+    catch(...)
+    {
+        if (failures == nullptr) throw;
+        error = std::current_exception();
+    }
+    return std::nullopt;
+}
+
+std::string rds::Publisher::_level_name(size_t priority) const
+{
+    if (priority >= _levels) throw std::runtime_error("Priority level out of range");
+    return rq::priority_key(_q_name, priority);
+}
+
+size_t rds::Publisher::length() const
+{
+    if (!_stream_name.empty()) return ctx -> xlen(_stream_name);
+    size_t length = 0;
+    for (size_t priority = 0; priority < _levels; priority += 1) 
+        length += ctx -> llen(_level_name(priority));
+    return length;
+}
 
-size_t rds::Publisher::publish(std::string const &item)
+size_t rds::Publisher::publish(std::string const &item, size_t priority)
 {
-    return ctx -> rpush(_q_name, item);
-}
\ No newline at end of file
+    std::string wrapped = _envelopes ? rq::envelope(item) : std::string();
+    sw::redis::StringView value = _envelopes 
+        ? sw::redis::StringView(wrapped) : sw::redis::StringView(item);
+    if (_publish_script != nullptr)
+    {
+        std::vector<std::string> keys = _script_keys(priority);
+        std::vector<sw::redis::StringView> args;
+        if (_dedupe_window.count() > 0) args.emplace_back(_window_arg);
+        args.push_back(value);
+        long long result = 0;
+        _with_script([&]()
+        {
+            result = ctx -> evalsha<long long>(
+                _publish_sha, keys.begin(), keys.end(), args.begin(), args.end());
+        });
+        return result;
+    }
+    if (priority > 0) throw std::runtime_error("Priority level out of range");
+    if (_stream_name.empty()) return ctx -> rpush(_q_name, value);
+    std::pair<sw::redis::StringView, sw::redis::StringView> entry[1] = {{rq::STREAM_FIELD, value}};
+    ctx -> xadd(_stream_name, "*", entry, entry + 1);
+    return 1;
+}
@@ -1,13 +1,288 @@
+#include <atomic>
 #include <iostream>
 #include <unistd.h>
+#include <getopt.h>
 #include "subscriber.h"
+#include "worker_pool.h"
+#include "prefetcher.h"
+#include "batcher.h"
+#include "notifier.h"
+#include "keys.h"
+#include "stats.h"
+#include "priority.h"
+#include "sharded_queue.h"
+#include "item_id.h"
+#include "cli.h"
 
-int main(int argc, const char** argv)
+// Runs a worker pool on a queue spread over shards, which are assigned to 
+// the hosts in turn. Every fetcher leases from its own home shard first and 
+// steals from the others while it is empty.
+static int run_sharded(
+    std::vector<std::string> const &hosts, uint16_t port, std::string const &queue,
+    size_t shards, size_t workers, size_t fetchers, rq::Layout layout,
+    size_t levels, std::vector<unsigned> const &weights, bool cluster, bool replica_reads)
 {
-    const std::string host = (argc > 1) ? argv[1] : "localhost";
-    const uint16_t port = (argc > 2) ? *argv[2] : 8888;
-    const std::string queue = (argc > 3) ? argv[3] : "foo";
-    rds::Subscriber sub = rds::Subscriber(host, port, queue);
+    typedef rq::ShardedQueue<rds::Subscriber, std::chrono::seconds> ShardedQueue;
+    rq::WorkerPoolOptions<std::chrono::seconds> opts;
+    opts.fetchers = fetchers;
+    opts.workers = workers;
+    opts.lease_duration = std::chrono::seconds(5);
+    opts.lease_timeout = std::chrono::seconds(2);
+    std::atomic<size_t> next_home{0};
+    rq::WorkerPool<ShardedQueue, std::chrono::seconds> pool = {
+        [&]()
+        {
+            std::vector<std::unique_ptr<rds::Subscriber>> subs;
+            for (size_t shard = 0; shard < shards; shard += 1)
+            {
+                // On a cluster every shard is tagged on its own, so that the 
+                // shards spread over the primaries
+                subs.push_back(std::make_unique<rds::Subscriber>(
+                    hosts[shard % hosts.size()], port, rq::shard_name(queue, shard), layout, 
+                    cluster, replica_reads));
+                if (levels > 1) subs.back() -> use_priorities(levels, weights);
+            }
+            return std::make_unique<ShardedQueue>(
+                std::move(subs), next_home++, std::chrono::seconds(1));
+        },
+        opts };
+    std::cout << "Worker pool on " << shards << " shards with " << fetchers << " fetchers, " 
+        << workers << " workers\n";
+    pool.run([](auto &pool, rds::LeasedItem const &leased)
+    {
+        if (rq::payload_of(leased.item) == "EOQ")
+        {
+            pool.stop();
+            return;
+        }
+        std::cout << ("Working on item: " + std::string(rq::payload_of(leased.item)) + "\n");
+        sleep(2); // Mocking a long running work
+    });
+    std::cout << "Last item processed exiting" << "\n";
+    return EXIT_SUCCESS;
+}
+
+// Options of the subscriber, every mode is selected by its own option
+static const char *USAGE = 
+    "Usage: sub_daemon [options]\n"
+    "  -H, --host HOST        redis server, cluster seed node, or comma separated\n"
+    "                         servers of the shards\n"
+    "  -p, --port PORT        redis port, default 8888\n"
+    "  -q, --queue NAME       queue name, default foo\n"
+    "  -w, --workers N        worker pool with N worker threads\n"
+    "  -f, --fetchers N       fetcher threads of the worker pool, default 1\n"
+    "  -n, --notify           wake idle fetchers with keyspace notifications\n"
+    "  -l, --layout LAYOUT    list, zset or stream, default list\n"
+    "      --levels N         number of priority levels, default 1\n"
+    "      --weights W        weights of the levels from level 0, e.g., 1,2,4\n"
+    "      --shards N         spread the queue over N shards\n"
+    "      --cluster          the host is a seed node of a redis cluster\n"
+    "      --replica-reads    read depth and lease checks from replicas, implies\n"
+    "                         --cluster\n"
+    "      --prefetch N       keep N items leased ahead of the single worker\n"
+    "      --batch N          hand the single worker batches of up to N items\n"
+    "      --batch-delay MS   time a batch waits to fill up, default 5\n"
+    "  -h, --help             show this help\n";
+
+int main(int argc, char** argv)
+{
+    std::string host = "localhost";
+    uint16_t port = 8888;
+    std::string queue = "foo";
+    // Worker pool mode is enabled by a non zero number of worker threads
+    size_t workers = 0;
+    size_t fetchers = 1;
+    // Idle fetchers are woken by keyspace notifications instead of polling
+    bool notify = false;
+    rq::Layout layout = rq::Layout::LIST;
+    // Number of priority levels and their weights from level 0 e.g., 1,2,4, 
+    // without weights higher levels are always served first
+    size_t levels = 1;
+    std::vector<unsigned> weights;
+    // Spreads the queue over shards, the host may be a comma separated list 
+    // of servers holding the shards in turn
+    size_t shards = 1;
+    // The host is a seed node of a redis cluster, with replica reads depth 
+    // and lease checks are also read from replicas
+    bool cluster = false;
+    bool replica_reads = false;
+    // Keeps the given number of items leased ahead of the single worker, so 
+    // that the next lease overlaps with the work on the current item
+    size_t prefetch = 0;
+    // Hands the single worker batches of up to the given number of items, 
+    // waiting at most the given milliseconds for a batch to fill up
+    size_t max_batch = 1;
+    std::chrono::milliseconds max_delay(5);
+    enum { LEVELS = 256, WEIGHTS, SHARDS, CLUSTER, REPLICA_READS, PREFETCH, BATCH, BATCH_DELAY };
+    const option options[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "queue", required_argument, nullptr, 'q' },
+        { "workers", required_argument, nullptr, 'w' },
+        { "fetchers", required_argument, nullptr, 'f' },
+        { "notify", no_argument, nullptr, 'n' },
+        { "layout", required_argument, nullptr, 'l' },
+        { "levels", required_argument, nullptr, LEVELS },
+        { "weights", required_argument, nullptr, WEIGHTS },
+        { "shards", required_argument, nullptr, SHARDS },
+        { "cluster", no_argument, nullptr, CLUSTER },
+        { "replica-reads", no_argument, nullptr, REPLICA_READS },
+        { "prefetch", required_argument, nullptr, PREFETCH },
+        { "batch", required_argument, nullptr, BATCH },
+        { "batch-delay", required_argument, nullptr, BATCH_DELAY },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 } };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "H:p:q:w:f:nl:h", options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host = optarg; break;
+            case 'p': port = rq::cli::port(optarg); break;
+            case 'q': queue = optarg; break;
+            case 'w': workers = rq::cli::number("workers", optarg); break;
+            case 'f': fetchers = rq::cli::number("fetchers", optarg); break;
+            case 'n': notify = true; break;
+            case 'l': layout = rq::layout_from(optarg); break;
+            case LEVELS: levels = rq::cli::number("levels", optarg); break;
+            case WEIGHTS: weights = rq::weights_from(optarg); break;
+            case SHARDS: shards = rq::cli::number("shards", optarg); break;
+            case CLUSTER: cluster = true; break;
+            case REPLICA_READS: cluster = replica_reads = true; break;
+            case PREFETCH: prefetch = rq::cli::number("prefetch", optarg); break;
+            case BATCH: max_batch = rq::cli::number("batch", optarg); break;
+            case BATCH_DELAY: 
+                max_delay = std::chrono::milliseconds(rq::cli::number("batch-delay", optarg));
+                break;
+            case 'h':
+                std::cout << USAGE;
+                return EXIT_SUCCESS;
+            default:
+                std::cout << USAGE;
+                return EXIT_FAILURE;
+        }
+    }
+    // Stream items arrive on the stream rather than the main queue, items of
+    // priority queues ring their doorbell
+    const std::string notify_key = (layout == rq::Layout::STREAM) 
+        ? queue + rq::processing_suffix(layout) 
+        : (levels > 1) ? rq::doorbell_key(queue) : queue;
+    // Counters and latency histograms are written to the file named by 
+    // RQUEUE_STATS every 10 seconds, as JSON if it ends with .json and as 
+    // Prometheus text otherwise
+    std::unique_ptr<rq::stats::Exporter> exporter;
+    if (const char *path = getenv("RQUEUE_STATS"))
+        exporter = std::make_unique<rq::stats::Exporter>(path, std::chrono::seconds(10));
+    if (shards > 1)
+    {
+        if (workers == 0 || notify) 
+            throw std::runtime_error("Sharded queues need the worker pool without notifications");
+        return run_sharded(
+            rq::list_from(host), port, queue, shards, workers, fetchers, layout, levels, weights, 
+            cluster, replica_reads);
+    }
+    // Notifications are published by the node of the key only
+    if (notify && cluster) 
+        throw std::runtime_error("Keyspace notifications are not supported on a cluster");
+    if (workers > 0)
+    {
+        rq::WorkerPoolOptions<std::chrono::seconds> opts;
+        opts.fetchers = fetchers;
+        opts.workers = workers;
+        opts.lease_duration = std::chrono::seconds(5);
+        opts.lease_timeout = std::chrono::seconds(2);
+        std::unique_ptr<rds::KeyspaceNotifier> notifier;
+        if (notify)
+        {
+            notifier = std::make_unique<rds::KeyspaceNotifier>(host, port, notify_key, true);
+            opts.wait.wakeup = notifier -> wakeup();
+        }
+        rq::WorkerPool<rds::Subscriber, std::chrono::seconds> pool = {
+            [&]() 
+            { 
+                auto sub = std::make_unique<rds::Subscriber>(
+                    host, port, queue, layout, cluster, replica_reads);
+                if (levels > 1) sub -> use_priorities(levels, weights);
+                return sub;
+            },
+            opts };
+        std::cout << "Worker pool with " << fetchers << " fetchers, " << workers << " workers\n";
+        pool.run([](auto &pool, rds::LeasedItem const &leased)
+        {
+            if (rq::payload_of(leased.item) == "EOQ")
+            {
+                pool.stop();
+                return;
+            }
+            std::cout << ("Working on item: " + std::string(rq::payload_of(leased.item)) + "\n");
+            sleep(2); // Mocking a long running work
+        });
+        std::cout << "Last item processed exiting" << "\n";
+        return EXIT_SUCCESS;
+    }
+    if (max_batch > 1)
+    {
+        rq::BatchOptions<std::chrono::seconds> opts;
+        opts.max_batch = max_batch;
+        opts.max_delay = max_delay;
+        opts.lease_duration = std::chrono::seconds(5);
+        opts.lease_timeout = std::chrono::seconds(2);
+        opts.heartbeat = std::chrono::milliseconds(5000 / 3);
+        auto sub = std::make_unique<rds::Subscriber>(
+            host, port, queue, layout, cluster, replica_reads);
+        if (levels > 1) sub -> use_priorities(levels, weights);
+        std::cout << "Working wit sessionID: " << sub -> session() 
+            << ", batches of up to " << max_batch << " items\n";
+        rq::Batcher<rds::Subscriber, std::chrono::seconds> batcher = { std::move(sub), opts };
+        batcher.run([](auto &batcher, auto batch, rq::BatchOutcome &outcome)
+        {
+            std::cout << "Working on batch of " << batch.size() << " items\n";
+            for (size_t idx = 0; idx < batch.size(); idx += 1)
+            {
+                if (rq::payload_of(batch[idx].item) == "EOQ") batcher.stop();
+                // Empty payloads stand for items the work cannot handle, 
+                // they return to the queue without the rest of the batch
+                else if (rq::payload_of(batch[idx].item).empty()) outcome.fail(idx);
+            }
+            sleep(2); // Mocking a long running work on the whole batch
+        });
+        std::cout << "Last item processed exiting" << "\n";
+        return EXIT_SUCCESS;
+    }
+    if (prefetch > 0)
+    {
+        rq::PrefetchOptions<std::chrono::seconds> opts;
+        opts.depth = prefetch;
+        opts.lease_duration = std::chrono::seconds(5);
+        opts.lease_timeout = std::chrono::seconds(2);
+        // Buffered items are renewed while they wait for the worker
+        opts.heartbeat = std::chrono::milliseconds(5000 / 3);
+        auto sub = std::make_unique<rds::Subscriber>(
+            host, port, queue, layout, cluster, replica_reads);
+        if (levels > 1) sub -> use_priorities(levels, weights);
+        std::cout << "Working wit sessionID: " << sub -> session() 
+            << ", prefetching " << prefetch << " items\n";
+        rq::Prefetcher<rds::Subscriber, std::chrono::seconds> prefetcher = { std::move(sub), opts };
+        while (true)
+        {
+            std::optional<rds::LeasedItem> leased = prefetcher.next();
+            if (!leased)
+            {
+                std::cout << "Waiting for work..." << "\n";
+                continue;
+            }
+            if (rq::payload_of(leased -> item) == "EOQ") break;
+            std::cout << "Working on item: " << rq::payload_of(leased -> item) << "\n";
+            sleep(2); // Mocking a long running work
+            prefetcher.complete(std::move(*leased));
+        }
+        // Items leased ahead of the end of the queue go back to it
+        prefetcher.stop();
+        std::cout << "Last item processed exiting" << "\n";
+        return EXIT_SUCCESS;
+    }
+    rds::Subscriber sub = rds::Subscriber(host, port, queue, layout, cluster, replica_reads);
+    if (levels > 1) sub.use_priorities(levels, weights);
     std::cout << "Working wit sessionID: " << sub.session() <<  "\n";
     std::string q_state = (sub.empty() == 1) ? "True" : "False";
     std::cout << "Inital queue state: " << q_state << "\n";
@@ -17,15 +292,15 @@ int main(int argc, const char** argv)
         if (item.has_value())
         {
             std::string value = item.value();
-            if (value == "EOQ") break;
-            std::cout << "Working on item: " << item.value() << "\n";
+            // Items keep their envelope until they are completed
+            if (rq::payload_of(value) == "EOQ") break;
+            std::cout << "Working on item: " << rq::payload_of(value) << "\n";
             sleep(2); // Mocking a long running work
             sub.complete(value);
         }else
         {
             std::cout << "Waiting for work..." << "\n";
         }
-        sleep(1);
     }
     std::cout << "Last item processed exiting" << "\n";
     return EXIT_SUCCESS;
@@ -1,31 +1,277 @@
+#include <stdexcept>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include "subscriber.h"
+#include "stats.h"
 
+namespace
+{
+    using rq::stats::Counter;
+    using rq::stats::Command;
+    constexpr rq::stats::Client CLIENT = rq::stats::Client::REDIS_PLUS_PLUS;
+
+    /// @brief Length of a script call in RESP encoding
+    template <typename Keys, typename Args>
+    uint64_t _command_bytes(std::string const &sha, Keys const &keys, Args const &args)
+    {
+        uint64_t bytes = rq::stats::resp_header_bytes(3 + keys.size() + args.size()) 
+            + rq::stats::resp_bulk_bytes(7) + rq::stats::resp_bulk_bytes(sha.size()) 
+            + rq::stats::resp_bulk_bytes(std::to_string(keys.size()).size());
+        for (sw::redis::StringView key: keys) bytes += rq::stats::resp_bulk_bytes(key.size());
+        for (sw::redis::StringView arg: args) bytes += rq::stats::resp_bulk_bytes(arg.size());
+        return bytes;
+    }
 
-rds::Subscriber::Subscriber(std::string const &host, uint16_t port, std::string const &queue)
-:RedisBase(host, port, queue)
+    /// @brief Lengths of script replies in RESP encoding
+    uint64_t _reply_bytes(long long value)
+    {
+        return rq::stats::resp_header_bytes((value < 0) ? 0 - (uint64_t) value : (uint64_t) value);
+    }
+
+    uint64_t _reply_bytes(std::vector<long long> const &values)
+    {
+        uint64_t bytes = rq::stats::resp_header_bytes(values.size());
+        for (long long value: values) bytes += _reply_bytes(value);
+        return bytes;
+    }
+
+    uint64_t _reply_bytes(std::vector<std::string> const &values)
+    {
+        uint64_t bytes = rq::stats::resp_header_bytes(values.size());
+        for (std::string const &value: values) bytes += rq::stats::resp_bulk_bytes(value.size());
+        return bytes;
+    }
+} // namespace
+
+
+rds::Subscriber::Subscriber(
+    std::string const &host, uint16_t port, std::string const &queue, rq::Layout layout, 
+    bool cluster, bool replica_reads)
+:RedisBase(host, port, queue, cluster, replica_reads), _layout(layout)
 {
     _session = boost::uuids::to_string(boost::uuids::random_generator_mt19937()());
-    _proc_q_name = _q_name + ":processing";
-    _lease_key_pref = _q_name + ":leased_by_session:";
+    // Every layout uses its own processing key, so that layouts can never 
+    // collide on a key of the wrong type
+    rq::QueueKeys keys(_q_name, _layout);
+    _proc_q_name = std::move(keys.processing);
+    _payloads_name = std::move(keys.payloads);
+    _lease_key_pref = std::move(keys.lease_prefix);
+    _completed_name = std::move(keys.completed);
+    _group = rq::STREAM_GROUP;
+    switch (_layout)
+    {
+        case rq::Layout::ZSET:
+            _lease_script = rq::scripts::LEASE_ZSET;
+            _complete_script = rq::scripts::COMPLETE_ZSET;
+            break;
+        case rq::Layout::STREAM:
+            // Entries are acknowledged and deleted without a script
+            _lease_script = rq::scripts::LEASE_STREAM;
+            _complete_script = nullptr;
+            _create_group();
+            break;
+        default:
+            _lease_script = rq::scripts::LEASE;
+            _complete_script = rq::scripts::COMPLETE;
+    }
+    _lease_sha = ctx -> script_load(_lease_script);
+    if (_complete_script != nullptr) _complete_sha = ctx -> script_load(_complete_script);
+    _release_sha = ctx -> script_load(rq::scripts::RELEASE);
+    _lease_exist_sha = reader().script_load(rq::scripts::LEASE_EXISTS);
+    _depth_sha = reader().script_load(rq::scripts::DEPTH);
 }
 
-inline size_t rds::Subscriber::_key_for(std::string const &item) const
+void rds::Subscriber::use_priorities(size_t levels, std::vector<unsigned> const &weights)
 {
-    return std::hash<std::string>{}(item);
+    if (_layout == rq::Layout::STREAM)
+        throw std::runtime_error("Priority levels are not supported by the stream layout");
+    _priorities = rq::PrioritySchedule(levels, weights);
+    _level_names = _priorities.keys(_q_name);
+    _doorbell_name = rq::doorbell_key(_q_name);
+    _lease_script = _priorities.enabled() ? rq::scripts::LEASE_PRIORITY 
+        : (_layout == rq::Layout::ZSET) ? rq::scripts::LEASE_ZSET : rq::scripts::LEASE;
+    _lease_sha = ctx -> script_load(_lease_script);
 }
 
-bool rds::Subscriber::_lease_exist(std::string const &item) const
+void rds::Subscriber::_create_group()
 {
-    sw::redis::StringView key = _lease_key_pref + std::to_string(_key_for(item));
-    return ctx -> exists(key) == 1;
+    try
+    {
+        ctx -> xgroup_create(_proc_q_name, _group, "0", true);
+    }
+    catch(sw::redis::ReplyError const &err)
+    {
+        // Another subscriber created the group first
+        if (std::string(err.what()).rfind("BUSYGROUP", 0) != 0) throw;
+    }
 }
 
-bool rds::Subscriber::empty() const
+void rds::Subscriber::_ack(std::vector<sw::redis::StringView> const &ids)
 {
-    return ctx -> llen(_q_name) && ctx -> llen(_proc_q_name);
+    sw::redis::Pipeline pipe = ctx -> pipeline(false);
+    pipe.xack(_proc_q_name, _group, ids.begin(), ids.end());
+    pipe.xdel(_proc_q_name, ids.begin(), ids.end());
+    pipe.exec();
+}
+
+template <typename Result, typename Keys, typename Args>
+Result rds::Subscriber::_evalsha(
+    std::string &sha, const char *script, Keys const &keys, Args const &args, 
+    sw::redis::Redis *client) const
+{
+    if (client == nullptr) client = ctx.get();
+    rq::stats::count(CLIENT, Counter::BYTES_OUT, _command_bytes(sha, keys, args));
+    try
+    {
+        Result result;
+        try
+        {
+            result = client -> evalsha<Result>(
+                sha, keys.begin(), keys.end(), args.begin(), args.end());
+        }
+        catch(sw::redis::ReplyError const &err)
+        {
+            // Script cache was flushed e.g., by SCRIPT FLUSH or a restart
+            if (std::string(err.what()).rfind("NOSCRIPT", 0) != 0) throw;
+            sha = client -> script_load(script);
+            result = client -> evalsha<Result>(
+                sha, keys.begin(), keys.end(), args.begin(), args.end());
+        }
+        rq::stats::count(CLIENT, Counter::BYTES_IN, _reply_bytes(result));
+        return result;
+    }
+    catch(sw::redis::IoError const&)
+    {
+        // The client drops the broken connection and opens a new one
+        rq::stats::count(CLIENT, Counter::RECONNECTS);
+        throw;
+    }
+    catch(sw::redis::ClosedError const&)
+    {
+        rq::stats::count(CLIENT, Counter::RECONNECTS);
+        throw;
+    }
+}
+
+bool rds::Subscriber::_lease_exist(std::string const &item)
+{
+    return _evalsha<long long>(
+        _lease_exist_sha, rq::scripts::LEASE_EXISTS, {}, {_lease_key_pref, item}, 
+        &reader()) == 1;
+}
+
+std::vector<std::string> rds::Subscriber::_lease(size_t count, std::chrono::seconds const &duration)
+{
+    rq::stats::Timer timer(CLIENT, (count == 1) ? Command::LEASE : Command::LEASE_BATCH);
+    std::vector<std::string> leased;
+    if (_priorities.enabled())
+    {
+        std::vector<sw::redis::StringView> keys = {_proc_q_name, _payloads_name, _doorbell_name};
+        keys.insert(keys.end(), _level_names.begin(), _level_names.end());
+        std::string first = std::to_string(_priorities.first_position(_priority_ticket++));
+        leased = _evalsha<std::vector<std::string>>(
+            _lease_sha, _lease_script, keys, 
+            {_lease_key_pref, _session, (_layout == rq::Layout::ZSET) ? "zset" : "list", 
+            std::to_string(duration.count()), std::to_string(count), first});
+    } else if (_layout != rq::Layout::STREAM)
+    {
+        leased = _evalsha<std::vector<std::string>>(
+            _lease_sha, _lease_script, 
+            {_q_name, _proc_q_name, _payloads_name}, 
+            {_lease_key_pref, _session, std::to_string(duration.count()), std::to_string(count)});
+    } else
+    {
+        // Stream leases reply with item and entry id pairs, or with the 
+        // last entry id of the stream if nothing was leased, followed by 
+        // the cursor of the next claim
+        leased = _evalsha<std::vector<std::string>>(
+            _lease_sha, _lease_script, {_proc_q_name}, 
+            {_group, _session, std::to_string(duration.count()), std::to_string(count), 
+            _claim_cursor});
+        if (!leased.empty())
+        {
+            _claim_cursor = std::move(leased.back());
+            leased.pop_back();
+        }
+        if (leased.size() == 1)
+        {
+            _stream_cursor = std::move(leased[0]);
+            leased.clear();
+        }
+    }
+    if (leased.size() >= 2) rq::stats::count(CLIENT, Counter::LEASES, leased.size() / 2);
+    else rq::stats::count(CLIENT, Counter::EMPTIES);
+    return leased;
+}
+
+template <typename Attempt>
+bool rds::Subscriber::_await(std::chrono::seconds const &timeout, Attempt attempt)
+{
+    // Moving the tail of the main queue onto itself leaves the queue 
+    // unchanged, but lets us block on the server until an item arrives. 
+    // Another worker may take that item first, so keep waiting until the 
+    // deadline. A zero timeout blocks indefinitely. Items may arrive without
+    // waking us, e.g., items pushed to level 0 of a priority queue without 
+    // ringing its doorbell, so the wait ends with one more attempt.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        double remaining = 0;
+        if (timeout.count() > 0)
+        {
+            remaining = std::chrono::duration<double>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return attempt();
+        }
+        bool ready = false;
+        {
+            rq::stats::Timer timer(CLIENT, Command::BLOCK);
+            if (_layout == rq::Layout::STREAM)
+            {
+                // Reading without a group does not deliver the entry, the 
+                // lease script claims it afterwards
+                long long block = (long long) (remaining * 1000);
+                if (timeout.count() > 0 && block == 0) block = 1;
+                sw::redis::ReplyUPtr reply = ctx -> command(
+                    "XREAD", "COUNT", "1", "BLOCK", std::to_string(block), "STREAMS", 
+                    _proc_q_name, _stream_cursor.empty() ? "$" : _stream_cursor);
+                ready = reply && !sw::redis::reply::is_nil(*reply);
+            } else
+            {
+                // Rotating the head onto itself stays out of the rpush 
+                // events the notifier wakes on. Priority queues ring their 
+                // doorbell for items of any level.
+                std::string const &watched = _priorities.enabled() ? _doorbell_name : _q_name;
+                ready = ctx -> command<sw::redis::OptionalString>(
+                    "BLMOVE", watched, watched, "LEFT", "LEFT", remaining).has_value();
+            }
+        }
+        if (!ready)
+        {
+            rq::stats::count(CLIENT, Counter::TIMEOUTS);
+            return attempt();
+        }
+        if (attempt()) return true;
+    }
+}
+
+rq::QueueDepth rds::Subscriber::depth() const
+{
+    rq::stats::Timer timer(CLIENT, Command::DEPTH);
+    const char *layout = "list";
+    if (_layout == rq::Layout::ZSET) layout = "zset";
+    else if (_layout == rq::Layout::STREAM) layout = "stream";
+    // Levels above the main queue are passed as further keys
+    std::vector<sw::redis::StringView> keys = {_q_name, _proc_q_name};
+    if (!_level_names.empty()) keys.insert(keys.end(), _level_names.begin(), _level_names.end() - 1);
+    std::vector<long long> counts = _evalsha<std::vector<long long>>(
+        _depth_sha, rq::scripts::DEPTH, keys, {layout, _group}, &reader());
+    if (counts.size() != 2) throw std::runtime_error("Could not read queue depth");
+    rq::QueueDepth depth;
+    depth.pending = counts[0];
+    depth.processing = counts[1];
+    return depth;
 }
 
 sw::redis::OptionalString rds::Subscriber::lease(
@@ -34,20 +280,174 @@ sw::redis::OptionalString rds::Subscriber::lease(
     bool blocking)
 {
     sw::redis::OptionalString item;
-    (blocking)
-        ? item = ctx -> brpoplpush(_q_name, _proc_q_name, timeout)
-        : item = ctx -> brpoplpush(_q_name, _proc_q_name);
-    if (item.has_value())
+    auto attempt = [&]()
     {
-        std::string key = _lease_key_pref + std::to_string(_key_for(item.value()));
-        ctx -> setex(key, duration, _session);
-    }
+        std::vector<std::string> leased = _lease(1, duration);
+        if (leased.size() < 2) return false;
+        if (_heartbeat) _heartbeat -> track(leased[0], leased[1]);
+        if (_layout == rq::Layout::STREAM) _stream_ids.emplace(leased[0], leased[1]);
+        item = std::move(leased[0]);
+        return item.has_value();
+    };
+    if (!attempt() && blocking) _await(timeout, attempt);
     return item;
 }
 
+std::vector<rds::LeasedItem> rds::Subscriber::lease_batch(
+    size_t n,
+    std::chrono::seconds const &duration, 
+    std::chrono::seconds const &timeout,  
+    bool blocking)
+{
+    std::vector<LeasedItem> items;
+    if (n == 0) return items;
+    auto attempt = [&]()
+    {
+        std::vector<std::string> leased = _lease(n, duration);
+        items.reserve(leased.size() / 2);
+        for (size_t idx = 0; idx + 1 < leased.size(); idx += 2)
+        {
+            if (_heartbeat) _heartbeat -> track(leased[idx], leased[idx + 1]);
+            items.push_back({std::move(leased[idx]), std::move(leased[idx + 1])});
+        }
+        return !items.empty();
+    };
+    if (!attempt() && blocking) _await(timeout, attempt);
+    return items;
+}
+
 void rds::Subscriber::complete(std::string const &item)
 {
-    ctx -> lrem(_proc_q_name, 0, item);
-    std::string _key = _lease_key_pref + std::to_string(_key_for(item));
-    ctx -> del(_key);
-}
\ No newline at end of file
+    // Released first, so that the heartbeat never mistakes a completed 
+    // lease for a lost one
+    if (_heartbeat) _heartbeat -> release_item(item);
+    rq::stats::Timer timer(CLIENT, Command::COMPLETE);
+    if (_layout == rq::Layout::STREAM)
+    {
+        auto found = _stream_ids.find(item);
+        if (found == _stream_ids.end()) 
+            throw std::runtime_error("Item was not leased by this subscriber");
+        std::string id = std::move(found -> second);
+        _stream_ids.erase(found);
+        _ack({id});
+        return;
+    }
+    _evalsha<long long>(
+        _complete_sha, _complete_script, 
+        {_proc_q_name, _payloads_name, _completed_name}, {_lease_key_pref, item});
+}
+
+void rds::Subscriber::complete_batch(std::vector<LeasedItem> const &items)
+{
+    if (items.empty()) return;
+    if (_heartbeat)
+        for (LeasedItem const &leased: items) _heartbeat -> release(leased.lease_key);
+    rq::stats::Timer timer(CLIENT, Command::COMPLETE_BATCH);
+    // Items leave the processing queue before their leases are deleted, so 
+    // an item is never seen in processing without a lease
+    std::vector<sw::redis::StringView> keys;
+    keys.reserve(items.size());
+    for (LeasedItem const &leased: items) keys.emplace_back(leased.lease_key);
+    // Lease keys of the stream layout are entry ids
+    if (_layout == rq::Layout::STREAM)
+    {
+        _ack(keys);
+        return;
+    }
+    std::vector<sw::redis::StringView> ids;
+    sw::redis::Pipeline pipe = ctx -> pipeline(false);
+    if (_layout == rq::Layout::LIST)
+    {
+        for (LeasedItem const &leased: items) pipe.lrem(_proc_q_name, 0, leased.item);
+    } else
+    {
+        // Item ids are the suffix of the lease keys
+        ids.reserve(items.size());
+        for (sw::redis::StringView key: keys) ids.push_back(key.substr(_lease_key_pref.size()));
+        pipe.zrem(_proc_q_name, ids.begin(), ids.end());
+        pipe.hdel(_payloads_name, ids.begin(), ids.end());
+    }
+    pipe.del(keys.begin(), keys.end());
+    // Counted without checking the removals, which only differs for items 
+    // whose lease expired while they were processed
+    pipe.incrby(_completed_name, (long long) items.size());
+    pipe.exec();
+}
+
+size_t rds::Subscriber::release_batch(std::vector<LeasedItem> const &items)
+{
+    if (items.empty()) return 0;
+    if (_heartbeat)
+        for (LeasedItem const &leased: items) _heartbeat -> release(leased.lease_key);
+    rq::stats::Timer timer(CLIENT, Command::RELEASE);
+    const char *layout = "list";
+    if (_layout == rq::Layout::ZSET) layout = "zset";
+    else if (_layout == rq::Layout::STREAM) layout = "stream";
+    // Blocked priority leases wait on the doorbell
+    std::vector<sw::redis::StringView> keys = {_q_name, _proc_q_name, _payloads_name};
+    if (_priorities.enabled()) keys.emplace_back(_doorbell_name);
+    std::vector<sw::redis::StringView> args = {
+        layout, (_layout == rq::Layout::STREAM) ? _group : _lease_key_pref, _session};
+    args.reserve(3 + 2 * items.size());
+    for (LeasedItem const &leased: items)
+    {
+        args.emplace_back(leased.item);
+        args.emplace_back(leased.lease_key);
+    }
+    return _evalsha<long long>(_release_sha, rq::scripts::RELEASE, keys, args);
+}
+
+void rds::Subscriber::start_heartbeat(
+    std::chrono::seconds const &duration, 
+    std::chrono::milliseconds const &interval, 
+    rq::Heartbeat::LostHandler on_lost)
+{
+    // The heartbeat only captures what survives moving the subscriber, the 
+    // client itself lives on the heap
+    sw::redis::Redis *redis = ctx.get();
+    bool stream = _layout == rq::Layout::STREAM;
+    const char *script = stream ? rq::scripts::EXTEND_STREAM : rq::scripts::EXTEND;
+    std::string sha = ctx -> script_load(script);
+    // Stream leases are pending entries, their ids are passed as arguments 
+    // and their idle time is reset instead of a key expiry
+    std::vector<std::string> stream_key;
+    std::vector<std::string> args = {_session, std::to_string(duration.count())};
+    if (stream)
+    {
+        stream_key = {_proc_q_name};
+        args = {_group, _session};
+    }
+    auto extend = [redis, sha, script, stream, stream_key, args](
+        std::vector<std::string> const &keys) mutable
+    {
+        std::vector<std::string> const *eval_keys = &keys;
+        std::vector<std::string> eval_args = args;
+        if (stream)
+        {
+            eval_keys = &stream_key;
+            eval_args.insert(eval_args.end(), keys.begin(), keys.end());
+        }
+        rq::stats::Timer timer(CLIENT, Command::EXTEND);
+        std::vector<long long> held;
+        try
+        {
+            held = redis -> evalsha<std::vector<long long>>(
+                sha, eval_keys -> begin(), eval_keys -> end(), eval_args.begin(), eval_args.end());
+        }
+        catch(sw::redis::ReplyError const &err)
+        {
+            if (std::string(err.what()).rfind("NOSCRIPT", 0) != 0) throw;
+            sha = redis -> script_load(script);
+            held = redis -> evalsha<std::vector<long long>>(
+                sha, eval_keys -> begin(), eval_keys -> end(), eval_args.begin(), eval_args.end());
+        }
+        return std::vector<bool>(held.begin(), held.end());
+    };
+    _heartbeat.reset();
+    _heartbeat = std::make_unique<rq::Heartbeat>(extend, interval, std::move(on_lost));
+}
+
+bool rds::Subscriber::lease_held(std::string const &lease_key) const
+{
+    return _heartbeat && _heartbeat -> held(lease_key);
+}
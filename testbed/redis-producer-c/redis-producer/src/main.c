@@ -8,7 +8,7 @@ int main(int argc, char **argv)
 {
     // Define connection properties for redis
     const char *host_name = (argc > 1) ? argv[1] : "redis";
-    uint16_t port = (argc > 2) ? *argv[2] : 6379;
+    uint16_t port = (argc > 2) ? (uint16_t) strtoul(argv[2], NULL, 10) : 6379;
     const char* queue_name = (argc > 3) ? argv[3] : "foo";
     // Attempt to establish connection
     struct timeval timeout = {1, 500000};
@@ -1,12 +1,24 @@
 #! /usr/bin/python3
 
+import os
 import redis
 import time
 
+
+def envelope(payload: bytes) -> bytes:
+    """Wraps a payload in the rq1 envelope carrying its XXH3 128 bit id, the
+    same bytes as rq::envelope in common/include/item_id.h"""
+    import xxhash
+    return b"rq1:" + xxhash.xxh3_128_hexdigest(payload).encode("ascii") \
+        + b":" + payload
+
+
 if __name__ == "__main__":
     r: redis.Redis = redis.Redis(host="redis", port=6379, db=0)
+    # Consumers read the ids of enveloped items instead of hashing them
+    use_envelope: bool = os.environ.get("RQUEUE_ENVELOPE") == "1"
     for idx in range(1, 100):
         value: str = f"bar-{idx}"
         print(f"Publishing {value}")
-        r.rpush("foo", value);
+        r.rpush("foo", envelope(value.encode()) if use_envelope else value);
         time.sleep(1)